@@ -0,0 +1,164 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+#include "../lib/user/tsc.h"
+#include "../lib/user/malloc.h"
+
+/* 直接编入内核的位图实现,在用户态对比新旧扫描的耗时.
+ * NDEBUG去掉ASSERT,免得链接内核的panic_spin */
+#define NDEBUG
+#include "../lib/kernel/bitmap.c"
+
+#define SMALL_BITS 4096      // 与一个小位图(如inode位图)相当
+#define LARGE_BITS (1 << 20) // 与用户虚拟地址位图同一量级
+#define SMALL_ROUNDS 2048
+#define LARGE_ROUNDS 8
+
+/* 原来的扫描:逐字节跳过全1的字节,cnt>1时逐位测试 */
+static int old_bitmap_scan(struct bitmap *btmp, uint32_t cnt)
+{
+    uint32_t idx_byte = 0;
+    while ((idx_byte < btmp->btmp_bytes_len) && (0xff == btmp->bits[idx_byte]))
+    {
+        idx_byte++;
+    }
+    if (idx_byte == btmp->btmp_bytes_len)
+    {
+        return -1;
+    }
+
+    int idx_bit = 0;
+    while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte])
+    {
+        idx_bit++;
+    }
+    int bit_idx_start = idx_byte * 8 + idx_bit;
+    if (cnt == 1)
+    {
+        return bit_idx_start;
+    }
+
+    uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start);
+    uint32_t next_bit = bit_idx_start + 1;
+    uint32_t count = 1;
+    bit_idx_start = -1;
+    while (bit_left-- > 0)
+    {
+        if (!bitmap_scan_test(btmp, next_bit))
+        {
+            count++;
+        }
+        else
+        {
+            count = 0;
+        }
+        if (count == cnt)
+        {
+            bit_idx_start = next_bit - cnt + 1;
+            break;
+        }
+        next_bit++;
+    }
+    return bit_idx_start;
+}
+
+static uint32_t seed = 1;
+
+/* 线性同余伪随机数 */
+static uint32_t next_rand(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+/* 前fill%的位全部占用,之后每4位随机占用1位,模拟首次适配用过一阵后的位图 */
+static void bitmap_fill(struct bitmap *btmp, uint32_t fill)
+{
+    uint32_t bits = btmp->btmp_bytes_len * 8, full = bits / 100 * fill, i;
+    bitmap_init(btmp);
+    bitmap_set_range(btmp, 0, full);
+    for (i = full; i < bits; i++)
+    {
+        if (next_rand() % 4 == 0)
+        {
+            bitmap_set(btmp, i, 1);
+        }
+    }
+}
+
+/* 在给定占用率的位图上找cnt个连续空闲位,分别打印新旧扫描每次的平均周期数 */
+static void bench_scan(struct bitmap *btmp, uint32_t fill, uint32_t cnt, uint32_t rounds)
+{
+    uint32_t i;
+    volatile int sink = 0;
+    bitmap_fill(btmp, fill);
+
+    uint64_t start = rdtsc();
+    for (i = 0; i < rounds; i++)
+    {
+        sink += old_bitmap_scan(btmp, cnt);
+    }
+    uint32_t old_cycles = (uint32_t)(rdtsc() - start) / rounds;
+
+    start = rdtsc();
+    for (i = 0; i < rounds; i++)
+    {
+        sink += bitmap_scan(btmp, cnt);
+    }
+    uint32_t new_cycles = (uint32_t)(rdtsc() - start) / rounds;
+
+    if (old_bitmap_scan(btmp, cnt) != bitmap_scan(btmp, cnt))
+    {
+        printf("bitmap_bench: scan results differ!\n");
+    }
+    printf("%d bits, %d%% full, cnt %d: old %d, new %d cycles\n",
+           btmp->btmp_bytes_len * 8, fill, cnt, old_cycles, new_cycles);
+}
+
+int main(void)
+{
+    static const uint32_t fills[] = {10, 50, 90, 99};
+    static const uint32_t cnts[] = {1, 8, 1024};
+    struct bitmap small, large;
+    uint32_t f, c;
+
+    small.btmp_bytes_len = SMALL_BITS / 8;
+    small.bits = malloc(small.btmp_bytes_len);
+    large.btmp_bytes_len = LARGE_BITS / 8;
+    large.bits = malloc(large.btmp_bytes_len);
+    if (small.bits == NULL || large.bits == NULL)
+    {
+        printf("bitmap_bench: malloc failed\n");
+        while (1)
+            ;
+    }
+
+    for (f = 0; f < sizeof(fills) / sizeof(fills[0]); f++)
+    {
+        for (c = 0; c < sizeof(cnts) / sizeof(cnts[0]); c++)
+        {
+            bench_scan(&small, fills[f], cnts[c], SMALL_ROUNDS);
+        }
+    }
+    /* 1M位时旧扫描找1024个连续位要逐位测试上百万次,rounds取小些 */
+    for (f = 0; f < sizeof(fills) / sizeof(fills[0]); f++)
+    {
+        for (c = 0; c < sizeof(cnts) / sizeof(cnts[0]); c++)
+        {
+            bench_scan(&large, fills[f], cnts[c], LARGE_ROUNDS);
+        }
+    }
+
+    /* 逐位置位与整段置位 */
+    uint64_t start = rdtsc();
+    for (f = 0; f < LARGE_BITS; f++)
+    {
+        bitmap_set(&large, f, 1);
+    }
+    uint32_t per_bit = (uint32_t)(rdtsc() - start);
+    start = rdtsc();
+    bitmap_set_range(&large, 0, LARGE_BITS);
+    printf("set %d bits: per bit %d, range %d cycles\n", LARGE_BITS, per_bit, (uint32_t)(rdtsc() - start));
+    while (1)
+        ;
+    return 0;
+}
@@ -11,11 +11,11 @@ if [[ ! -d "../lib" || ! -d "../build" ]];then
    exit
 fi
 
-BIN="prog_no_arg"
+BIN=${1:-"prog_no_arg"}
 CFLAGS="-m32 -Wall -c -fno-builtin -W -Wstrict-prototypes \
       -Wmissing-prototypes -Wsystem-headers"
 LIB="-I ../lib/"
-OBJS="../build/string.o ../build/syscall.o \
+OBJS="../build/string.o ../build/syscall.o ../build/malloc.o \
       ../build/stdio.o ../build/assert.o"
 DD_IN=$BIN
 DD_OUT="/home/master/MyOS/VirtualMachine/bochs/hd60M.img" 
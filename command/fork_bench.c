@@ -0,0 +1,63 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+#include "../lib/user/tsc.h"
+#include "../lib/user/malloc.h"
+#include "../kernel/global.h"
+
+#define HEAP_PAGES 256 // 测试用堆的页数
+#define PAGE_SIZE 4096
+
+/* 写入heap的前pg_cnt页,每页写一个字节 */
+static void touch_pages(char *heap, uint32_t pg_cnt)
+{
+    uint32_t i;
+    for (i = 0; i < pg_cnt; i++)
+    {
+        heap[i * PAGE_SIZE]++;
+    }
+}
+
+/* 父进程已映射pg_cnt页堆内存时fork的耗时,以及fork后首次写这些页(写时复制)的耗时 */
+static void bench_fork(char *heap, uint32_t pg_cnt)
+{
+    touch_pages(heap, pg_cnt);
+    uint64_t start = rdtsc();
+    int16_t pid = fork();
+    if (pid == 0)
+    { // 没有exit,子进程只睡眠,不占cpu,也就不会复制任何页
+        while (1)
+        {
+            sleep(3600);
+        }
+    }
+    uint64_t fork_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    touch_pages(heap, pg_cnt);
+    uint64_t cow_cycles = rdtsc() - start;
+    printf("%d pages touched: fork %d cycles, first write after fork %d cycles\n",
+           pg_cnt, (uint32_t)fork_cycles, (uint32_t)cow_cycles);
+}
+
+/* meminfo中copy-on-write一行的计数可与各次测试写入的页数对照 */
+int main(void)
+{
+    char *heap = malloc(HEAP_PAGES * PAGE_SIZE);
+    if (heap == NULL)
+    {
+        printf("fork_bench: malloc failed\n");
+        while (1)
+        {
+            sleep(3600);
+        }
+    }
+    bench_fork(heap, 1);
+    bench_fork(heap, 16);
+    bench_fork(heap, HEAP_PAGES);
+    meminfo();
+    while (1)
+    {
+        sleep(3600);
+    }
+    return 0;
+}
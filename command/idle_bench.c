@@ -0,0 +1,19 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+
+#define IDLE_SECONDS 10
+
+/* 睡眠期间系统只有空闲线程可运行.对照前后两次ps最后一行的嘀嗒数和实际时钟中断次数,
+ * 空闲时停掉周期时钟后,这段时间内的时钟中断应明显少于嘀嗒数 */
+int main(void)
+{
+    ps();
+    printf("idle_bench: sleeping %d seconds\n", IDLE_SECONDS);
+    sleep(IDLE_SECONDS);
+    ps();
+    while (1)
+    { // 没有exit,睡眠而不是忙等,不妨碍系统空闲
+        sleep(3600);
+    }
+    return 0;
+}
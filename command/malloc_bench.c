@@ -0,0 +1,61 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+#include "../lib/user/tsc.h"
+#include "../lib/user/malloc.h"
+
+#define PAIRS_SHIFT 20           // 共2^20(约1M)次malloc/free
+#define PAIRS (1 << PAIRS_SHIFT)
+#define BURST 16                 // 突发模式下一次连续申请的块数,超过magazine容量
+
+/* 反复申请后立即释放同一规格的小块内存.
+ * name为"user"时测用户态的malloc/free,为"syscall"时测每次都陷入内核的malloc_pages/free_pages */
+static void bench_pairs(const char *name, void *(*alloc)(uint32_t), void (*release)(void *))
+{
+    uint32_t i;
+    uint64_t start = rdtsc();
+    for (i = 0; i < PAIRS; i++)
+    {
+        void *p = alloc(32);
+        release(p);
+    }
+    uint64_t cycles = rdtsc() - start;
+    printf("%s pairs: %d malloc/free, %d cycles per pair\n", name, PAIRS, (uint32_t)(cycles >> PAIRS_SHIFT));
+}
+
+/* 连续申请BURST块后再全部释放,让空闲块反复合并与切分 */
+static void bench_bursts(const char *name, void *(*alloc)(uint32_t), void (*release)(void *))
+{
+    void *p[BURST];
+    uint32_t i, j;
+    uint64_t start = rdtsc();
+    for (i = 0; i < PAIRS / BURST; i++)
+    {
+        for (j = 0; j < BURST; j++)
+        {
+            p[j] = alloc(32);
+        }
+        for (j = 0; j < BURST; j++)
+        {
+            release(p[j]);
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+    printf("%s bursts of %d: %d malloc/free, %d cycles per pair\n", name, BURST, PAIRS, (uint32_t)(cycles >> PAIRS_SHIFT));
+}
+
+/* 两次meminfo输出中user_pool的lock acquisitions之差即为各测试获取锁的次数,
+ * 用户态的malloc/free只在扩展堆时才进内核 */
+int main(void)
+{
+    meminfo();
+    bench_pairs("syscall", malloc_pages, free_pages);
+    meminfo();
+    bench_bursts("syscall", malloc_pages, free_pages);
+    meminfo();
+    bench_pairs("user", malloc, free);
+    bench_bursts("user", malloc, free);
+    meminfo();
+    while (1)
+        ;
+    return 0;
+}
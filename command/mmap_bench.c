@@ -0,0 +1,82 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+#include "../lib/user/tsc.h"
+#include "../lib/user/assert.h"
+
+#define FILE_PAGES 16 // 测试文件的页数,文件最多140个扇区
+#define PAGE_SIZE 4096
+#define BENCH_FILE "/mmap_bench.dat"
+
+static char buf[PAGE_SIZE];
+
+/* 建好FILE_PAGES页的测试文件,第i页的内容都是字节i */
+static int32_t file_prepare(void)
+{
+    int32_t fd = open(BENCH_FILE, O_CREAT | O_RDWR);
+    if (fd == -1)
+    { // 上次运行时已建好
+        return open(BENCH_FILE, O_RDWR);
+    }
+    uint32_t i, j;
+    for (i = 0; i < FILE_PAGES; i++)
+    {
+        for (j = 0; j < PAGE_SIZE; j++)
+        {
+            buf[j] = i;
+        }
+        write(fd, buf, PAGE_SIZE);
+    }
+    return fd;
+}
+
+/* 用read逐页读出整个文件,数据经内核的扇区缓冲区再复制到buf */
+static void bench_read(int32_t fd)
+{
+    uint32_t i, sum = 0;
+    uint64_t start = rdtsc();
+    lseek(fd, 0, SEEK_SET);
+    for (i = 0; i < FILE_PAGES; i++)
+    {
+        assert(read(fd, buf, PAGE_SIZE) == PAGE_SIZE);
+        sum += (uint8_t)buf[0];
+    }
+    uint64_t cycles = rdtsc() - start;
+    printf("read: %d pages, %d cycles per page (sum %d)\n", FILE_PAGES, (uint32_t)cycles / FILE_PAGES, sum);
+}
+
+/* 映射整个文件后访问前pg_cnt页,只有访问到的页才从磁盘读入 */
+static void bench_mmap(int32_t fd, uint32_t pg_cnt)
+{
+    uint32_t i, sum = 0;
+    uint64_t start = rdtsc();
+    char *map = mmap(NULL, FILE_PAGES * PAGE_SIZE, PROT_READ, 0, fd, 0);
+    assert(map != NULL);
+    for (i = 0; i < pg_cnt; i++)
+    {
+        sum += (uint8_t)map[i * PAGE_SIZE];
+    }
+    munmap(map, FILE_PAGES * PAGE_SIZE);
+    uint64_t cycles = rdtsc() - start;
+    printf("mmap: %d of %d pages touched, %d cycles per touched page (sum %d)\n",
+           pg_cnt, FILE_PAGES, (uint32_t)cycles / pg_cnt, sum);
+}
+
+/* meminfo中demand paging一行的文件页数可与各次测试访问的页数对照 */
+int main(void)
+{
+    int32_t fd = file_prepare();
+    if (fd == -1)
+    {
+        printf("mmap_bench: open %s failed\n", BENCH_FILE);
+        while (1)
+            ;
+    }
+    bench_read(fd);
+    bench_mmap(fd, FILE_PAGES);
+    bench_mmap(fd, 1);
+    close(fd);
+    meminfo();
+    while (1)
+        ;
+    return 0;
+}
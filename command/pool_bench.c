@@ -0,0 +1,81 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+#include "../lib/user/malloc.h"
+#include "../lib/user/assert.h"
+
+#define PAGE_SIZE 4096
+#define MB (1024 * 1024)
+
+/* 以下规模按bochs配置的megs为32时设定:空闲内存对半分时两边各约15M.
+ * 第一阶段fork出的每个子进程在内核中要占页目录、约23页的虚拟地址位图、pcb和页表,
+ * FORK_CHILDREN个子进程足以用完内核内存池原有的一半;
+ * 第二阶段写入的用户内存超过用户内存池原有的一半.
+ * 分界不能移动时两个阶段都会因内存耗尽而失败 */
+#define FORK_CHILDREN 160
+#define TOUCH_MB 20
+#define CHUNK_MB 1
+
+/* 写入heap的前pg_cnt页,每页写一个字节 */
+static void touch_pages(char *heap, uint32_t pg_cnt)
+{
+    uint32_t i;
+    for (i = 0; i < pg_cnt; i++)
+    {
+        heap[i * PAGE_SIZE] = 1;
+    }
+}
+
+/* 大量fork:子进程不访问用户内存,压力都在内核内存池 */
+static void bench_fork_heavy(void)
+{
+    uint32_t i;
+    for (i = 0; i < FORK_CHILDREN; i++)
+    {
+        int16_t pid = fork();
+        if (pid == -1)
+        {
+            printf("pool_bench: fork failed after %d children\n", i);
+            break;
+        }
+        if (pid == 0)
+        { // 没有exit,子进程什么都不做,睡眠而不是忙等,以免占着cpu影响后面的测试
+            while (1)
+            {
+                sleep(3600);
+            }
+        }
+    }
+    printf("fork-heavy: %d children forked\n", i);
+    meminfo();
+}
+
+/* 大量写入用户内存:压力都在用户内存池,每次申请不足4M,都按4K页在缺页时映射 */
+static void bench_touch_heavy(void)
+{
+    uint32_t mb;
+    for (mb = 0; mb < TOUCH_MB; mb += CHUNK_MB)
+    {
+        char *chunk = malloc(CHUNK_MB * MB);
+        if (chunk == NULL)
+        {
+            printf("pool_bench: malloc failed after %d MB\n", mb);
+            break;
+        }
+        touch_pages(chunk, CHUNK_MB * MB / PAGE_SIZE);
+    }
+    printf("touch-heavy: %d MB of user memory written\n", mb);
+    meminfo();
+}
+
+/* meminfo中两个内存池的页数、使用率、借入的4M块数和pool boundary一行反映分界的移动 */
+int main(void)
+{
+    meminfo();
+    bench_fork_heavy();
+    bench_touch_heavy();
+    while (1)
+    {
+        sleep(3600);
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+#include "../lib/user/tsc.h"
+#include "../lib/user/assert.h"
+
+#define NR_SPINNERS 4          // 与测试进程争抢cpu的忙循环进程数
+#define SPIN_SECONDS 30        // 忙循环进程运行的秒数,足够两次测试做完
+#define FILE_SECTORS 64        // 测试文件的扇区数
+#define SECTOR_SIZE 512
+#define BENCH_FILE "/rt_bench.dat"
+
+static char buf[SECTOR_SIZE];
+
+/* 建好FILE_SECTORS个扇区的测试文件 */
+static int32_t file_prepare(void)
+{
+    int32_t fd = open(BENCH_FILE, O_CREAT | O_RDWR);
+    if (fd == -1)
+    { // 上次运行时已建好
+        return open(BENCH_FILE, O_RDWR);
+    }
+    uint32_t i;
+    for (i = 0; i < FILE_SECTORS; i++)
+    {
+        write(fd, buf, SECTOR_SIZE);
+    }
+    return fd;
+}
+
+/* 逐扇区读文件,每次read都要等一次硬盘中断唤醒.忙循环进程越多,
+ * 普通策略下醒来后等待调度的时间越长,实时策略下醒来即可运行 */
+static void bench_read(int32_t fd, char *name)
+{
+    uint32_t i;
+    uint64_t start = rdtsc();
+    lseek(fd, 0, SEEK_SET);
+    for (i = 0; i < FILE_SECTORS; i++)
+    {
+        assert(read(fd, buf, SECTOR_SIZE) == SECTOR_SIZE);
+    }
+    uint64_t cycles = rdtsc() - start;
+    printf("%s: %d sector reads, %d cycles per read\n", name, FILE_SECTORS, (uint32_t)cycles / FILE_SECTORS);
+}
+
+/* ps最后两行是各调度类从唤醒到运行的延迟,可与两次测试的每次读耗时对照 */
+int main(void)
+{
+    int32_t fd = file_prepare();
+    if (fd == -1)
+    {
+        printf("rt_bench: open %s failed\n", BENCH_FILE);
+        while (1)
+        {
+            sleep(3600);
+        }
+    }
+    /* 没有exit也没有kill,忙循环进程按睡眠1秒量出的时钟周期数自行停下,之后只睡眠 */
+    uint64_t start = rdtsc();
+    sleep(1);
+    uint64_t spin_cycles = (rdtsc() - start) * SPIN_SECONDS;
+    uint32_t i;
+    for (i = 0; i < NR_SPINNERS; i++)
+    {
+        if (fork() == 0)
+        {
+            start = rdtsc();
+            while (rdtsc() - start < spin_cycles)
+                ;
+            while (1)
+            {
+                sleep(3600);
+            }
+        }
+    }
+    bench_read(fd, "SCHED_NORMAL");
+    assert(sched_setscheduler(0, SCHED_FIFO, RT_PRIO_MAX) == 0);
+    bench_read(fd, "SCHED_FIFO");
+    sched_setscheduler(0, SCHED_NORMAL, 0);
+    close(fd);
+    ps();
+    while (1)
+    {
+        sleep(3600);
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+#include "../lib/user/tsc.h"
+
+#define NR_SPINNERS 4
+#define PARENT_NICE 19           // 父进程只负责计时,用最低的优先级
+#define PARENT_WEIGHT 15         // nice为19的权重
+#define RUN_CYCLES 0x100000000ULL // 各子进程一起运行这么多个时钟周期后打印ps
+
+/* 各子进程的nice值及内核中对应的权重 */
+static const int32_t spinner_nice[NR_SPINNERS] = {0, 0, 5, 10};
+static const uint32_t spinner_weight[NR_SPINNERS] = {1024, 1024, 335, 110};
+
+/* 按nice值分组的忙循环子进程,运行一段时间后用ps中的TICKS列对照它们实际分得的时间片.
+ * 公平调度下各子进程的TICKS之比应接近权重之比.没有exit,各进程忙等RUN_CYCLES后都只睡眠 */
+int main(void)
+{
+    uint32_t total_weight = PARENT_WEIGHT, i;
+    for (i = 0; i < NR_SPINNERS; i++)
+    {
+        total_weight += spinner_weight[i];
+    }
+
+    setpriority(0, PARENT_NICE);
+    printf("pid  nice  weight  expected share\n");
+    for (i = 0; i < NR_SPINNERS; i++)
+    {
+        int16_t pid = fork();
+        if (pid == 0)
+        {
+            setpriority(0, spinner_nice[i]);
+            uint64_t start = rdtsc();
+            while (rdtsc() - start < RUN_CYCLES)
+                ;
+            while (1)
+            {
+                sleep(3600);
+            }
+        }
+        printf("%d    %d    %d    %d/1000\n", pid, spinner_nice[i], spinner_weight[i],
+               spinner_weight[i] * 1000 / total_weight);
+    }
+
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < RUN_CYCLES)
+        ;
+    ps();
+    while (1)
+    {
+        sleep(3600);
+    }
+    return 0;
+}
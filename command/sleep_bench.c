@@ -0,0 +1,48 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+#include "../lib/user/tsc.h"
+
+#define NR_SLEEPERS 8               // 反复睡眠的子进程数
+#define WINDOW_CYCLES 0x40000000ULL // 每次测量忙循环的时钟周期数
+
+/* 在WINDOW_CYCLES个时钟周期内忙循环,返回完成的迭代数(以1024次为单位).
+ * 其它任务占用的cpu越多,这段时间内本进程分到的越少 */
+static uint32_t spin_window(void)
+{
+    uint32_t iters = 0;
+    uint64_t start = rdtsc();
+    while (rdtsc() - start < WINDOW_CYCLES)
+    {
+        iters++;
+    }
+    return iters >> 10;
+}
+
+/* 对照有无睡眠进程时忙循环的进度:睡眠进程阻塞在定时器上,不被调度,几乎不占cpu.
+ * 之后ps中睡眠进程的TICKS列即它们实际用掉的时间片数 */
+int main(void)
+{
+    uint32_t alone = spin_window();
+    printf("no sleepers: %d k iterations\n", alone);
+
+    uint32_t i;
+    for (i = 0; i < NR_SLEEPERS; i++)
+    {
+        if (fork() == 0)
+        {
+            struct timespec req = {0, 20000000}; // 每次睡20毫秒
+            while (1)
+            {
+                nanosleep(&req);
+            }
+        }
+    }
+    uint32_t with_sleepers = spin_window();
+    printf("%d sleepers waking every 20ms: %d k iterations\n", NR_SLEEPERS, with_sleepers);
+    ps();
+    while (1)
+    { // 没有exit,睡眠而不是忙等,不妨碍系统空闲
+        sleep(3600);
+    }
+    return 0;
+}
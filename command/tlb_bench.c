@@ -0,0 +1,68 @@
+#include "../lib/stdio.h"
+#include "../lib/user/syscall.h"
+#include "../lib/user/tsc.h"
+#include "../lib/user/malloc.h"
+#include "../kernel/global.h"
+
+#define PAGE_SIZE 4096
+#define HUGE_SIZE (4 * 1024 * 1024)
+#define BENCH_SIZE (64 * 1024 * 1024)          // 每种映射方式访问的内存总量
+#define SMALL_CHUNK (HUGE_SIZE - 2 * PAGE_SIZE) // 不足4M的申请只用4K页映射
+#define SMALL_CHUNKS (BENCH_SIZE / SMALL_CHUNK + 1)
+#define ROUNDS 8 // 每种映射方式重复遍历的次数
+
+/* 以4K为步长在chunk_cnt块、每块chunk_size字节的内存上遍历ROUNDS次,
+ * 每次访问都落在不同的4K页上,返回每次访问的平均周期数 */
+static uint32_t strided_walk(char **chunks, uint32_t chunk_cnt, uint32_t chunk_size)
+{
+    uint32_t round, chunk, offset, accesses = 0;
+    uint64_t start = rdtsc();
+    for (round = 0; round < ROUNDS; round++)
+    {
+        for (chunk = 0; chunk < chunk_cnt; chunk++)
+        {
+            for (offset = 0; offset < chunk_size; offset += PAGE_SIZE)
+            {
+                chunks[chunk][offset]++;
+                accesses++;
+            }
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+    return (uint32_t)cycles / accesses;
+}
+
+/* 运行前须保证用户内存池中至少有2*BENCH_SIZE的空闲内存(bochs的megs不小于256).
+ * 第一次遍历时4K页要在缺页中映射,所以先各遍历一遍再计时 */
+int main(void)
+{
+    char *small[SMALL_CHUNKS];
+    char *huge;
+    uint32_t i;
+    for (i = 0; i < SMALL_CHUNKS; i++)
+    {
+        small[i] = malloc(SMALL_CHUNK);
+        if (small[i] == NULL)
+        {
+            printf("tlb_bench: malloc 4K-mapped chunk failed\n");
+            while (1)
+                ;
+        }
+    }
+    huge = malloc(BENCH_SIZE);
+    if (huge == NULL)
+    {
+        printf("tlb_bench: malloc 4M-mapped buffer failed\n");
+        while (1)
+            ;
+    }
+
+    strided_walk(small, SMALL_CHUNKS, SMALL_CHUNK);
+    strided_walk(&huge, 1, BENCH_SIZE);
+    printf("4K pages: %d cycles per access\n", strided_walk(small, SMALL_CHUNKS, SMALL_CHUNK));
+    printf("4M pages: %d cycles per access\n", strided_walk(&huge, 1, BENCH_SIZE));
+    meminfo();
+    while (1)
+        ;
+    return 0;
+}
@@ -269,10 +269,12 @@ void intr_hd_handler(uint8_t irq_no)
     if (channel->expecting_intr)
     {
         channel->expecting_intr = false;
-        sema_up(&channel->disk_done);
 
-        /* 读取状态寄存器使硬盘控制器认为此次的中断已被处理,从而硬盘可以继续执行新的读写 */
+        /* 读取状态寄存器使硬盘控制器认为此次的中断已被处理,从而硬盘可以继续执行新的读写.
+         * 要在唤醒等待者之前读,被唤醒的任务可能马上抢占cpu */
         inb(reg_status(channel));
+        sema_up(&channel->disk_done);
+        thread_preempt(); // 等待者优先级更高时不必等到下一个时钟中断
     }
 }
 
@@ -320,7 +322,7 @@ static void identify_disk(struct disk *hd)
 /* 扫描硬盘hd中地址为ext_lba的扇区中的所有分区 */
 static void partition_scan(struct disk *hd, uint32_t ext_lba)
 {
-    struct boot_sector *bs = sys_malloc(sizeof(struct boot_sector)); // 分配内存用于引导扇区
+    struct boot_sector *bs = sys_malloc_flags(sizeof(struct boot_sector), AF_NOZERO); // 引导扇区随即整个读入,不必清0
     ide_read(hd, ext_lba, bs, 1);                                    // 读取引导扇区
     uint8_t part_idx = 0;                                            // 分区索引
     struct partition_table_entry *p = bs->partition_table;           // 获取分区表
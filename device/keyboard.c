@@ -223,6 +223,7 @@ static void intr_keyboard_handler(void)
                 // put_char(cur_char); // 输出字符到控制台
                 /* 如果键盘缓冲区未满,则将字符放入缓冲区 */
                 ioq_putchar(&kbd_buf, cur_char);
+                thread_preempt(); // 读键盘的任务优先级更高时立即运行它
             }
             return;
         }
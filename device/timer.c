@@ -4,19 +4,148 @@
 #include "../kernel/interrupt.h"
 #include "../thread/thread.h"
 #include "../kernel/debug.h"
+#include "../kernel/global.h"
+#include "../lib/user/syscall.h"
+#include "../lib/kernel/stdio_kernel.h"
 
-#define IRQ0_FREQUENCY 100
 #define INPUT_FREQUENCY 1193180
 #define COUNTER0_VALUE (INPUT_FREQUENCY / IRQ0_FREQUENCY)
 #define COUNTER0_PORT 0x40
 #define COUNTER0_NO 0
-#define COUNTER0_MODE 2
+#define COUNTER0_MODE 2 // 周期模式,每COUNTER0_VALUE个输入脉冲产生一次中断
+#define ONESHOT_MODE 0  // 单次模式,计数到0时产生一次中断后停止
+#define COUNTER_MAX 0xffff
+#define LATCH_COUNTER0 0x00 // 写入控制端口,锁存计数器0的当前值供读取
+#define PIC_M_CTRL 0x20
+#define PIC_READ_IRR 0x0a // 写入主片控制端口,之后读出中断请求寄存器
 #define READ_WRITE_LATCH 3
 #define PIT_CONTROL_PORT 0x43
 #define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY) // 每次时钟中断的毫秒数
+#define NSEC_PER_SEC 1000000000
+#define MAX_SLEEP_TICKS 0x7fffffff // 到期时间与当前ticks之差按有符号数比较,不能超过此值
 
 uint32_t ticks; // ticks是内核自中断开启以来总共的嘀嗒数，即时钟中断的次数
 
+/***************************  分级时间轮  ***************************
+ * 第一级tv1有256个槽,每槽对应一个嘀嗒,放256个嘀嗒内到期的定时器;
+ * 之后四级各64个槽,第n级每槽对应2^(8+6*(n-1))个嘀嗒,放更远的定时器.
+ * 每个嘀嗒只处理tv1的一个槽;tv1转完一圈时,把上一级当前槽中的定时器
+ * 按剩余时间重新分到下一级,即级联.增删定时器都是O(1),不必按到期时间排序
+ *******************************************************************/
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4
+
+static struct list tv1[TVR_SIZE];
+static struct list tvn[TVN_LEVELS][TVN_SIZE];
+static uint32_t timer_jiffies; // 时间轮下一个要处理的嘀嗒,追赶ticks
+
+/* 按到期时间把timer放进相应级别的槽.须在关中断时调用 */
+static void internal_add_timer(struct timer_list *timer)
+{
+    uint32_t expires = timer->expires;
+    uint32_t idx = expires - timer_jiffies;
+    struct list *slot;
+    if ((int32_t)idx < 0)
+    { // 已经过期,下一个嘀嗒就处理
+        slot = &tv1[timer_jiffies & TVR_MASK];
+    }
+    else if (idx < TVR_SIZE)
+    {
+        slot = &tv1[expires & TVR_MASK];
+    }
+    else
+    {
+        uint8_t level = 0;
+        while (level < TVN_LEVELS - 1 && idx >= 1U << (TVR_BITS + (level + 1) * TVN_BITS))
+        {
+            level++;
+        }
+        slot = &tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+    }
+    list_append(slot, &timer->entry);
+}
+
+/* 把第level级当前槽中的定时器重新分到更低的级别,返回该槽的下标,为0表示这一级也转完了一圈 */
+static uint32_t cascade(uint8_t level)
+{
+    uint32_t index = (timer_jiffies >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+    struct list *slot = &tvn[level][index];
+    while (!list_empty(slot))
+    {
+        internal_add_timer(elem2entry(struct timer_list, entry, list_pop(slot)));
+    }
+    return index;
+}
+
+/* 处理到当前ticks为止到期的定时器,在时钟中断中调用 */
+static void run_timers(void)
+{
+    while ((int32_t)(ticks - timer_jiffies) >= 0)
+    {
+        uint32_t index = timer_jiffies & TVR_MASK;
+        if (index == 0)
+        {
+            uint8_t level = 0;
+            while (level < TVN_LEVELS && cascade(level) == 0)
+            {
+                level++;
+            }
+        }
+        timer_jiffies++; // 先前进,回调中再加入的已到期定时器会放到下一个槽
+
+        struct list *slot = &tv1[index];
+        while (!list_empty(slot))
+        {
+            struct timer_list *timer = elem2entry(struct timer_list, entry, list_pop(slot));
+            timer->entry.prev = timer->entry.next = NULL;
+            timer->function(timer->arg);
+        }
+    }
+}
+
+/* 初始化定时器,到期时间由调用者在add_timer前填入expires */
+void init_timer(struct timer_list *timer, timer_func *function, void *arg)
+{
+    timer->entry.prev = timer->entry.next = NULL;
+    timer->expires = 0;
+    timer->function = function;
+    timer->arg = arg;
+}
+
+/* 定时器是否已加入时间轮且尚未到期 */
+bool timer_pending(struct timer_list *timer)
+{
+    return timer->entry.next != NULL;
+}
+
+/* 把定时器加入时间轮,ticks到达timer->expires时触发 */
+void add_timer(struct timer_list *timer)
+{
+    enum intr_status old_status = intr_disable();
+    ASSERT(!timer_pending(timer));
+    internal_add_timer(timer);
+    intr_set_status(old_status);
+}
+
+/* 取消定时器,返回它是否还未触发 */
+bool del_timer(struct timer_list *timer)
+{
+    enum intr_status old_status = intr_disable();
+    bool pending = timer_pending(timer);
+    if (pending)
+    {
+        list_remove(&timer->entry);
+        timer->entry.prev = timer->entry.next = NULL;
+    }
+    intr_set_status(old_status);
+    return pending;
+}
+
 static void frequency_set(uint8_t counter_port,
                           uint8_t counter_no,
                           uint8_t rwl,
@@ -25,36 +154,152 @@ static void frequency_set(uint8_t counter_port,
 {
     outb(PIT_CONTROL_PORT, (uint8_t)(counter_no << 6 | rwl << 4 | counter_mode << 1));
     outb(counter_port, (uint8_t)counter_value);      // Low byte
-    outb(counter_port, (uint8_t)counter_value >> 8); // High byte
+    outb(counter_port, (uint8_t)(counter_value >> 8)); // High byte
 }
 
-static void intr_timer_handler(void)
+/***************************  空闲时停掉周期时钟  ***************************
+ * 只有空闲线程可运行时,把计数器0改为单次模式,直到最近的定时器到期才产生中断,
+ * 一次最多COUNTER_MAX个脉冲,约5个嘀嗒.单次定时总是在原本的某个嘀嗒边界上结束,
+ * 中断到来时一次补上跨过的嘀嗒数,再恢复周期模式,ticks与一直按周期中断时一致.
+ * 其它中断提前唤醒cpu时,由读出的剩余计数算出已跨过的嘀嗒,再定时到下一个边界
+ **************************************************************************/
+enum tick_mode
 {
-    struct task_struct *cur_thread = running_thread();
+    TICK_PERIODIC, // 周期模式
+    TICK_STOPPED,  // 单次模式,结束时跨过oneshot_ticks个嘀嗒
+    TICK_RESYNC,   // 被提前唤醒后,单次定时到下一个嘀嗒边界
+};
+static enum tick_mode tick_mode;
+static uint32_t oneshot_ticks;      // 本次单次定时结束时跨过的嘀嗒数
+static uint32_t timer_irq_cnt;      // 实际发生的时钟中断次数
+static uint32_t nohz_enter_cnt;     // 停掉周期时钟的次数
 
-    ASSERT(cur_thread->stack_magic == 0x19870916); // 检查栈边界标记
+/* 锁存并读出计数器0的当前值 */
+static uint16_t counter0_read(void)
+{
+    outb(PIT_CONTROL_PORT, LATCH_COUNTER0);
+    uint8_t lo = inb(COUNTER0_PORT);
+    uint8_t hi = inb(COUNTER0_PORT);
+    return (uint16_t)hi << 8 | lo;
+}
 
-    cur_thread->elapsed_ticks++; // 增加已运行的时间片数
-    ticks++;                     // 增加总的ticks数
+/* 时钟中断是否已发出尚未处理.此时读出的计数已越过0,不能据此计算 */
+static bool timer_irq_pending(void)
+{
+    outb(PIC_M_CTRL, PIC_READ_IRR);
+    return inb(PIC_M_CTRL) & 1;
+}
 
-    if (cur_thread->ticks == 0) // 如果当前线程的时间片用完
-    {
-        schedule(); // 调度下一个线程
+/* 从下一个要处理的嘀嗒起,在max_ticks个嘀嗒内最早有定时器到期的是第几个嘀嗒(从1起),
+ * 都没有则返回max_ticks.tv1转完一圈时要级联,上一级的定时器可能到期,不能越过这一点 */
+static uint32_t next_timer_ticks(uint32_t max_ticks)
+{
+    if (timer_jiffies != ticks + 1)
+    { // 提前唤醒时补上的嘀嗒还没处理定时器,等下一个嘀嗒追上
+        return 1;
     }
-    else
+    uint32_t n;
+    for (n = 1; n < max_ticks; n++)
     {
-        cur_thread->ticks--; // 否则减少当前线程的时间片
+        uint32_t index = (timer_jiffies + n - 1) & TVR_MASK;
+        if (!list_empty(&tv1[index]) || index == 0)
+        {
+            break;
+        }
     }
+    return n;
 }
 
-static void ticks_to_sleep(uint32_t sleep_ticks)
+/* 空闲线程halt前调用:下一个嘀嗒没有定时器到期时改为单次定时,跳过中间的时钟中断.须在关中断时调用 */
+void tick_nohz_idle_enter(void)
 {
-    uint32_t start_tick = ticks;
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (tick_mode != TICK_PERIODIC)
+    {
+        return;
+    }
+    /* 周期模式下计数器从COUNTER0_VALUE减到0时产生中断,读出值即到下个嘀嗒边界的脉冲数 */
+    uint32_t remain = counter0_read();
+    if (timer_irq_pending() || remain == 0 || remain > COUNTER0_VALUE)
+    {
+        return;
+    }
+    uint32_t n = next_timer_ticks(1 + (COUNTER_MAX - remain) / COUNTER0_VALUE);
+    if (n <= 1)
+    {
+        return;
+    }
+    frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, ONESHOT_MODE,
+                  remain + (n - 1) * COUNTER0_VALUE);
+    tick_mode = TICK_STOPPED;
+    oneshot_ticks = n;
+    nohz_enter_cnt++;
+}
 
-    while (ticks - start_tick < sleep_ticks)
+/* 空闲线程被换下cpu前调用:若还在单次定时中,补上已跨过的嘀嗒并定时到下一个嘀嗒边界.须在关中断时调用 */
+void tick_nohz_idle_exit(void)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (tick_mode != TICK_STOPPED)
     {
-        thread_yield();
+        return;
+    }
+    uint32_t remain = counter0_read();
+    if (timer_irq_pending() || remain == 0)
+    { // 单次定时已到,由中断处理程序补上嘀嗒
+        return;
+    }
+    /* 剩余计数为j*COUNTER0_VALUE处是原本的嘀嗒边界,j为oneshot_ticks-1到0 */
+    uint32_t left = DIV_ROUND_UP(remain, COUNTER0_VALUE); // 包括最后一个在内,还没跨过的边界数
+    ticks += oneshot_ticks - left;
+    frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, ONESHOT_MODE,
+                  (remain - 1) % COUNTER0_VALUE + 1);
+    tick_mode = TICK_RESYNC;
+    oneshot_ticks = 1;
+}
+
+/* 打印时钟中断的统计:空闲时停掉周期时钟后,实际中断次数少于嘀嗒数 */
+void timer_info(void)
+{
+    printk("timer: %d ticks, %d timer interrupts, tick stopped %d times while idle\n",
+           ticks, timer_irq_cnt, nohz_enter_cnt);
+}
+
+static void intr_timer_handler(void)
+{
+    struct task_struct *cur_thread = running_thread();
+
+    ASSERT(cur_thread->stack_magic == 0x19870916); // 检查栈边界标记
+
+    timer_irq_cnt++;
+    if (tick_mode != TICK_PERIODIC)
+    { // 单次定时结束在嘀嗒边界上,补上跨过的嘀嗒,恢复周期模式
+        ticks += oneshot_ticks - 1;
+        frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER0_MODE, COUNTER0_VALUE);
+        tick_mode = TICK_PERIODIC;
     }
+    ticks++; // 增加总的ticks数
+
+    run_timers();  // 到期定时器唤醒的任务在thread_tick中按需抢占
+    thread_tick(); // 时间片记账,由当前任务的调度类决定是否调度
+}
+
+/* 睡眠定时器到期,唤醒睡眠的任务 */
+static void sleep_timeout(void *arg)
+{
+    thread_unblock(arg);
+}
+
+/* 阻塞当前任务,直到再经过sleep_ticks次时钟中断.睡眠期间任务不在就绪队列中,不占cpu */
+static void ticks_to_sleep(uint32_t sleep_ticks)
+{
+    struct timer_list timer;
+    init_timer(&timer, sleep_timeout, running_thread());
+    enum intr_status old_status = intr_disable(); // 加入时间轮到阻塞之间定时器不能触发
+    timer.expires = ticks + sleep_ticks;
+    add_timer(&timer);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
 }
 
 void mtime_sleep(uint32_t m_seconds)
@@ -64,9 +309,44 @@ void mtime_sleep(uint32_t m_seconds)
     ticks_to_sleep(sleep_ticks); // 将ticks转换为睡眠时间
 }
 
+/* 睡眠req指定的时间,精度为一个嘀嗒,至少睡满所要求的时间.成功返回0,参数不对返回-1 */
+int32_t sys_nanosleep(const struct timespec *req)
+{
+    if (req == NULL || req->tv_nsec >= NSEC_PER_SEC)
+    {
+        return -1;
+    }
+    uint32_t sleep_ticks = MAX_SLEEP_TICKS;
+    if (req->tv_sec < MAX_SLEEP_TICKS / IRQ0_FREQUENCY - 1)
+    {
+        sleep_ticks = req->tv_sec * IRQ0_FREQUENCY + DIV_ROUND_UP(req->tv_nsec, NSEC_PER_SEC / IRQ0_FREQUENCY);
+    }
+    if (sleep_ticks == 0)
+    {
+        return 0;
+    }
+    ticks_to_sleep(sleep_ticks + 1); // 当前嘀嗒已过去一部分,多等一个才能保证睡满
+    return 0;
+}
+
 void timer_init(void)
 {
     put_str("timer_init start\n");
+    uint32_t slot;
+    for (slot = 0; slot < TVR_SIZE; slot++)
+    {
+        list_init(&tv1[slot]);
+    }
+    uint8_t level;
+    for (level = 0; level < TVN_LEVELS; level++)
+    {
+        for (slot = 0; slot < TVN_SIZE; slot++)
+        {
+            list_init(&tvn[level][slot]);
+        }
+    }
+    timer_jiffies = ticks;
+    tick_mode = TICK_PERIODIC;
     frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER0_MODE, COUNTER0_VALUE);
     register_handler(0x20, intr_timer_handler); // 注册时钟中断处理函数
     put_str("timer_init done\n");
@@ -1,7 +1,34 @@
 #ifndef __DEVICE_TIMER_H
 #define __DEVICE_TIMER_H
 #include "../lib/stdint.h"
+#include "../lib/kernel/list.h"
+
+#define IRQ0_FREQUENCY 100 // 每秒的时钟中断次数
+
+extern uint32_t ticks; // 自中断开启以来的时钟中断次数
+
+/* 定时器到期时在时钟中断中调用的函数,此时处于关中断状态,不能阻塞 */
+typedef void timer_func(void *arg);
+
+/* 内核定时器,ticks到达expires时调用function(arg),只触发一次 */
+struct timer_list
+{
+    struct list_elem entry; // 挂在时间轮的槽中,next为NULL表示不在轮上
+    uint32_t expires;       // 到期时的ticks值
+    timer_func *function;
+    void *arg;
+};
+
+struct timespec;
 
 void timer_init(void);
+void init_timer(struct timer_list *timer, timer_func *function, void *arg);
+void add_timer(struct timer_list *timer);
+bool del_timer(struct timer_list *timer);
+bool timer_pending(struct timer_list *timer);
 void mtime_sleep(uint32_t m_seconds);
-#endif
\ No newline at end of file
+int32_t sys_nanosleep(const struct timespec *req);
+void tick_nohz_idle_enter(void);
+void tick_nohz_idle_exit(void);
+void timer_info(void);
+#endif
@@ -7,6 +7,7 @@
 #include "../kernel/global.h"
 #include "../kernel/debug.h"
 #include "../kernel/memory.h"
+#include "../kernel/slab.h"
 #include "../lib/string.h"
 #include "../kernel/interrupt.h"
 #include "super_block.h"
@@ -21,7 +22,7 @@ void open_root_dir(struct partition *part)
 
 struct dir *dir_open(struct partition *part, uint32_t inode_no)
 {
-    struct dir *pdir = (struct dir *)sys_malloc(sizeof(struct dir));
+    struct dir *pdir = (struct dir *)kmem_cache_alloc(dir_cache);
     pdir->inode = inode_open(part, inode_no);
     pdir->dir_pos = 0;
     return pdir;
@@ -32,10 +33,10 @@ bool search_dir_entry(struct partition *part, struct dir *pdir, const char *name
     uint32_t block_cnt = 140; // 12个直接块+128个一级间接块=140块
 
     /* 12个直接块大小+128个间接块,共560字节 */
-    uint32_t *all_blocks = (uint32_t *)sys_malloc(48 + 512);
+    uint32_t *all_blocks = (uint32_t *)kmem_cache_alloc(all_blocks_cache);
     if (all_blocks == NULL)
     {
-        printk("search_dir_entry: sys_malloc for all_blocks failed");
+        printk("search_dir_entry: kmem_cache_alloc for all_blocks failed");
         return false;
     }
 
@@ -52,7 +53,7 @@ bool search_dir_entry(struct partition *part, struct dir *pdir, const char *name
         ide_read(part->my_disk, pdir->inode->i_sectors[12], all_blocks + 12, 1); // 读取一级间接块
     }
 
-    uint8_t *buf = (uint8_t *)sys_malloc(SECTOR_SIZE);
+    uint8_t *buf = (uint8_t *)kmem_cache_alloc(sector_buf_cache);
     struct dir_entry *p_de = (struct dir_entry *)buf;
     uint32_t dir_entry_size = part->sb->dir_entry_size;
     uint32_t dir_entry_cnt = SECTOR_SIZE / dir_entry_size; // 每扇区的目录项数量
@@ -75,8 +76,8 @@ bool search_dir_entry(struct partition *part, struct dir *pdir, const char *name
             if (!strcmp(p_de->filename, name))
             {
                 memcpy(dir_e, p_de, dir_entry_size);
-                sys_free(buf);
-                sys_free(all_blocks);
+                kmem_cache_free(sector_buf_cache, buf);
+                kmem_cache_free(all_blocks_cache, all_blocks);
                 return true;
             }
             dir_entry_idx++;
@@ -86,8 +87,8 @@ bool search_dir_entry(struct partition *part, struct dir *pdir, const char *name
         p_de = (struct dir_entry *)buf; // 此时p_de已经指向扇区内最后一个完整目录项了,需要恢复p_de指向为buf
         memset(buf, 0, SECTOR_SIZE);    // 将buf清0,下次再用
     }
-    sys_free(buf);
-    sys_free(all_blocks);
+    kmem_cache_free(sector_buf_cache, buf);
+    kmem_cache_free(all_blocks_cache, all_blocks);
     return false;
 }
 
@@ -103,7 +104,7 @@ void dir_close(struct dir *dir)
         return;
     }
     inode_close(dir->inode);
-    sys_free(dir);
+    kmem_cache_free(dir_cache, dir);
 }
 
 /* 在内存中初始化目录项p_de */
@@ -441,7 +442,7 @@ int32_t dir_remove(struct dir *parent_dir, struct dir *child_dir)
         ASSERT(child_dir_inode->i_sectors[block_idx] == 0);
         block_idx++;
     }
-    void *io_buf = sys_malloc(SECTOR_SIZE * 2);
+    void *io_buf = kmem_cache_alloc(io_buf_cache);
     if (io_buf == NULL)
     {
         printk("dir_remove: malloc for io_buf failed\n");
@@ -453,6 +454,6 @@ int32_t dir_remove(struct dir *parent_dir, struct dir *child_dir)
 
     /* 回收inode中i_secotrs中所占用的扇区,并同步inode_bitmap和block_bitmap */
     inode_release(cur_part, child_dir_inode->i_no);
-    sys_free(io_buf);
+    kmem_cache_free(io_buf_cache, io_buf);
     return 0;
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "inode.h"
 #include "../lib/kernel/stdio_kernel.h"
 #include "../kernel/memory.h"
+#include "../kernel/slab.h"
 #include "../kernel/debug.h"
 #include "../kernel/interrupt.h"
 #include "../lib/string.h"
@@ -86,10 +87,10 @@ int32_t block_bitmap_alloc(struct partition *part)
 int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag)
 {
     /* 后续操作的公共缓冲区 */
-    void *io_buf = sys_malloc(1024);
+    void *io_buf = kmem_cache_alloc(io_buf_cache);
     if (io_buf == NULL)
     {
-        printk("in file_creat: sys_malloc for io_buf failed\n");
+        printk("in file_creat: kmem_cache_alloc for io_buf failed\n");
         return -1;
     }
 
@@ -103,12 +104,12 @@ int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag)
         return -1;
     }
 
-    /* 此inode要从堆中申请内存,不可生成局部变量(函数退出时会释放)
+    /* 此inode要从inode_cache中申请内存,不可生成局部变量(函数退出时会释放)
      * 因为file_table数组中的文件描述符的inode指针要指向它.*/
-    struct inode *new_file_inode = (struct inode *)sys_malloc(sizeof(struct inode));
+    struct inode *new_file_inode = (struct inode *)kmem_cache_alloc(inode_cache);
     if (new_file_inode == NULL)
     {
-        printk("file_create: sys_malloc for inode failded\n");
+        printk("file_create: kmem_cache_alloc for inode failded\n");
         rollback_step = 1;
         goto rollback;
     }
@@ -157,7 +158,7 @@ int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag)
     list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
     new_file_inode->i_open_cnts = 1;
 
-    sys_free(io_buf);
+    kmem_cache_free(io_buf_cache, io_buf);
     return pcb_fd_install(fd_idx);
 
 /*创建文件需要创建相关的多个资源,若某步失败则会执行到下面的回滚步骤 */
@@ -168,13 +169,13 @@ rollback:
         /* 失败时,将file_table中的相应位清空 */
         memset(&file_table[fd_idx], 0, sizeof(struct file));
     case 2:
-        sys_free(new_file_inode);
+        kmem_cache_free(inode_cache, new_file_inode);
     case 1:
         /* 如果新文件的i结点创建失败,之前位图中分配的inode_no也要恢复 */
         bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
         break;
     }
-    sys_free(io_buf);
+    kmem_cache_free(io_buf_cache, io_buf);
     return -1;
 }
 
@@ -233,16 +234,17 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count)
         printk("exceed max file_size 71680 bytes, write file failed\n");
         return -1;
     }
-    uint8_t *io_buf = sys_malloc(BLOCK_SIZE);
+    /* io_buf最后还要交给inode_sync,inode可能跨扇区,故用2扇区大小的缓冲区 */
+    uint8_t *io_buf = kmem_cache_alloc(io_buf_cache);
     if (io_buf == NULL)
     {
-        printk("file_write: sys_malloc for io_buf failed\n");
+        printk("file_write: kmem_cache_alloc for io_buf failed\n");
         return -1;
     }
-    uint32_t *all_blocks = (uint32_t *)sys_malloc(BLOCK_SIZE + 48); // 用来记录文件所有的块地址
+    uint32_t *all_blocks = (uint32_t *)kmem_cache_alloc(all_blocks_cache); // 用来记录文件所有的块地址
     if (all_blocks == NULL)
     {
-        printk("file_write: sys_malloc for all_blocks failed\n");
+        printk("file_write: kmem_cache_alloc for all_blocks failed\n");
         return -1;
     }
 
@@ -442,8 +444,8 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count)
         size_left -= chunk_size;
     }
     inode_sync(cur_part, file->fd_inode, io_buf);
-    sys_free(all_blocks);
-    sys_free(io_buf);
+    kmem_cache_free(all_blocks_cache, all_blocks);
+    kmem_cache_free(io_buf_cache, io_buf);
     return bytes_written;
 }
 
@@ -464,15 +466,15 @@ int32_t file_read(struct file *file, void *buf, uint32_t count)
         }
     }
 
-    uint8_t *io_buf = sys_malloc(BLOCK_SIZE);
+    uint8_t *io_buf = kmem_cache_alloc(sector_buf_cache);
     if (io_buf == NULL)
     {
-        printk("file_read: sys_malloc for io_buf failed\n");
+        printk("file_read: kmem_cache_alloc for io_buf failed\n");
     }
-    uint32_t *all_blocks = (uint32_t *)sys_malloc(BLOCK_SIZE + 48); // 用来记录文件所有的块地址
+    uint32_t *all_blocks = (uint32_t *)kmem_cache_alloc(all_blocks_cache); // 用来记录文件所有的块地址
     if (all_blocks == NULL)
     {
-        printk("file_read: sys_malloc for all_blocks failed\n");
+        printk("file_read: kmem_cache_alloc for all_blocks failed\n");
         return -1;
     }
 
@@ -556,11 +558,63 @@ int32_t file_read(struct file *file, void *buf, uint32_t count)
         bytes_read += chunk_size;
         size_left -= chunk_size;
     }
-    sys_free(all_blocks);
-    sys_free(io_buf);
+    kmem_cache_free(all_blocks_cache, all_blocks);
+    kmem_cache_free(sector_buf_cache, io_buf);
     return bytes_read;
 }
 
+/* 把文件inode中从页对齐的offset起的一页内容读到page,文件尾之后的部分清0.
+ * 数据按整扇区直接读进page,磁盘上相邻的扇区合并成一次ide_read,不经io缓冲区中转.
+ * 返回从文件中读到的字节数,失败返回-1,此时page全部清0 */
+int32_t file_read_page(struct inode *inode, uint32_t offset, void *page)
+{
+    ASSERT(offset % PG_SIZE == 0);
+    uint8_t *dst = page;
+    uint32_t size = 0;
+    if (offset < inode->i_size)
+    {
+        size = inode->i_size - offset < PG_SIZE ? inode->i_size - offset : PG_SIZE;
+    }
+
+    uint32_t sec_cnt = DIV_ROUND_UP(size, BLOCK_SIZE);
+    if (sec_cnt > 0)
+    {
+        uint32_t *all_blocks = (uint32_t *)kmem_cache_alloc(all_blocks_cache);
+        if (all_blocks == NULL)
+        {
+            printk("file_read_page: kmem_cache_alloc for all_blocks failed\n");
+            memset(dst, 0, PG_SIZE);
+            return -1;
+        }
+        uint32_t first = offset / BLOCK_SIZE, idx;
+        ASSERT(first + sec_cnt <= 140);
+        for (idx = first; idx < first + sec_cnt && idx < 12; idx++)
+        {
+            all_blocks[idx] = inode->i_sectors[idx];
+        }
+        if (first + sec_cnt > 12)
+        { // 用到了一级间接块
+            ASSERT(inode->i_sectors[12] != 0);
+            ide_read(cur_part->my_disk, inode->i_sectors[12], all_blocks + 12, 1);
+        }
+
+        idx = 0;
+        while (idx < sec_cnt)
+        {
+            uint32_t run = 1;
+            while (idx + run < sec_cnt && all_blocks[first + idx + run] == all_blocks[first + idx] + run)
+            {
+                run++;
+            }
+            ide_read(cur_part->my_disk, all_blocks[first + idx], dst + idx * BLOCK_SIZE, run);
+            idx += run;
+        }
+        kmem_cache_free(all_blocks_cache, all_blocks);
+    }
+    memset(dst + size, 0, PG_SIZE - size);
+    return size;
+}
+
 /* 将内存中bitmap第bit_idx位所在的512字节同步到硬盘 */
 void bitmap_sync(struct partition *part, uint32_t bit_idx, uint8_t btmp_type)
 {
@@ -12,12 +12,20 @@
 #include "../kernel/global.h"
 #include "../kernel/debug.h"
 #include "../kernel/memory.h"
+#include "../kernel/slab.h"
+#include "../kernel/vmalloc.h"
 #include "../device/console.h"
 #include "../device/keyboard.h"
 #include "../device/ioqueue.h"
 
 struct partition *cur_part; // 默认情况下操作的是哪个分区
 
+struct kmem_cache *inode_cache;
+struct kmem_cache *dir_cache;
+struct kmem_cache *sector_buf_cache;
+struct kmem_cache *io_buf_cache;
+struct kmem_cache *all_blocks_cache;
+
 /* 在分区链表中找到名为part_name的分区,并将其指针赋值给cur_part */
 static bool mount_partition(struct list_elem *pelem, int arg)
 {
@@ -28,25 +36,24 @@ static bool mount_partition(struct list_elem *pelem, int arg)
         cur_part = part;
         struct disk *hd = cur_part->my_disk;
 
-        /* sb_buf用来存储从硬盘上读入的超级块 */
-        struct super_block *sb_buf = (struct super_block *)sys_malloc(SECTOR_SIZE);
+        /* sb_buf用来存储从硬盘上读入的超级块,以下缓冲区都会被整个读入或复制覆盖,不必清0 */
+        struct super_block *sb_buf = (struct super_block *)sys_malloc_flags(SECTOR_SIZE, AF_NOZERO);
 
         /* 在内存中创建分区cur_part的超级块 */
-        cur_part->sb = (struct super_block *)sys_malloc(sizeof(struct super_block));
+        cur_part->sb = (struct super_block *)sys_malloc_flags(sizeof(struct super_block), AF_NOZERO);
         if (cur_part->sb == NULL)
         {
             PANIC("alloc memory failed!");
         }
 
         /* 读入超级块 */
-        memset(sb_buf, 0, SECTOR_SIZE);
         ide_read(hd, cur_part->start_lba + 1, sb_buf, 1);
 
         /* 把sb_buf中超级块的信息复制到分区的超级块sb中。*/
         memcpy(cur_part->sb, sb_buf, sizeof(struct super_block));
 
         /**********     将硬盘上的块位图读入到内存    ****************/
-        cur_part->block_bitmap.bits = (uint8_t *)sys_malloc(sb_buf->block_bitmap_sects * SECTOR_SIZE);
+        cur_part->block_bitmap.bits = (uint8_t *)vmalloc_flags(sb_buf->block_bitmap_sects * SECTOR_SIZE, AF_NOZERO);
         if (cur_part->block_bitmap.bits == NULL)
         {
             PANIC("alloc memory failed!");
@@ -57,7 +64,7 @@ static bool mount_partition(struct list_elem *pelem, int arg)
         /*************************************************************/
 
         /**********     将硬盘上的inode位图读入到内存    ************/
-        cur_part->inode_bitmap.bits = (uint8_t *)sys_malloc(sb_buf->inode_bitmap_sects * SECTOR_SIZE);
+        cur_part->inode_bitmap.bits = (uint8_t *)vmalloc_flags(sb_buf->inode_bitmap_sects * SECTOR_SIZE, AF_NOZERO);
         if (cur_part->inode_bitmap.bits == NULL)
         {
             PANIC("alloc memory failed!");
@@ -129,7 +136,7 @@ static void partition_format(struct partition *part)
     /* 找出数据量最大的元信息,用其尺寸做存储缓冲区*/
     uint32_t buf_size = (sb.block_bitmap_sects >= sb.inode_bitmap_sects ? sb.block_bitmap_sects : sb.inode_bitmap_sects);
     buf_size = (buf_size >= sb.inode_table_sects ? buf_size : sb.inode_table_sects) * SECTOR_SIZE;
-    uint8_t *buf = (uint8_t *)sys_malloc(buf_size); // 申请的内存由内存管理系统清0后返回
+    uint8_t *buf = (uint8_t *)vmalloc(buf_size); // 申请的内存由内存管理系统清0后返回,不要求物理连续
 
     /**************************************
      * 2 将块位图初始化并写入sb.block_bitmap_lba *
@@ -197,7 +204,7 @@ static void partition_format(struct partition *part)
 
     printk("   root_dir_lba:0x%x\n", sb.data_start_lba);
     printk("%s format done\n", part->name);
-    sys_free(buf);
+    vfree(buf);
 }
 
 /* 将最上层路径名称解析出来 */
@@ -406,6 +413,16 @@ static uint32_t fd_local2global(uint32_t local_fd)
     return (uint32_t)global_fd;
 }
 
+/* 返回当前任务的文件描述符fd打开的文件的inode,fd不是已打开的文件时返回NULL */
+struct inode *fd_inode_get(int32_t fd)
+{
+    if (fd <= stderr_no || fd >= MAX_FILES_OPEN_PER_PROC || running_thread()->fd_table[fd] == -1)
+    {
+        return NULL;
+    }
+    return file_table[fd_local2global(fd)].fd_inode;
+}
+
 /* 关闭文件描述符fd指向的文件,成功返回0,否则返回-1 */
 int32_t sys_close(int32_t fd)
 {
@@ -556,7 +573,7 @@ int32_t sys_unlink(const char *pathname)
     ASSERT(file_idx == MAX_FILE_OPEN);
 
     /* 为delete_dir_entry申请缓冲区 */
-    void *io_buf = sys_malloc(SECTOR_SIZE + SECTOR_SIZE);
+    void *io_buf = kmem_cache_alloc(io_buf_cache);
     if (io_buf == NULL)
     {
         dir_close(searched_record.parent_dir);
@@ -567,7 +584,7 @@ int32_t sys_unlink(const char *pathname)
     struct dir *parent_dir = searched_record.parent_dir;
     delete_dir_entry(cur_part, parent_dir, inode_no, io_buf);
     inode_release(cur_part, inode_no);
-    sys_free(io_buf);
+    kmem_cache_free(io_buf_cache, io_buf);
     dir_close(searched_record.parent_dir);
     return 0; // 成功删除文件
 }
@@ -576,10 +593,10 @@ int32_t sys_unlink(const char *pathname)
 int32_t sys_mkdir(const char *pathname)
 {
     uint8_t rollback_step = 0; // 用于操作失败时回滚各资源状态
-    void *io_buf = sys_malloc(SECTOR_SIZE * 2);
+    void *io_buf = kmem_cache_alloc(io_buf_cache);
     if (io_buf == NULL)
     {
-        printk("sys_mkdir: sys_malloc for io_buf failed\n");
+        printk("sys_mkdir: kmem_cache_alloc for io_buf failed\n");
         return -1;
     }
 
@@ -678,7 +695,7 @@ int32_t sys_mkdir(const char *pathname)
     /* 将inode位图同步到硬盘 */
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
-    sys_free(io_buf);
+    kmem_cache_free(io_buf_cache, io_buf);
 
     /* 关闭所创建目录的父目录 */
     dir_close(searched_record.parent_dir);
@@ -695,7 +712,7 @@ rollback: // 因为某步骤操作失败而回滚
         dir_close(searched_record.parent_dir);
         break;
     }
-    sys_free(io_buf);
+    kmem_cache_free(io_buf_cache, io_buf);
     return -1;
 }
 
@@ -869,7 +886,7 @@ char *sys_getcwd(char *buf, uint32_t size)
     /* 确保buf不为空,若用户进程提供的buf为NULL,
     系统调用getcwd中要为用户进程通过malloc分配内存 */
     ASSERT(buf != NULL);
-    void *io_buf = sys_malloc(SECTOR_SIZE);
+    void *io_buf = kmem_cache_alloc(sector_buf_cache);
     if (io_buf == NULL)
     {
         return NULL;
@@ -883,7 +900,7 @@ char *sys_getcwd(char *buf, uint32_t size)
     {
         buf[0] = '/';
         buf[1] = 0;
-        sys_free(io_buf);
+        kmem_cache_free(sector_buf_cache, io_buf);
         return buf;
     }
 
@@ -898,7 +915,7 @@ char *sys_getcwd(char *buf, uint32_t size)
         parent_inode_nr = get_parent_dir_inode_nr(child_inode_nr, io_buf);
         if (get_child_dir_name(parent_inode_nr, child_inode_nr, full_path_reverse, io_buf) == -1)
         { // 或未找到名字,失败退出
-            sys_free(io_buf);
+            kmem_cache_free(sector_buf_cache, io_buf);
             return NULL;
         }
         child_inode_nr = parent_inode_nr;
@@ -915,7 +932,7 @@ char *sys_getcwd(char *buf, uint32_t size)
         /* 在full_path_reverse中添加结束字符,做为下一次执行strcpy中last_slash的边界 */
         *last_slash = 0;
     }
-    sys_free(io_buf);
+    kmem_cache_free(sector_buf_cache, io_buf);
     return buf;
 }
 
@@ -981,11 +998,28 @@ void sys_putchar(char char_asci)
     console_put_char(char_asci);
 }
 
+/* 创建文件系统用到的对象缓存 */
+static void fs_cache_init(void)
+{
+    inode_cache = kmem_cache_create("inode", sizeof(struct inode), NULL);
+    dir_cache = kmem_cache_create("dir", sizeof(struct dir), NULL);
+    sector_buf_cache = kmem_cache_create("io_buf_512", SECTOR_SIZE, NULL);
+    io_buf_cache = kmem_cache_create("io_buf_1024", SECTOR_SIZE * 2, NULL);
+    all_blocks_cache = kmem_cache_create("all_blocks", BLOCK_SIZE + 48, NULL);
+    if (inode_cache == NULL || dir_cache == NULL || sector_buf_cache == NULL ||
+        io_buf_cache == NULL || all_blocks_cache == NULL)
+    {
+        PANIC("fs_cache_init: create kmem_cache failed");
+    }
+}
+
 /* 在磁盘上搜索文件系统,若没有则格式化分区创建文件系统 */
 void filesys_init()
 {
     uint8_t channel_no = 0, dev_no, part_idx = 0;
 
+    fs_cache_init();
+
     /* sb_buf用来存储从硬盘上读入的超级块 */
     struct super_block *sb_buf = (struct super_block *)sys_malloc(SECTOR_SIZE);
 
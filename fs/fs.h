@@ -51,11 +51,20 @@ struct stat
 
 extern struct partition *cur_part; // 当前工作分区
 
+/* 文件系统常用对象及扫描缓冲区的对象缓存,均位于内核空间,为所有任务共享 */
+struct kmem_cache;
+extern struct kmem_cache *inode_cache;      // struct inode
+extern struct kmem_cache *dir_cache;        // struct dir
+extern struct kmem_cache *sector_buf_cache; // 1个扇区大小的io缓冲区
+extern struct kmem_cache *io_buf_cache;     // 2个扇区大小的io缓冲区,可容纳跨扇区的inode
+extern struct kmem_cache *all_blocks_cache; // 12个直接块+128个间接块地址,共560字节
+
 void filesys_init(void); // 文件系统初始化函数
 char *path_parse(char *pathname, char *name_store);
 int32_t path_depth_cnt(char *pathname);
 int32_t sys_open(const char *pathname, uint8_t flags);
 int32_t sys_close(int32_t fd);
+struct inode *fd_inode_get(int32_t fd);
 int32_t sys_write(int32_t fd, const void *buf, uint32_t count);
 int32_t sys_read(int32_t fd, void *buf, uint32_t count);
 int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence);
@@ -10,6 +10,7 @@
 #include "../userprog/syscall_init.h"
 #include "../device/ide.h"
 #include "../fs/fs.h"
+#include "swap.h"
 
 void init_all(void)
 {
@@ -25,4 +26,5 @@ void init_all(void)
     intr_enable();   // Enable interrupts
     ide_init();      // Initialize IDE (if applicable)
     filesys_init();  // Initialize the file system
+    swap_init();     // Initialize swap space on the spare partition
 }
\ No newline at end of file
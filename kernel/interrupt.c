@@ -86,7 +86,8 @@ static void idt_desc_init(void)
     put_str("   idt_desc_init done\n");
 }
 
-static void general_intr_handler(uint8_t vec_nr)
+/* 通用的中断处理函数,一般用在异常出现时的处理 */
+void general_intr_handler(uint8_t vec_nr)
 {
     if (vec_nr == 0x27 || vec_nr == 0x2f) // IRQ7 and IRQ15 are not used
     {
@@ -31,7 +31,7 @@ int main(void)
     uint32_t file_size = 11692;
     uint32_t sec_cnt = DIV_ROUND_UP(file_size, 512);
     struct disk *sda = &channels[0].devices[0];
-    void *prog_buf = sys_malloc(file_size);
+    void *prog_buf = sys_malloc_flags(file_size, AF_NOZERO);
     ide_read(sda, 300, prog_buf, sec_cnt);
     int32_t fd = sys_open("/prog_no_arg", O_CREAT | O_RDWR);
     if (fd != -1)
@@ -48,8 +48,11 @@ int main(void)
     cls_screen(); // 清屏
     console_put_str("[user@localhost /]$ ");
     /********  测试代码  ********/
+    /* 主线程已无事可做,阻塞而不是忙等,没有其它任务时cpu才能进入空闲 */
     while (1)
-        ;
+    {
+        thread_block(TASK_BLOCKED);
+    }
     return 0;
 }
 
@@ -60,10 +63,14 @@ void init(void)
     if (ret_pid)
     { // 父进程
         while (1)
-            ;
+        { // 没有wait可回收子进程,睡眠而不是忙等
+            sleep(3600);
+        }
     }
     else
     { // 子进程
+        /* shell等待键盘输入,用实时策略让按键后尽快得到响应.其派生的进程恢复为普通策略 */
+        sched_setscheduler(0, SCHED_RR, 1);
         my_shell();
     }
     panic("init: should not be here");
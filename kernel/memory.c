@@ -8,80 +8,140 @@
 #include "../thread/sync.h"
 #include "interrupt.h"
 #include "../lib/kernel/list.h"
-
-/***************  位图地址 ********************
- * 因为0xc009f000是内核主线程栈顶，0xc009e000是内核主线程的pcb.
- * 一个页框大小的位图可表示128M内存, 位图位置安排在地址0xc009a000,
- * 这样本系统最大支持4个页框的位图,即512M内存 */
-#define MEM_BITMAP_BASE 0xc009a000
-/*************************************/
+#include "../lib/kernel/stdio_kernel.h"
+#include "../lib/stdio.h"
+#include "slab.h"
+#include "../userprog/process.h"
+#include "vma.h"
+#include "vmalloc.h"
+#include "swap.h"
+#include "../fs/fs.h"
+#include "../fs/file.h"
+#include "../lib/user/syscall.h"
 
 #define PDE_IDX(addr) ((addr & 0xffc00000) >> 22)
 #define PTE_IDX(addr) ((addr & 0x003ff000) >> 12)
 
-/* 0xc0000000是内核从虚拟地址3G起. 0x100000意指跨过低端1M内存,使虚拟地址在逻辑上连续 */
-#define K_HEAP_START 0xc0100000
+/* loader在0xb00处存放物理内存总量,其后依次是gdt_ptr(6字节)、
+ * e820返回的地址范围描述符ards_buf(最多12项)和项数ards_nr,地址须与loader.S中的布局一致 */
+#define TOTAL_MEM_BYTES_ADDR 0xb00
+#define ARDS_BUF_ADDR 0xb0a
+#define ARDS_NR_ADDR 0xbfe
+#define ARDS_MAX 12
+#define ARDS_TYPE_USABLE 1 // 可供操作系统使用的内存
+#define PHY_MEM_END 0xfffff000 // 管理的物理内存的上限,4G以上的内存用不到,跨过4G的截到这里,与loader一致
+
+#define POOL_RESERVE_PAGES 256 // 内存池让出4M块后至少还要留下的空闲页框数
+#define INVLPG_MAX_PAGES 32 // unmap_range解除映射的页数超过此值时,改为重新加载cr3整体刷新tlb
+#define CMA_PAGES HUGE_PG_PAGES // 为物理连续分配预留的页框数,即一个4M块
+#define SWAP_BATCH 16 // 用户内存池耗尽时一次最多换出的页数
+
+/* 伙伴系统中某一阶的空闲块链表 */
+struct free_area
+{
+    struct list free_list; // 本阶空闲块的链表,元素为空闲块首页page的free_elem
+    uint32_t nr_free;      // 本阶空闲块的数量
+};
 
 /* 内存池结构,生成两个实例用于管理内核内存池和用户内存池 */
 struct pool
 {
-    struct bitmap pool_bitmap; // 本内存池用到的位图结构,用于管理物理内存
-    uint32_t phy_addr_start;   // 本内存池所管理物理内存的起始地址
-    uint32_t pool_size;        // 本内存池字节容量
-    struct lock lock;          // 申请内存时互斥
+    struct page *mem_map;                  // 本内存池所管理页框的描述符数组
+    struct free_area free_area[MAX_ORDER]; // 伙伴系统各阶空闲块链表
+    uint32_t phy_addr_start;               // 本内存池所管理物理内存的起始地址
+    uint32_t pool_size;                    // 本内存池字节容量
+    uint32_t present_pages;                // 交给伙伴系统管理的页框数,不含内核池开头保留的页框和e820中的空洞
+    uint32_t grown_chunks;                 // 内存不足时从另一个内存池移来的4M块数
+    uint32_t free_pages;                   // 本内存池空闲页框数
+    uint32_t malloc_lock_cnt;              // sys_malloc和sys_free获取本池锁的次数
+    struct list zeroed_list;               // 空闲线程预先清0的页框,已从伙伴系统中取出
+    uint32_t zeroed_cnt;                   // zeroed_list中的页框数
+    struct lock lock;                      // 申请内存时互斥
+};
+
+/* e820返回的地址范围描述符 */
+struct ards
+{
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t length_low;
+    uint32_t length_high;
+    uint32_t type;
+};
+
+/* 一段可用的物理内存[start, end),均按页对齐 */
+struct mem_range
+{
+    uint32_t start;
+    uint32_t end;
+};
+
+/* 为物理连续分配(如DMA缓冲区)预留的一段物理内存,从用户内存池顶端取出一个4M块,不在伙伴系统中.
+ * 用户内存池耗尽时其空闲页框可以借给用户页,需要连续内存时再把借出的页迁走.所有字段由user_pool的锁保护 */
+struct cma_area
+{
+    uint32_t base;                // 物理起始地址,4M对齐,为0表示没有预留
+    struct bitmap btmp;           // 每位对应一个页框,1表示已连续分配或已借出
+    uint8_t bits[CMA_PAGES / 8];  // btmp的位
+    uint32_t contig_pages;        // 连续分配占用的页框数
+    uint32_t movable_pages;       // 借给用户页的页框数
+    uint32_t alloc_cnt;           // palloc_contig成功的次数
+    uint32_t fail_cnt;            // palloc_contig失败的次数
+    uint32_t migrate_cnt;         // 为腾出连续页框迁走的页数
+    uint32_t total_kcycles;       // palloc_contig累计耗时,单位为1024个时钟周期
+    uint32_t max_cycles;          // palloc_contig单次最长耗时
 };
 
 /* 内存仓库arena元信息 */
 struct arena
 {
-    struct mem_block_desc *desc; // 此arena关联的mem_block_desc
-                                 /* large为ture时,cnt表示的是页框数。
-                                  * 否则cnt表示空闲mem_block数量 */
+    uint8_t desc_idx; // 内存块规格在所属任务内存块描述符数组中的下标.
+                      // 不存描述符的地址,fork出的子进程中它会指向父进程pcb里的描述符
+    pid_t owner;      // 把此arena挂在自己描述符链表上的进程,内核的arena为-1
+                      /* large为ture时,cnt表示的是页框数。
+                       * 否则cnt表示空闲mem_block数量 */
     uint32_t cnt;
     bool large;
+
+    /* 以下两项仅对小块内存的arena有效 */
+    struct list_elem arena_elem; // 用于挂在desc的empty/partial/full链表上
+    struct list free_list;       // 本arena中空闲的mem_block
 };
 
 struct mem_block_desc k_block_descs[DESC_CNT]; // 内核内存块描述符数组
 struct pool kernel_pool, user_pool;            // 生成内核内存池和用户内存池
-struct virtual_addr kernel_vaddr;              // 此结构是用来给内核分配虚拟地址
-
-/* 在pf表示的虚拟内存池中申请pg_cnt个虚拟页,
+static uint32_t demand_page_cnt;               // 缺页异常中按需映射的用户页数
+static uint32_t file_page_cnt;                 // 缺页异常中从映射的文件读入的页数
+static uint32_t cow_copy_cnt;                  // 写时复制缺页中复制出的页数
+static uint32_t cow_reuse_cnt;                 // 写时复制缺页中因已无共享者而直接恢复可写的页数
+static uint32_t huge_page_cnt;                 // 用4M大页映射的用户内存区数
+static uint32_t highmem_pages;                 // 用户内存池中直接映射区之外的页框数,只能经用户映射或kmap访问
+static uint32_t *kmap_pte;                     // 临时映射窗口的页表,经直接映射区访问
+static enum intr_status kmap_intr_status[KM_TYPE_NR]; // 各槽位映射前的中断状态
+static uint32_t kmap_cnt;                      // 经临时映射窗口映射页框的次数
+static struct cma_area cma;                    // 物理连续分配的预留区
+static uint16_t cma_map_cnt[CMA_PAGES];        // 迁移时数出的预留区各页框被页表项映射的次数
+static uint32_t cma_dest[CMA_PAGES];           // 迁移时预留区各页框的新页框
+static pid_t clock_pid;                        // 换出页时时钟指针所在的进程
+static uint32_t clock_vaddr;                   // 时钟指针在该进程中的用户虚拟地址
+static uint8_t swap_buf[PG_SIZE];              // 换入换出时读写交换区的缓冲区,由swap_io_lock保护
+static struct lock swap_io_lock;               // 串行化交换区的读写,须先于user_pool的锁获取
+
+/* 在当前进程的用户空间中找一段空闲的pg_cnt个虚拟页并记为一个匿名区域,huge_align为true时起始地址按4M对齐.
+ * 内核内存都在直接映射区,不再需要分配虚拟地址.
  * 成功则返回虚拟页的起始地址, 失败则返回NULL */
-static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt)
+static void *vaddr_get(uint32_t pg_cnt, bool huge_align)
 {
-    int vaddr_start = 0, bit_idx_start = -1;
-    uint32_t cnt = 0;
-    if (pf == PF_KERNEL)
-    { // 内核内存池
-        bit_idx_start = bitmap_scan(&kernel_vaddr.vaddr_bitmap, pg_cnt);
-        if (bit_idx_start == -1)
-        {
-            return NULL;
-        }
-        while (cnt < pg_cnt)
-        {
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
-        }
-        vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
+    struct task_struct *cur = running_thread();
+    uint32_t size = pg_cnt * PG_SIZE;
+    uint32_t vaddr_start = vma_get_unmapped(&cur->vma_list, size, huge_align ? HUGE_PG_SIZE : PG_SIZE);
+    if (vaddr_start == 0 || !vma_add(&cur->vma_list, vaddr_start, vaddr_start + size, VM_READ | VM_WRITE, VMA_ANON))
+    {
+        return NULL;
     }
-    else
-    { // 用户内存池
-        struct task_struct *cur = running_thread();
-        bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt);
-        if (bit_idx_start == -1)
-        {
-            return NULL;
-        }
 
-        while (cnt < pg_cnt)
-        {
-            bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
-        }
-        vaddr_start = cur->userprog_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
-
-        /* (0xc0000000 - PG_SIZE)做为用户3级栈已经在start_process被分配 */
-        ASSERT((uint32_t)vaddr_start < (0xc0000000 - PG_SIZE));
-    }
+    /* 用户3级栈所在的区域在创建进程时就已记录 */
+    ASSERT(vaddr_start < (0xc0000000 - PG_SIZE));
     return (void *)vaddr_start;
 }
 
@@ -105,361 +165,1472 @@ uint32_t *pde_ptr(uint32_t vaddr)
     return pde;
 }
 
-/* 在m_pool指向的物理内存池中分配1个物理页,
- * 成功则返回页框的物理地址,失败则返回NULL */
-static void *palloc(struct pool *m_pool)
+/* 判断虚拟地址vaddr所在的页在当前页表中是否已映射或已换出到交换区,即页中是否有内容.
+ * 要先判断pde再判断pte,否则pde不存在时访问pte会引发缺页异常.
+ * pde映射的是4M大页时没有页表,pte_ptr得到的是大页中的数据,不能当作pte */
+bool page_present(uint32_t vaddr)
 {
-    /* 扫描或设置位图要保证原子操作 */
-    int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1); // 找一个物理页面
-    if (bit_idx == -1)
-    {
-        return NULL;
-    }
-    bitmap_set(&m_pool->pool_bitmap, bit_idx, 1); // 将此位bit_idx置1
-    uint32_t page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);
-    return (void *)page_phyaddr;
+    uint32_t pde = *pde_ptr(vaddr);
+    return (pde & PG_P_1) && ((pde & PG_PS) || (*pte_ptr(vaddr) & (PG_P_1 | PG_SWAP)));
 }
 
-/* 页表中添加虚拟地址_vaddr与物理地址_page_phyaddr的映射 */
-static void page_table_add(void *_vaddr, void *_page_phyaddr)
+/* 将m_pool中以pg_idx为首页、阶为order的块放回伙伴系统,
+ * 若其伙伴也空闲则逐级合并成更大的块 */
+static void buddy_free_block(struct pool *m_pool, uint32_t pg_idx, uint8_t order)
 {
-    uint32_t vaddr = (uint32_t)_vaddr, page_phyaddr = (uint32_t)_page_phyaddr;
-    uint32_t *pde = pde_ptr(vaddr);
-    uint32_t *pte = pte_ptr(vaddr);
-
-    /************************   注意   *************************
-     * 执行*pte,会访问到pde。所以确保pde创建完成后才能执行*pte,
-     * 否则会引发page_fault。因此在pde未创建时,
-     * *pte只能出现在下面最外层else语句块中的*pde后面。
-     * *********************************************************/
-    /* 先在页目录内判断目录项的P位，若为1,则表示该表已存在 */
-    if (*pde & 0x00000001)
+    uint32_t page_cnt = m_pool->pool_size / PG_SIZE;
+    m_pool->free_pages += 1 << order;
+    while (order < MAX_ORDER - 1)
     {
-        ASSERT(!(*pte & 0x00000001));
-
-        if (!(*pte & 0x00000001))
-        {                                                       // 只要是创建页表,pte就应该不存在,多判断一下放心
-            *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1); // US=1,RW=1,P=1
+        uint32_t buddy_idx = pg_idx ^ (1 << order);
+        if (buddy_idx >= page_cnt)
+        { // 伙伴在内存池之外,无法合并
+            break;
         }
-        else
-        { // 调试模式下不会执行到此,上面的ASSERT会先执行.关闭调试时下面的PANIC会起作用
-            PANIC("pte repeat");
+        struct page *buddy = &m_pool->mem_map[buddy_idx];
+        if (!(buddy->flags & PAGE_BUDDY) || buddy->order != order)
+        { // 伙伴已被分配或已被拆成更小的块
+            break;
         }
+        /* 把伙伴从原链表中摘下,和本块合并成高一阶的块 */
+        list_remove(&buddy->free_elem);
+        buddy->flags &= ~PAGE_BUDDY;
+        m_pool->free_area[order].nr_free--;
+        pg_idx &= ~(1 << order);
+        order++;
     }
-    else
-    { // 页目录项不存在,所以要先创建页目录项再创建页表项.
-        /* 页表中用到的页框一律从内核空间分配 */
-        uint32_t pde_phyaddr = (uint32_t)palloc(&kernel_pool);
-        *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
-
-        /*******************   必须将页表所在的页清0   *********************
-         * 必须把分配到的物理页地址pde_phyaddr对应的物理内存清0,
-         * 避免里面的陈旧数据变成了页表中的页表项,从而让页表混乱.
-         * pte的高20位会映射到pde所指向的页表的物理起始地址.*/
-        memset((void *)((int)pte & 0xfffff000), 0, PG_SIZE);
-        /************************************************************/
-        ASSERT(!(*pte & 0x00000001));
-        *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1); // US=1,RW=1,P=1
-    }
+    struct page *pg = &m_pool->mem_map[pg_idx];
+    pg->flags |= PAGE_BUDDY;
+    pg->order = order;
+    list_push(&m_pool->free_area[order].free_list, &pg->free_elem);
+    m_pool->free_area[order].nr_free++;
 }
 
-/* 分配pg_cnt个页空间,成功则返回起始虚拟地址,失败时返回NULL */
-void *malloc_page(enum pool_flags pf, uint32_t pg_cnt)
+/* 从m_pool中分配一个阶为order的块,成功返回块首页下标,失败返回-1 */
+static int32_t buddy_alloc_block(struct pool *m_pool, uint8_t order)
 {
-    ASSERT(pg_cnt > 0 && pg_cnt < 3840);
-    /***********   malloc_page的原理是三个动作的合成:   ***********
-          1通过vaddr_get在虚拟内存池中申请虚拟地址
-          2通过palloc在物理内存池中申请物理页
-          3通过page_table_add将以上两步得到的虚拟地址和物理地址在页表中完成映射
-    ***************************************************************/
-    void *vaddr_start = vaddr_get(pf, pg_cnt);
-    if (vaddr_start == NULL)
+    /* 从order阶开始向上找第一个非空的空闲链表 */
+    uint8_t cur_order = order;
+    while (cur_order < MAX_ORDER && list_empty(&m_pool->free_area[cur_order].free_list))
     {
-        return NULL;
+        cur_order++;
+    }
+    if (cur_order == MAX_ORDER)
+    {
+        return -1;
     }
-    uint32_t vaddr = (uint32_t)vaddr_start, cnt = pg_cnt;
-    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
 
-    /* 因为虚拟地址是连续的,但物理地址可以是不连续的,所以逐个做映射*/
-    while (cnt-- > 0)
+    struct page *pg = elem2entry(struct page, free_elem, list_pop(&m_pool->free_area[cur_order].free_list));
+    m_pool->free_area[cur_order].nr_free--;
+    pg->flags &= ~PAGE_BUDDY;
+    uint32_t pg_idx = pg - m_pool->mem_map;
+
+    /* 找到的块比需要的大,就逐级对半拆分,把后一半挂回低一阶的链表 */
+    while (cur_order > order)
     {
-        void *page_phyaddr = palloc(mem_pool);
+        cur_order--;
+        struct page *buddy = &m_pool->mem_map[pg_idx + (1 << cur_order)];
+        buddy->flags |= PAGE_BUDDY;
+        buddy->order = cur_order;
+        list_push(&m_pool->free_area[cur_order].free_list, &buddy->free_elem);
+        m_pool->free_area[cur_order].nr_free++;
+    }
+    m_pool->free_pages -= 1 << order;
+    return pg_idx;
+}
 
-        /* 失败时要将曾经已申请的虚拟地址和物理页全部回滚，
-         * 在将来完成内存回收时再补充 */
-        if (page_phyaddr == NULL)
+/* 把m_pool中以pg_idx起始的连续pg_cnt个页框按最大的对齐块放回伙伴系统 */
+static void buddy_free_range(struct pool *m_pool, uint32_t pg_idx, uint32_t pg_cnt)
+{
+    while (pg_cnt > 0)
+    {
+        uint8_t order = MAX_ORDER - 1;
+        while (order > 0 && ((pg_idx & ((1 << order) - 1)) || (1U << order) > pg_cnt))
         {
-            return NULL;
+            order--;
         }
-
-        page_table_add((void *)vaddr, page_phyaddr); // 在页表中做映射
-        vaddr += PG_SIZE;                            // 下一个虚拟页
+        buddy_free_block(m_pool, pg_idx, order);
+        pg_idx += 1 << order;
+        pg_cnt -= 1 << order;
     }
-    return vaddr_start;
 }
 
-/* 从内核物理内存池中申请pg_cnt页内存,
- * 成功则返回其虚拟地址,失败则返回NULL */
-void *get_kernel_pages(uint32_t pg_cnt)
+/* 返回能容纳pg_cnt个页框的最小阶 */
+static uint8_t pages_to_order(uint32_t pg_cnt)
 {
-    lock_acquire(&kernel_pool.lock);
-    void *vaddr = malloc_page(PF_KERNEL, pg_cnt);
-    if (vaddr != NULL)
-    { // 若分配的地址不为空,将页框清0后返回
-        memset(vaddr, 0, pg_cnt * PG_SIZE);
+    uint8_t order = 0;
+    while ((1U << order) < pg_cnt)
+    {
+        order++;
     }
-    lock_release(&kernel_pool.lock);
-    return vaddr;
+    return order;
 }
 
-/* 在用户空间中申请4k内存,并返回其虚拟地址 */
-void *get_user_pages(uint32_t pg_cnt)
+/* 从m_pool的预清0链表中取出1个页框,返回其下标,链表为空时返回-1 */
+static int32_t zeroed_page_pop(struct pool *m_pool)
 {
-    lock_acquire(&user_pool.lock);
-    void *vaddr = malloc_page(PF_USER, pg_cnt);
-    if (vaddr != NULL)
-    { // 若分配的地址不为空,将页框清0后返回
-        memset(vaddr, 0, pg_cnt * PG_SIZE);
+    if (m_pool->zeroed_cnt == 0)
+    {
+        return -1;
     }
-    lock_release(&user_pool.lock);
-    return vaddr;
+    m_pool->zeroed_cnt--;
+    struct page *pg = elem2entry(struct page, free_elem, list_pop(&m_pool->zeroed_list));
+    return pg - m_pool->mem_map;
 }
 
-/* 将地址vaddr与pf池中的物理地址关联,仅支持一页空间分配 */
-void *get_a_page(enum pool_flags pf, uint32_t vaddr)
+/* 把m_pool中预先清0的页框全部放回伙伴系统,使它们能与伙伴合并 */
+static void zeroed_pages_drain(struct pool *m_pool)
 {
-    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-    lock_acquire(&mem_pool->lock);
-
-    /* 先将虚拟地址对应的位图置1 */
-    struct task_struct *cur = running_thread();
-    int32_t bit_idx = -1;
-
-    /* 若当前是用户进程申请用户内存,就修改用户进程自己的虚拟地址位图 */
-    if (cur->pgdir != NULL && pf == PF_USER)
+    int32_t pg_idx;
+    while ((pg_idx = zeroed_page_pop(m_pool)) != -1)
     {
-        bit_idx = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
-        ASSERT(bit_idx >= 0);
-        bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
+        buddy_free_block(m_pool, pg_idx, 0);
     }
-    else if (cur->pgdir == NULL && pf == PF_KERNEL)
-    {
-        /* 如果是内核线程申请内核内存,就修改kernel_vaddr. */
-        bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
-        ASSERT(bit_idx > 0);
-        bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx, 1);
+}
+
+/* m_pool内存不足时,从另一个内存池移来紧邻分界处的4M块.
+ * 内核内存池在下、用户内存池在上,分界4M对齐,mem_map按物理页框号连续存放,
+ * 伙伴系统最大的块也是4M,所以移动一块只需挪动分界,两边其它块的对齐都不受影响.
+ * 该块须整块空闲,且对方移走后仍有POOL_RESERVE_PAGES个空闲页框.调用者须持有m_pool的锁,成功返回true */
+static bool pool_grow(struct pool *m_pool)
+{
+    struct pool *donor = m_pool == &kernel_pool ? &user_pool : &kernel_pool;
+    if (user_pool.phy_addr_start % HUGE_PG_SIZE != 0)
+    { // 内存太小时分界没有对齐,不能移动
+        return false;
     }
-    else
+    if (donor == &user_pool && user_pool.phy_addr_start + HUGE_PG_SIZE > DIRECT_MAP_SIZE)
+    { // 内核内存都经直接映射区访问,不能借到高端内存
+        return false;
+    }
+    /* 其它路径都是先持用户池的锁再申请内核池的页表,内核池向用户池借时只尝试加锁,以免死锁 */
+    if (donor == &kernel_pool)
     {
-        PANIC("get_a_page:not allow kernel alloc userspace or user alloc kernelspace by get_a_page");
+        lock_acquire(&kernel_pool.lock);
     }
-
-    void *page_phyaddr = palloc(mem_pool);
-    if (page_phyaddr == NULL)
+    else if (!lock_try_acquire(&user_pool.lock))
     {
-        lock_release(&mem_pool->lock);
-        return NULL;
+        return false;
     }
-    page_table_add((void *)vaddr, page_phyaddr);
-    lock_release(&mem_pool->lock);
-    return (void *)vaddr;
-}
 
-/* 安装1页大小的vaddr,专门针对fork时虚拟地址位图无须操作的情况 */
-void *get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr)
-{
-    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-    lock_acquire(&mem_pool->lock);
-    void *page_phyaddr = palloc(mem_pool);
-    if (page_phyaddr == NULL)
+    bool grown = false;
+    uint32_t donor_pages = donor->pool_size / PG_SIZE;
+    if (donor_pages >= HUGE_PG_PAGES)
     {
-        lock_release(&mem_pool->lock);
-        return NULL;
+        struct page *chunk = &donor->mem_map[donor == &kernel_pool ? donor_pages - HUGE_PG_PAGES : 0];
+        if (!(chunk->flags & PAGE_BUDDY) || chunk->order != MAX_ORDER - 1)
+        { // 预先清0的页框不在伙伴系统中,放回去后也许能合并出整块
+            zeroed_pages_drain(donor);
+        }
+        if ((chunk->flags & PAGE_BUDDY) && chunk->order == MAX_ORDER - 1 &&
+            donor->free_pages >= HUGE_PG_PAGES + POOL_RESERVE_PAGES)
+        {
+            list_remove(&chunk->free_elem);
+            chunk->flags &= ~PAGE_BUDDY;
+            donor->free_area[MAX_ORDER - 1].nr_free--;
+            donor->free_pages -= HUGE_PG_PAGES;
+            donor->pool_size -= HUGE_PG_SIZE;
+            donor->present_pages -= HUGE_PG_PAGES;
+            m_pool->pool_size += HUGE_PG_SIZE;
+            m_pool->present_pages += HUGE_PG_PAGES;
+            if (donor == &user_pool)
+            { // 分界上移,用户池的下标整体减1024
+                user_pool.phy_addr_start += HUGE_PG_SIZE;
+                user_pool.mem_map += HUGE_PG_PAGES;
+                buddy_free_block(&kernel_pool, kernel_pool.pool_size / PG_SIZE - HUGE_PG_PAGES, MAX_ORDER - 1);
+            }
+            else
+            { // 分界下移,用户池的下标整体加1024
+                user_pool.phy_addr_start -= HUGE_PG_SIZE;
+                user_pool.mem_map -= HUGE_PG_PAGES;
+                buddy_free_block(&user_pool, 0, MAX_ORDER - 1);
+            }
+            m_pool->grown_chunks++;
+            grown = true;
+        }
     }
-    page_table_add((void *)vaddr, page_phyaddr);
-    lock_release(&mem_pool->lock);
-    return (void *)vaddr;
+    lock_release(&donor->lock);
+    return grown;
 }
 
-/* 得到虚拟地址映射到的物理地址 */
-uint32_t addr_v2p(uint32_t vaddr)
+/* 返回预留区中第idx个页框的描述符.mem_map按物理页框号下标,从内核内存池的起点算起 */
+static struct page *cma_page(uint32_t idx)
 {
-    uint32_t *pte = pte_ptr(vaddr);
-    /* (*pte)的值是页表所在的物理页框地址,
-     * 去掉其低12位的页表项属性+虚拟地址vaddr的低12位 */
-    return ((*pte & 0xfffff000) + (vaddr & 0x00000fff));
+    return &kernel_pool.mem_map[cma.base / PG_SIZE + idx];
 }
 
-/* 返回arena中第idx个内存块的地址 */
-static struct mem_block *arena2block(struct arena *a, uint32_t idx)
+/* 判断页框pg_phy_addr是否在预留区中 */
+static bool cma_contains(uint32_t pg_phy_addr)
 {
-    return (struct mem_block *)((uint32_t)a + sizeof(struct arena) + idx * a->desc->block_size);
+    return cma.base != 0 && pg_phy_addr >= cma.base && pg_phy_addr < cma.base + CMA_PAGES * PG_SIZE;
 }
 
-/* 返回内存块b所在的arena地址 */
-static struct arena *block2arena(struct mem_block *b)
+/* 用户内存池耗尽时从预留区借1个页框给用户页,返回物理地址,没有空闲页框时返回NULL.
+ * 借出的页框只能以4K页映射给进程,这样palloc_contig才能找到并迁走它 */
+static void *cma_alloc_movable(void)
 {
-    return (struct arena *)((uint32_t)b & 0xfffff000);
+    int32_t idx = cma.base == 0 ? -1 : bitmap_scan(&cma.btmp, 1);
+    if (idx == -1)
+    {
+        return NULL;
+    }
+    bitmap_set(&cma.btmp, idx, 1);
+    struct page *pg = cma_page(idx);
+    pg->flags |= PAGE_MOVABLE;
+    pg->ref_cnt = 1;
+    cma.movable_pages++;
+    return (void *)(cma.base + idx * PG_SIZE);
 }
 
-/* 在堆中申请size字节内存 */
-void *sys_malloc(uint32_t size)
+/* 把引用计数已减为0的预留区页框放回预留区 */
+static void cma_free_page(uint32_t pg_phy_addr)
 {
-    enum pool_flags PF;
-    struct pool *mem_pool;
-    uint32_t pool_size;
-    struct mem_block_desc *descs;
-    struct task_struct *cur_thread = running_thread();
-
-    /* 判断用哪个内存池*/
-    if (cur_thread->pgdir == NULL)
-    { // 若为内核线程
-        PF = PF_KERNEL;
-        pool_size = kernel_pool.pool_size;
-        mem_pool = &kernel_pool;
-        descs = k_block_descs;
+    uint32_t idx = (pg_phy_addr - cma.base) / PG_SIZE;
+    struct page *pg = cma_page(idx);
+    if (pg->flags & PAGE_MOVABLE)
+    {
+        pg->flags &= ~PAGE_MOVABLE;
+        cma.movable_pages--;
     }
     else
-    { // 用户进程pcb中的pgdir会在为其分配页表时创建
-        PF = PF_USER;
-        pool_size = user_pool.pool_size;
-        mem_pool = &user_pool;
-        descs = cur_thread->u_block_desc;
+    {
+        cma.contig_pages--;
     }
+    bitmap_set(&cma.btmp, idx, 0);
+}
 
-    /* 若申请的内存不在内存池容量范围内则直接返回NULL */
-    if (!(size > 0 && size < pool_size))
+/* 在task的用户区域中从*vaddr起按时钟算法扫描页表项:访问位为1的清0,给它再留一圈,
+ * 返回第一个访问位为0、只被这一个页表项映射的4K页的pte,并在*vaddr中返回其地址.task中没有可换出的页时返回NULL.
+ * 页表都在内核内存池中,经直接映射区就能访问其它进程的页表.调用者须关中断 */
+static uint32_t *clock_scan_task(struct task_struct *task, uint32_t *vaddr)
+{
+    bool is_cur = task == running_thread();
+    struct list_elem *elem = task->vma_list.head.next;
+    while (elem != &task->vma_list.tail)
     {
-        return NULL;
+        struct vm_area *vma = elem2entry(struct vm_area, vma_tag, elem);
+        uint32_t va = *vaddr > vma->start ? *vaddr : vma->start;
+        elem = elem->next;
+        while (va < vma->end)
+        {
+            uint32_t pde = task->pgdir[PDE_IDX(va)];
+            if (!(pde & PG_P_1) || (pde & PG_PS))
+            { // 大页不换出
+                va = (va & 0xffc00000) + HUGE_PG_SIZE;
+                continue;
+            }
+            uint32_t *pte = (uint32_t *)K_P2V(pde & 0xfffff000) + PTE_IDX(va);
+            /* fork后共享的页要改所有共享者的页表项,不换出 */
+            if ((*pte & PG_P_1) && kernel_pool.mem_map[*pte / PG_SIZE].ref_cnt == 1)
+            {
+                if (!(*pte & PG_A))
+                {
+                    *vaddr = va;
+                    return pte;
+                }
+                *pte &= ~PG_A;
+                /* 其它进程的用户页不是全局页,切换到它们时重新加载cr3就会刷掉旧项 */
+                if (is_cur)
+                {
+                    asm volatile("invlpg %0" ::"m"(*(char *)va) : "memory");
+                }
+            }
+            va += PG_SIZE;
+        }
     }
-    struct arena *a;
-    struct mem_block *b;
-    lock_acquire(&mem_pool->lock);
-    /* 超过最大内存块1024, 就分配页框 */
-    if (size > 1024)
-    {
-        uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE); // 向上取整需要的页框数
-
-        a = malloc_page(PF, page_cnt);
+    return NULL;
+}
 
-        if (a != NULL)
+/* 从时钟指针处依次扫描所有用户进程,返回一个可以换出的页的pte,*owner和*vaddr返回所属进程和虚拟地址.
+ * 扫描两圈后所有页的访问位都已清过,仍找不到说明没有能换出的页,返回NULL.调用者须关中断 */
+static uint32_t *clock_scan(struct task_struct **owner, uint32_t *vaddr)
+{
+    struct list_elem *elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail)
+    {
+        struct task_struct *task = elem2entry(struct task_struct, all_list_tag, elem);
+        if (task->pid == clock_pid)
         {
-            memset(a, 0, page_cnt * PG_SIZE); // 将分配的内存清0
-
-            /* 对于分配的大块页框,将desc置为NULL, cnt置为页框数,large置为true */
-            a->desc = NULL;
-            a->cnt = page_cnt;
-            a->large = true;
-            lock_release(&mem_pool->lock);
-            return (void *)(a + 1); // 跨过arena大小，把剩下的内存返回
+            break;
         }
-        else
+        elem = elem->next;
+    }
+    uint32_t va = clock_vaddr, laps = 0;
+    if (elem == &thread_all_list.tail)
+    { // 指针所在的进程已不在,从头开始
+        elem = thread_all_list.head.next;
+        va = 0;
+    }
+    while (laps <= 2)
+    {
+        struct task_struct *task = elem2entry(struct task_struct, all_list_tag, elem);
+        uint32_t *pte = task->pgdir == NULL ? NULL : clock_scan_task(task, &va);
+        if (pte != NULL)
         {
-            lock_release(&mem_pool->lock);
-            return NULL;
+            clock_pid = task->pid;
+            clock_vaddr = va + PG_SIZE;
+            *owner = task;
+            *vaddr = va;
+            return pte;
+        }
+        elem = elem->next;
+        if (elem == &thread_all_list.tail)
+        {
+            elem = thread_all_list.head.next;
+            laps++;
         }
+        va = 0;
     }
-    else
-    { // 若申请的内存小于等于1024,可在各种规格的mem_block_desc中去适配
-        uint8_t desc_idx;
+    return NULL;
+}
 
-        /* 从内存块描述符中匹配合适的内存块规格 */
-        for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++)
+/* 用户内存池耗尽时把最多SWAP_BATCH个最近未被访问的用户页写到交换区并归还其页框,返回换出的页数.
+ * 页的内容先复制到缓冲区、页表项改为交换槽号后才写盘,写盘期间只持有swap_io_lock,
+ * 其它任务的缺页和分配不必等磁盘;进程此时访问该页要在缺页异常中等swap_io_lock,拿到时数据已在交换区中.
+ * 调用者须持有user_pool的锁,此函数中会暂时放开它,返回后调用者之前读到的页表项可能已经失效 */
+static uint32_t swap_out_pages(void)
+{
+    uint32_t cnt = 0;
+    /* 锁的顺序是先swap_io_lock后user_pool的锁,等swap_io_lock前先放开user_pool的锁.
+     * 从swap_in_page进来时已持有swap_io_lock,重入即可.
+     * user_pool的锁若是重入的,放开一次并不真正释放,会与换入的任务互相等待,
+     * 所以持有此锁时内核不能访问用户页,以免在缺页中嵌套进来 */
+    ASSERT(user_pool.lock.holder_repeat_nr == 1);
+    lock_release(&user_pool.lock);
+    lock_acquire(&swap_io_lock);
+    lock_acquire(&user_pool.lock);
+    while (cnt < SWAP_BATCH)
+    {
+        int32_t slot = swap_slot_alloc();
+        if (slot == -1)
         {
-            if (size <= descs[desc_idx].block_size)
-            { // 从小往大后,找到后退出
-                break;
-            }
+            break;
         }
+        /* 查改其它进程的区域和页表期间不能让它们运行 */
+        enum intr_status old_status = intr_disable();
+        struct task_struct *owner;
+        uint32_t vaddr;
+        uint32_t *pte = clock_scan(&owner, &vaddr);
+        if (pte == NULL)
+        {
+            intr_set_status(old_status);
+            swap_slot_free(slot);
+            break;
+        }
+        uint32_t page_phyaddr = *pte & 0xfffff000;
+        void *src = kmap_atomic(page_phyaddr, KM_SRC);
+        memcpy(swap_buf, src, PG_SIZE);
+        kunmap_atomic(src, KM_SRC);
+        *pte = ((uint32_t)slot << 12) | PG_SWAP;
+        if (owner == running_thread())
+        {
+            asm volatile("invlpg %0" ::"m"(*(char *)vaddr) : "memory");
+        }
+        pfree(page_phyaddr);
+        intr_set_status(old_status);
+
+        lock_release(&user_pool.lock);
+        swap_write(slot, swap_buf);
+        lock_acquire(&user_pool.lock);
+        cnt++;
+    }
+    lock_release(&swap_io_lock);
+    return cnt;
+}
 
-        /* 若mem_block_desc的free_list中已经没有可用的mem_block,
-         * 就创建新的arena提供mem_block */
-        if (list_empty(&descs[desc_idx].free_list))
+/* 在m_pool指向的物理内存池中分配1个物理页,
+ * 成功则返回页框的物理地址,失败则返回NULL */
+static void *palloc(struct pool *m_pool)
+{
+    /* 扫描或设置伙伴系统要保证原子操作 */
+    int32_t pg_idx = buddy_alloc_block(m_pool, 0); // 找一个物理页面
+    if (pg_idx == -1)
+    {
+        /* 伙伴系统已空,预先清0的页框也可以用,再没有就向另一个内存池借 */
+        pg_idx = zeroed_page_pop(m_pool);
+        if (pg_idx == -1 && pool_grow(m_pool))
         {
-            a = malloc_page(PF, 1); // 分配1页框做为arena
-            if (a == NULL)
+            pg_idx = buddy_alloc_block(m_pool, 0);
+        }
+        if (pg_idx == -1 && m_pool == &user_pool)
+        { // 用户页还可以借用连续分配的预留区,再没有就换出最近未访问的用户页
+            void *page_phyaddr = cma_alloc_movable();
+            if (page_phyaddr != NULL)
             {
-                lock_release(&mem_pool->lock);
-                return NULL;
+                return page_phyaddr;
             }
-            memset(a, 0, PG_SIZE);
-
-            /* 对于分配的小块内存,将desc置为相应内存块描述符,
-             * cnt置为此arena可用的内存块数,large置为false */
-            a->desc = &descs[desc_idx];
-            a->large = false;
-            a->cnt = descs[desc_idx].blocks_per_arena;
-            uint32_t block_idx;
-
-            enum intr_status old_status = intr_disable();
-
-            /* 开始将arena拆分成内存块,并添加到内存块描述符的free_list中 */
-            for (block_idx = 0; block_idx < descs[desc_idx].blocks_per_arena; block_idx++)
+            /* 写盘时放开了锁,换出的页框可能已被别的任务取走,再换一批 */
+            while (pg_idx == -1 && swap_out_pages() != 0)
             {
-                b = arena2block(a, block_idx);
-                ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
-                list_append(&a->desc->free_list, &b->free_elem);
+                pg_idx = buddy_alloc_block(m_pool, 0);
             }
-            intr_set_status(old_status);
         }
-        /* 开始分配内存块 */
-        b = elem2entry(struct mem_block, free_elem, list_pop(&(descs[desc_idx].free_list)));
-        memset(b, 0, descs[desc_idx].block_size);
+        if (pg_idx == -1)
+        {
+            return NULL;
+        }
+    }
+    m_pool->mem_map[pg_idx].ref_cnt = 1;
+    uint32_t page_phyaddr = ((pg_idx * PG_SIZE) + m_pool->phy_addr_start);
+    return (void *)page_phyaddr;
+}
 
-        a = block2arena(b); // 获取内存块b所在的arena
-        a->cnt--;           // 将此arena中的空闲内存块数减1
-        lock_release(&mem_pool->lock);
-        return (void *)b;
+/* 分配1个内容为0的物理页框,优先取空闲线程预先清0的页框.
+ * *zeroed返回页框是否已清0,为false时须由调用者映射后自行清0 */
+static void *palloc_zero(struct pool *m_pool, bool *zeroed)
+{
+    int32_t pg_idx = zeroed_page_pop(m_pool);
+    if (pg_idx == -1)
+    {
+        *zeroed = false;
+        return palloc(m_pool);
     }
+    *zeroed = true;
+    m_pool->mem_map[pg_idx].ref_cnt = 1;
+    return (void *)((pg_idx * PG_SIZE) + m_pool->phy_addr_start);
 }
 
-/* 将物理地址pg_phy_addr回收到物理内存池 */
-void pfree(uint32_t pg_phy_addr)
+/* 在m_pool中分配物理地址连续的pg_cnt个页框,
+ * 成功则返回起始物理地址,失败则返回NULL */
+static void *palloc_contiguous(struct pool *m_pool, uint32_t pg_cnt)
 {
-    struct pool *mem_pool;
-    uint32_t bit_idx = 0;
-    if (pg_phy_addr >= user_pool.phy_addr_start)
-    { // 用户物理内存池
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
+    uint8_t order = pages_to_order(pg_cnt);
+    if (order >= MAX_ORDER)
+    {
+        return NULL;
     }
-    else
-    { // 内核物理内存池
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
+    int32_t pg_idx = buddy_alloc_block(m_pool, order);
+    /* 只是碎片化时不借,空闲页框确实不够才向另一个内存池借 */
+    if (pg_idx == -1 && m_pool->free_pages < pg_cnt && pool_grow(m_pool))
+    {
+        pg_idx = buddy_alloc_block(m_pool, order);
+    }
+    if (pg_idx == -1)
+    {
+        return NULL;
+    }
+    /* 块的大小是2的幂,多出来的尾部页框还给伙伴系统 */
+    buddy_free_range(m_pool, pg_idx + pg_cnt, (1 << order) - pg_cnt);
+    uint32_t cnt = 0;
+    while (cnt < pg_cnt)
+    {
+        m_pool->mem_map[pg_idx + cnt++].ref_cnt = 1;
     }
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0); // 将位图中该位清0
+    return (void *)((pg_idx * PG_SIZE) + m_pool->phy_addr_start);
 }
 
-/* 去掉页表中虚拟地址vaddr的映射,只去掉vaddr对应的pte */
-static void page_table_pte_remove(uint32_t vaddr)
+/* 确保vaddr所在的4M区域有页表,pde不存在时分配一张清0的页表.
+ * 页表中用到的页框一律从内核空间分配,申请不到时返回false */
+static bool page_table_get(uint32_t vaddr)
 {
-    uint32_t *pte = pte_ptr(vaddr);
-    *pte &= ~PG_P_1;                                   // 将页表项pte的P位置0
-    asm volatile("invlpg %0" ::"m"(vaddr) : "memory"); // 更新tlb
+    uint32_t *pde = pde_ptr(vaddr);
+    if (*pde & PG_P_1)
+    {
+        ASSERT(!(*pde & PG_PS));
+        return true;
+    }
+
+    bool zeroed;
+    lock_acquire(&kernel_pool.lock);
+    void *pt_phyaddr = palloc_zero(&kernel_pool, &zeroed);
+    lock_release(&kernel_pool.lock);
+    if (pt_phyaddr == NULL)
+    {
+        return false;
+    }
+    /* 必须将页表所在的页清0,避免里面的陈旧数据变成了页表中的页表项 */
+    if (!zeroed)
+    {
+        memset(K_P2V(pt_phyaddr), 0, PG_SIZE);
+    }
+    *pde = (uint32_t)pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    return true;
 }
 
-/* 在虚拟地址池中释放以_vaddr起始的连续pg_cnt个虚拟页地址 */
-static void vaddr_remove(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
+/* 把从page_phyaddr起物理连续的pg_cnt个页框依次映射到用户虚拟地址vaddr起的pg_cnt页,这些页原先不能有映射.
+ * 先为涉及的每个4M区域各查一次pde、补齐缺的页表,再逐个4M区域顺序填写pte,不必每页都经pde_ptr/pte_ptr.
+ * 原先不存在的pte不会缓存在tlb中,因此不用刷新.调用者须持有user_pool的锁,
+ * 申请不到页表时返回false,此时一页也没有映射 */
+bool map_range(uint32_t vaddr, uint32_t page_phyaddr, uint32_t pg_cnt)
 {
-    uint32_t bit_idx_start = 0, vaddr = (uint32_t)_vaddr, cnt = 0;
-
-    if (pf == PF_KERNEL)
-    { // 内核虚拟内存池
-        bit_idx_start = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
-        while (cnt < pg_cnt)
+    ASSERT(vaddr % PG_SIZE == 0 && page_phyaddr % PG_SIZE == 0 && pg_cnt > 0);
+    uint32_t vaddr_end = vaddr + pg_cnt * PG_SIZE, pde_vaddr = vaddr & 0xffc00000;
+    while (pde_vaddr < vaddr_end)
+    {
+        if (!page_table_get(pde_vaddr))
         {
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
+            return false;
         }
+        pde_vaddr += HUGE_PG_SIZE;
     }
-    else
-    { // 用户虚拟内存池
-        struct task_struct *cur_thread = running_thread();
-        bit_idx_start = (vaddr - cur_thread->userprog_vaddr.vaddr_start) / PG_SIZE;
-        while (cnt < pg_cnt)
+
+    while (vaddr < vaddr_end)
+    {
+        /* 页目录最后一项指向页目录自己,一个4M区域的pte在页表中是连续的 */
+        uint32_t *pte = pte_ptr(vaddr);
+        uint32_t run = 1024 - PTE_IDX(vaddr);
+        if (run > (vaddr_end - vaddr) / PG_SIZE)
+        {
+            run = (vaddr_end - vaddr) / PG_SIZE;
+        }
+        vaddr += run * PG_SIZE;
+        while (run-- > 0)
+        {
+            ASSERT(!(*pte & PG_P_1));
+            *pte++ = page_phyaddr | PG_US_U | PG_RW_W | PG_P_1; // US=1,RW=1,P=1
+            page_phyaddr += PG_SIZE;
+        }
+    }
+    return true;
+}
+
+/* 为临时映射窗口分配页表并挂在内核页目录的第1022项上.
+ * 进程的页目录在创建时复制内核部分的pde,所以必须在创建任何进程之前调用,之后所有进程共用这张页表 */
+static void kmap_init(void)
+{
+    uint32_t *pde = pde_ptr(KMAP_BASE);
+    ASSERT(!(*pde & PG_P_1));
+    bool zeroed;
+    lock_acquire(&kernel_pool.lock);
+    void *pt_phyaddr = palloc_zero(&kernel_pool, &zeroed);
+    lock_release(&kernel_pool.lock);
+    if (pt_phyaddr == NULL)
+    {
+        PANIC("kmap_init: no page for kmap page table");
+    }
+    kmap_pte = K_P2V(pt_phyaddr);
+    if (!zeroed)
+    {
+        memset(kmap_pte, 0, PG_SIZE);
+    }
+    *pde = (uint32_t)pt_phyaddr | PG_RW_W | PG_P_1;
+}
+
+/* 把物理页框pg_phy_addr映射到type槽位并返回其虚拟地址,用于访问不在当前地址空间中的页框.
+ * 映射期间关中断,以免被切换出去的任务在同一槽位上重入;必须用kunmap_atomic按相反的顺序解除 */
+void *kmap_atomic(uint32_t pg_phy_addr, enum km_type type)
+{
+    ASSERT(type < KM_TYPE_NR && pg_phy_addr % PG_SIZE == 0);
+    enum intr_status old_status = intr_disable();
+    ASSERT(!(kmap_pte[type] & PG_P_1));
+    kmap_intr_status[type] = old_status;
+    /* 槽位解除映射时已invlpg,tlb中不会留有旧项 */
+    kmap_pte[type] = pg_phy_addr | PG_RW_W | PG_P_1;
+    kmap_cnt++;
+    return (void *)(KMAP_BASE + type * PG_SIZE);
+}
+
+/* 解除kmap_atomic在type槽位上的映射,只刷新这一页的tlb */
+void kunmap_atomic(void *vaddr, enum km_type type)
+{
+    ASSERT(type < KM_TYPE_NR && (uint32_t)vaddr == KMAP_BASE + type * PG_SIZE);
+    kmap_pte[type] = 0;
+    asm volatile("invlpg %0" ::"m"(*(char *)vaddr) : "memory");
+    intr_set_status(kmap_intr_status[type]);
+}
+
+/* 经临时映射窗口把物理页框pg_phy_addr清0 */
+static void clear_phys_page(uint32_t pg_phy_addr)
+{
+    void *vaddr = kmap_atomic(pg_phy_addr, KM_DST);
+    memset(vaddr, 0, PG_SIZE);
+    kunmap_atomic(vaddr, KM_DST);
+}
+
+/* 为当前进程已记录在区域中的用户虚拟页vaddr起的pg_cnt页立即分配物理页并映射,已映射的页保持不变.
+ * 用于马上就会被整页写满的内存,省去逐页的缺页异常和清0,因此页框不清0.
+ * 每段连续未映射的页尽量整段申请物理连续的页框,再用map_range一次装入.
+ * 内存不足时提前返回,剩下的页仍由缺页异常按需映射 */
+void populate_user_pages(uint32_t vaddr, uint32_t pg_cnt)
+{
+    uint32_t vaddr_end = vaddr + pg_cnt * PG_SIZE;
+    lock_acquire(&user_pool.lock);
+    while (vaddr < vaddr_end)
+    {
+        if (page_present(vaddr))
+        {
+            vaddr += PG_SIZE;
+            continue;
+        }
+        uint32_t run = 1;
+        while (run < HUGE_PG_PAGES && vaddr + run * PG_SIZE < vaddr_end &&
+               !page_present(vaddr + run * PG_SIZE))
+        {
+            run++;
+        }
+
+        /* 没有这么大的连续块就减半再试 */
+        void *page_phyaddr = palloc_contiguous(&user_pool, run);
+        while (page_phyaddr == NULL && run > 1)
+        {
+            run /= 2;
+            page_phyaddr = palloc_contiguous(&user_pool, run);
+        }
+        if (page_phyaddr == NULL)
+        {
+            break;
+        }
+        if (!map_range(vaddr, (uint32_t)page_phyaddr, run))
+        {
+            while (run-- > 0)
+            {
+                pfree((uint32_t)page_phyaddr + run * PG_SIZE);
+            }
+            break;
+        }
+        vaddr += run * PG_SIZE;
+    }
+    lock_release(&user_pool.lock);
+}
+
+/* 读时间戳计数器的低32位,用于统计耗时 */
+static uint32_t rdtsc32(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+/* 检查预留区中从idx起的cnt个页框:有被连续分配占用的返回-1,否则返回其中借给用户页的页框数 */
+static int32_t cma_range_check(uint32_t idx, uint32_t cnt)
+{
+    int32_t movable = 0;
+    uint32_t end = idx + cnt;
+    for (; idx < end; idx++)
+    {
+        if (bitmap_scan_test(&cma.btmp, idx))
+        {
+            if (!(cma_page(idx)->flags & PAGE_MOVABLE))
+            {
+                return -1;
+            }
+            movable++;
+        }
+    }
+    return movable;
+}
+
+/* 遍历所有用户进程各区域的页表项,找出映射预留区中[idx, idx+cnt)页框的项.
+ * remap为false时在cma_map_cnt中数出每个页框被映射的次数,为true时把这些项改为指向cma_dest中的新页框.
+ * 没有反向映射,只能逐个进程地查;借出的页框只会用4K页映射,大页直接跳过.
+ * 调用者须关中断并持有user_pool的锁 */
+static void cma_walk_ptes(uint32_t idx, uint32_t cnt, bool remap)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t range_start = cma.base + idx * PG_SIZE, range_end = range_start + cnt * PG_SIZE;
+    struct list_elem *t_elem = thread_all_list.head.next;
+    while (t_elem != &thread_all_list.tail)
+    {
+        struct task_struct *task = elem2entry(struct task_struct, all_list_tag, t_elem);
+        t_elem = t_elem->next;
+        if (task->pgdir == NULL)
+        {
+            continue;
+        }
+        struct list_elem *v_elem = task->vma_list.head.next;
+        while (v_elem != &task->vma_list.tail)
+        {
+            struct vm_area *vma = elem2entry(struct vm_area, vma_tag, v_elem);
+            uint32_t vaddr = vma->start;
+            v_elem = v_elem->next;
+            while (vaddr < vma->end)
+            {
+                uint32_t pde = task->pgdir[PDE_IDX(vaddr)];
+                if (!(pde & PG_P_1) || (pde & PG_PS))
+                {
+                    vaddr = (vaddr & 0xffc00000) + HUGE_PG_SIZE;
+                    continue;
+                }
+                /* 页表都在内核内存池中,经直接映射区就能访问其它进程的页表 */
+                uint32_t *pte = (uint32_t *)K_P2V(pde & 0xfffff000) + PTE_IDX(vaddr);
+                uint32_t frame = *pte & 0xfffff000;
+                if ((*pte & PG_P_1) && frame >= range_start && frame < range_end)
+                {
+                    uint32_t pg = (frame - cma.base) / PG_SIZE;
+                    if (!remap)
+                    {
+                        cma_map_cnt[pg]++;
+                    }
+                    else
+                    {
+                        *pte = cma_dest[pg] | (*pte & 0xfff);
+                        /* 其它进程的用户页不是全局页,切换到它们时重新加载cr3就会刷掉旧项 */
+                        if (task == cur)
+                        {
+                            asm volatile("invlpg %0" ::"m"(*(char *)vaddr) : "memory");
+                        }
+                    }
+                }
+                vaddr += PG_SIZE;
+            }
+        }
+    }
+}
+
+/* 把预留区[idx, idx+cnt)中借给用户页的页框迁到用户内存池的其它页框,成功返回true.
+ * 有页框的引用不全来自进程的页表(如exec正在填写、还未装入的参数页)或没有空闲页框时返回false,
+ * 此时什么也没有改动.调用者须持有user_pool的锁 */
+static bool cma_compact(uint32_t idx, uint32_t cnt)
+{
+    uint32_t i, end = idx + cnt;
+    bool ok = true;
+    /* 查改其它进程的区域和页表期间不能让它们运行 */
+    enum intr_status old_status = intr_disable();
+    memset(&cma_map_cnt[idx], 0, cnt * sizeof(cma_map_cnt[0]));
+    memset(&cma_dest[idx], 0, cnt * sizeof(cma_dest[0]));
+    cma_walk_ptes(idx, cnt, false);
+    for (i = idx; i < end; i++)
+    {
+        struct page *pg = cma_page(i);
+        if (!(pg->flags & PAGE_MOVABLE))
+        {
+            continue;
+        }
+        int32_t pg_idx = -1;
+        if (cma_map_cnt[i] == pg->ref_cnt)
+        {
+            pg_idx = buddy_alloc_block(&user_pool, 0);
+            if (pg_idx == -1)
+            {
+                pg_idx = zeroed_page_pop(&user_pool);
+            }
+        }
+        if (pg_idx == -1)
+        {
+            ok = false;
+            break;
+        }
+        user_pool.mem_map[pg_idx].ref_cnt = pg->ref_cnt;
+        cma_dest[i] = pg_idx * PG_SIZE + user_pool.phy_addr_start;
+
+        void *src = kmap_atomic(cma.base + i * PG_SIZE, KM_SRC);
+        void *dst = kmap_atomic(cma_dest[i], KM_DST);
+        memcpy(dst, src, PG_SIZE);
+        kunmap_atomic(dst, KM_DST);
+        kunmap_atomic(src, KM_SRC);
+    }
+
+    if (ok)
+    {
+        cma_walk_ptes(idx, cnt, true);
+    }
+    for (i = idx; i < end; i++)
+    {
+        if (cma_dest[i] == 0)
+        {
+            continue;
+        }
+        if (ok)
+        { // 旧页框已没有映射,放回预留区
+            cma_page(i)->ref_cnt = 0;
+            cma_free_page(cma.base + i * PG_SIZE);
+            cma.migrate_cnt++;
+        }
+        else
+        { // 放弃迁移,已申请的新页框还回去
+            buddy_free_block(&user_pool, (cma_dest[i] - user_pool.phy_addr_start) / PG_SIZE, 0);
+        }
+    }
+    intr_set_status(old_status);
+    return ok;
+}
+
+/* 从预留区分配2^order个物理连续的页框,起始地址按2^order页对齐,供DMA缓冲区等必须物理连续的场合使用.
+ * 先找完全空闲的一段,没有时再把借给用户页的页框迁走腾出一段.
+ * 成功返回物理地址,失败返回NULL.用pfree_contig归还 */
+void *palloc_contig(uint8_t order)
+{
+    uint32_t start = rdtsc32(), cnt = 1U << order, idx;
+    void *page_phyaddr = NULL;
+    if (order >= MAX_ORDER || cma.base == 0)
+    {
+        return NULL;
+    }
+
+    lock_acquire(&user_pool.lock);
+    int32_t found = -1;
+    for (idx = 0; idx < CMA_PAGES && found == -1; idx += cnt)
+    {
+        if (cma_range_check(idx, cnt) == 0)
+        {
+            found = idx;
+        }
+    }
+    for (idx = 0; idx < CMA_PAGES && found == -1; idx += cnt)
+    {
+        if (cma_range_check(idx, cnt) > 0 && cma_compact(idx, cnt))
+        {
+            found = idx;
+        }
+    }
+
+    if (found != -1)
+    {
+        bitmap_set_range(&cma.btmp, found, cnt);
+        for (idx = found; idx < found + cnt; idx++)
+        {
+            cma_page(idx)->ref_cnt = 1;
+        }
+        cma.contig_pages += cnt;
+        cma.alloc_cnt++;
+        page_phyaddr = (void *)(cma.base + found * PG_SIZE);
+    }
+    else
+    {
+        cma.fail_cnt++;
+    }
+    uint32_t cycles = rdtsc32() - start;
+    cma.total_kcycles += cycles >> 10;
+    if (cycles > cma.max_cycles)
+    {
+        cma.max_cycles = cycles;
+    }
+    lock_release(&user_pool.lock);
+    return page_phyaddr;
+}
+
+/* 归还palloc_contig分配的2^order个页框 */
+void pfree_contig(uint32_t pg_phy_addr, uint8_t order)
+{
+    ASSERT(cma_contains(pg_phy_addr));
+    uint32_t cnt;
+    lock_acquire(&user_pool.lock);
+    for (cnt = 0; cnt < (1U << order); cnt++)
+    {
+        pfree(pg_phy_addr + cnt * PG_SIZE);
+    }
+    lock_release(&user_pool.lock);
+}
+
+/* 用一个4M大页映射当前进程中4M对齐的用户虚拟地址vaddr,这4M的虚拟地址须已记录在区域中且没有映射任何页.
+ * 调用者须持有user_pool的锁.没有4M对齐的连续空闲页框时返回false,该区域仍在缺页时按4K页映射 */
+static bool huge_page_map(uint32_t vaddr)
+{
+    /* 伙伴系统中的块只是相对内存池起始处对齐,内存池起始处本身4M对齐时最大的块才能用作大页 */
+    if (user_pool.phy_addr_start % HUGE_PG_SIZE != 0)
+    {
+        return false;
+    }
+    /* 伙伴系统中没有完整的4M块时就用4K页,不动连续分配的预留区:
+     * 大页不可迁移,拿走整个预留区就再也分不出DMA缓冲区了 */
+    uint32_t page_phyaddr = (uint32_t)palloc_contiguous(&user_pool, HUGE_PG_PAGES);
+    if (page_phyaddr == 0)
+    {
+        return false;
+    }
+    /* 用户页框只经用户映射或临时映射窗口访问,不依赖它们落在直接映射区中 */
+    uint32_t cnt;
+    for (cnt = 0; cnt < HUGE_PG_PAGES; cnt++)
+    {
+        clear_phys_page(page_phyaddr + cnt * PG_SIZE);
+    }
+
+    /* 这4M区域中以前用过又已释放的4K页会留下一张空页表,换成大页前先归还 */
+    uint32_t *pde = pde_ptr(vaddr);
+    if (*pde & PG_P_1)
+    {
+        ASSERT(!(*pde & PG_PS));
+        lock_acquire(&kernel_pool.lock);
+        pfree(*pde & 0xfffff000);
+        lock_release(&kernel_pool.lock);
+    }
+    *pde = page_phyaddr | PG_PS | PG_US_U | PG_RW_W | PG_P_1;
+    asm volatile("invlpg %0" ::"m"(*(char *)vaddr) : "memory");
+    huge_page_cnt++;
+    return true;
+}
+
+/* 解除4M大页vaddr的映射并归还其页框,仍被fork出的进程共享的页框只减少引用计数.
+ * 调用者须持有user_pool的锁 */
+static void huge_page_unmap(uint32_t vaddr)
+{
+    uint32_t *pde = pde_ptr(vaddr);
+    uint32_t page_phyaddr = *pde & 0xffc00000, cnt;
+    for (cnt = 0; cnt < HUGE_PG_PAGES; cnt++)
+    {
+        pfree(page_phyaddr + cnt * PG_SIZE);
+    }
+    *pde = 0;
+    asm volatile("invlpg %0" ::"m"(*(char *)vaddr) : "memory");
+}
+
+/* 把vaddr所在的4M大页拆成由页表映射的1024个4K页,页框和属性都不变,
+ * 之后就能按4K页释放或写时复制.调用者须持有user_pool的锁,申请不到页表时返回false */
+static bool huge_page_split(uint32_t vaddr)
+{
+    uint32_t *pde = pde_ptr(vaddr);
+    lock_acquire(&kernel_pool.lock);
+    uint32_t pt_phyaddr = (uint32_t)palloc(&kernel_pool);
+    lock_release(&kernel_pool.lock);
+    if (pt_phyaddr == 0)
+    {
+        return false;
+    }
+    uint32_t *pt = K_P2V(pt_phyaddr);
+    uint32_t page_phyaddr = *pde & 0xffc00000, attr = *pde & (PG_US_U | PG_RW_W | PG_P_1), pte_idx;
+    for (pte_idx = 0; pte_idx < 1024; pte_idx++)
+    {
+        pt[pte_idx] = (page_phyaddr + pte_idx * PG_SIZE) | attr;
+    }
+    /* 只读属性已经留在各pte中,pde本身可写 */
+    *pde = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    asm volatile("invlpg %0" ::"m"(*(char *)vaddr) : "memory");
+    return true;
+}
+
+/* vaddr所在的4M区域若是只有一部分落在[start, end)中的大页,就把它拆成4K页.
+ * 不是大页或整个在范围内时什么也不做.申请不到页表时返回false */
+static bool huge_page_split_partial(uint32_t vaddr, uint32_t start, uint32_t end)
+{
+    uint32_t huge_start = vaddr & 0xffc00000;
+    uint32_t *pde = pde_ptr(vaddr);
+    if (!(*pde & PG_P_1) || !(*pde & PG_PS) || (huge_start >= start && huge_start + HUGE_PG_SIZE <= end))
+    {
+        return true;
+    }
+    return huge_page_split(vaddr);
+}
+
+/* 解除当前进程用户虚拟地址vaddr起pg_cnt页的映射并归还页框,从未映射过的页直接跳过.
+ * 每个4M区域只查一次pde:完整落在范围内的4M大页整个释放,只释放一部分的先拆成4K页,
+ * 页表中的pte顺序清除.最后页数不多时逐页invlpg,多时重新加载cr3一次刷掉用户空间的tlb,
+ * 内核空间是全局页,不受影响.调用者须持有user_pool的锁.
+ * 拆大页申请不到页表时返回false,此时一页也没有解除映射 */
+bool unmap_range(uint32_t vaddr, uint32_t pg_cnt)
+{
+    uint32_t vaddr_start = vaddr, vaddr_end = vaddr + pg_cnt * PG_SIZE;
+    ASSERT(vaddr % PG_SIZE == 0 && vaddr_end <= 0xc0000000);
+    /* 只释放一部分的大页只可能在范围首尾的两个4M区域,先拆好它们再动页表 */
+    if (!huge_page_split_partial(vaddr_start, vaddr_start, vaddr_end) ||
+        !huge_page_split_partial(vaddr_end - 1, vaddr_start, vaddr_end))
+    {
+        return false;
+    }
+    while (vaddr < vaddr_end)
+    {
+        uint32_t *pde = pde_ptr(vaddr);
+        uint32_t run = 1024 - PTE_IDX(vaddr);
+        if (run > (vaddr_end - vaddr) / PG_SIZE)
+        {
+            run = (vaddr_end - vaddr) / PG_SIZE;
+        }
+
+        if ((*pde & PG_P_1) && (*pde & PG_PS))
+        { // 部分覆盖的大页已在前面拆开,剩下的都整个落在范围内
+            ASSERT(run == HUGE_PG_PAGES);
+            huge_page_unmap(vaddr);
+            vaddr += HUGE_PG_SIZE;
+            continue;
+        }
+
+        if (*pde & PG_P_1)
+        {
+            uint32_t *pte = pte_ptr(vaddr), cnt;
+            for (cnt = 0; cnt < run; cnt++, pte++)
+            {
+                if (*pte & PG_P_1)
+                {
+                    /* 确保物理地址属于用户物理内存池 */
+                    ASSERT((*pte & 0xfffff000) >= user_pool.phy_addr_start);
+                    pfree(*pte & 0xfffff000);
+                    *pte = 0;
+                }
+                else if (*pte & PG_SWAP)
+                { // 已换出的页只需释放交换槽
+                    swap_slot_free(*pte >> 12);
+                    *pte = 0;
+                }
+            }
+        }
+        vaddr += run * PG_SIZE;
+    }
+
+    if (pg_cnt <= INVLPG_MAX_PAGES)
+    {
+        for (vaddr = vaddr_start; vaddr < vaddr_end; vaddr += PG_SIZE)
+        {
+            asm volatile("invlpg %0" ::"m"(*(char *)vaddr) : "memory");
+        }
+    }
+    else
+    {
+        asm volatile("movl %%cr3, %%eax; movl %%eax, %%cr3" ::: "eax", "memory");
+    }
+    return true;
+}
+
+/* 分配pg_cnt个页空间,成功则返回起始虚拟地址,失败时返回NULL.
+ * 内核内存从伙伴系统取物理连续的页框,直接返回其在直接映射区中的地址.
+ * 用户内存只记录为进程的一个区域,物理页等到首次访问引发缺页异常时再由page_fault_handler映射;
+ * 其中不小于4M的申请按4M对齐,完整的4M区域立即用大页映射,以减少页表和tlb的开销 */
+void *malloc_page(enum pool_flags pf, uint32_t pg_cnt)
+{
+    ASSERT(pg_cnt > 0);
+    if (pf == PF_KERNEL)
+    {
+        void *page_phyaddr = palloc_contiguous(&kernel_pool, pg_cnt);
+        return page_phyaddr == NULL ? NULL : K_P2V(page_phyaddr);
+    }
+
+    bool huge = pg_cnt >= HUGE_PG_PAGES;
+    void *vaddr_start = vaddr_get(pg_cnt, huge);
+    if (vaddr_start != NULL && huge)
+    {
+        uint32_t vaddr = (uint32_t)vaddr_start, vaddr_end = vaddr + pg_cnt * PG_SIZE;
+        while (vaddr + HUGE_PG_SIZE <= vaddr_end && huge_page_map(vaddr))
+        {
+            vaddr += HUGE_PG_SIZE;
+        }
+    }
+    return vaddr_start;
+}
+
+/* 分配pg_cnt页清0的内核内存,单页时优先用预先清0的页框省去memset.
+ * 调用者须持有kernel_pool的锁,成功则返回虚拟地址,失败返回NULL */
+static void *malloc_kernel_page_zero(uint32_t pg_cnt)
+{
+    if (pg_cnt > 1)
+    {
+        void *vaddr = malloc_page(PF_KERNEL, pg_cnt);
+        if (vaddr != NULL)
+        {
+            memset(vaddr, 0, pg_cnt * PG_SIZE);
+        }
+        return vaddr;
+    }
+
+    bool zeroed;
+    void *page_phyaddr = palloc_zero(&kernel_pool, &zeroed);
+    if (page_phyaddr == NULL)
+    {
+        return NULL;
+    }
+    void *vaddr = K_P2V(page_phyaddr);
+    if (!zeroed)
+    {
+        memset(vaddr, 0, PG_SIZE);
+    }
+    return vaddr;
+}
+
+/* 从内核物理内存池中申请pg_cnt页内存,flags为AF_NOZERO时不清0,
+ * 成功则返回其虚拟地址,失败则返回NULL */
+void *get_kernel_pages_flags(uint32_t pg_cnt, uint8_t flags)
+{
+    lock_acquire(&kernel_pool.lock);
+    void *vaddr = flags & AF_NOZERO ? malloc_page(PF_KERNEL, pg_cnt) : malloc_kernel_page_zero(pg_cnt);
+    lock_release(&kernel_pool.lock);
+    return vaddr;
+}
+
+/* 从内核物理内存池中申请pg_cnt页清0的内存,
+ * 成功则返回其虚拟地址,失败则返回NULL */
+void *get_kernel_pages(uint32_t pg_cnt)
+{
+    return get_kernel_pages_flags(pg_cnt, 0);
+}
+
+/* 将get_kernel_pages申请的以vaddr起始的pg_cnt页内存归还给内核物理内存池 */
+void free_kernel_pages(void *vaddr, uint32_t pg_cnt)
+{
+    lock_acquire(&kernel_pool.lock);
+    mfree_page(PF_KERNEL, vaddr, pg_cnt);
+    lock_release(&kernel_pool.lock);
+}
+
+/* 在用户空间中申请4k内存,并返回其虚拟地址 */
+void *get_user_pages(uint32_t pg_cnt)
+{
+    lock_acquire(&user_pool.lock);
+    void *vaddr = malloc_page(PF_USER, pg_cnt); // 用户页在缺页映射时清0,此处不必访问
+    lock_release(&user_pool.lock);
+    return vaddr;
+}
+
+/* 将地址vaddr与pf池中的物理地址关联,仅支持一页空间分配.
+ * 内核内存都在直接映射区,只有用户进程能在指定的地址上映射页 */
+void *get_a_page(enum pool_flags pf, uint32_t vaddr)
+{
+    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+    lock_acquire(&mem_pool->lock);
+
+    /* 先确保vaddr所在的页已记录在进程的区域中 */
+    struct task_struct *cur = running_thread();
+
+    /* 只有用户进程能申请用户内存,vaddr不在已有区域中时为它单独记录一个匿名区域 */
+    if (cur->pgdir != NULL && pf == PF_USER)
+    {
+        if (vma_find(&cur->vma_list, vaddr) == NULL &&
+            !vma_add(&cur->vma_list, vaddr & 0xfffff000, (vaddr & 0xfffff000) + PG_SIZE, VM_READ | VM_WRITE, VMA_ANON))
+        {
+            lock_release(&mem_pool->lock);
+            return NULL;
+        }
+    }
+    else
+    {
+        PANIC("get_a_page:only user process can alloc userspace by get_a_page");
+    }
+
+    void *page_phyaddr = palloc(mem_pool);
+    if (page_phyaddr == NULL)
+    {
+        lock_release(&mem_pool->lock);
+        return NULL;
+    }
+    if (!map_range(vaddr, (uint32_t)page_phyaddr, 1))
+    {
+        pfree((uint32_t)page_phyaddr);
+        lock_release(&mem_pool->lock);
+        return NULL;
+    }
+    lock_release(&mem_pool->lock);
+    return (void *)vaddr;
+}
+
+/* 安装1页大小的vaddr,专门针对vaddr已在进程区域中、无须记录的情况 */
+void *get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr)
+{
+    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+    lock_acquire(&mem_pool->lock);
+    void *page_phyaddr = palloc(mem_pool);
+    if (page_phyaddr == NULL)
+    {
+        lock_release(&mem_pool->lock);
+        return NULL;
+    }
+    if (!map_range(vaddr, (uint32_t)page_phyaddr, 1))
+    {
+        pfree((uint32_t)page_phyaddr);
+        lock_release(&mem_pool->lock);
+        return NULL;
+    }
+    lock_release(&mem_pool->lock);
+    return (void *)vaddr;
+}
+
+/* 从用户内存池申请一个还不映射的页框,调用者经kmap_atomic填好内容后用user_page_install装入.
+ * 成功返回物理地址,内存不足时返回0 */
+uint32_t user_frame_alloc(void)
+{
+    lock_acquire(&user_pool.lock);
+    void *page_phyaddr = palloc(&user_pool);
+    lock_release(&user_pool.lock);
+    return (uint32_t)page_phyaddr;
+}
+
+/* 归还user_frame_alloc申请到、还没有装入的页框 */
+void user_frame_free(uint32_t pg_phy_addr)
+{
+    lock_acquire(&user_pool.lock);
+    pfree(pg_phy_addr);
+    lock_release(&user_pool.lock);
+}
+
+/* 用页框pg_phy_addr替换当前进程用户虚拟页vaddr原有的映射,原来的页框被归还.
+ * 申请不到页表时归还pg_phy_addr并返回false */
+bool user_page_install(uint32_t vaddr, uint32_t pg_phy_addr)
+{
+    lock_acquire(&user_pool.lock);
+    bool ok = unmap_range(vaddr, 1) && map_range(vaddr, pg_phy_addr, 1);
+    if (!ok)
+    {
+        pfree(pg_phy_addr);
+    }
+    lock_release(&user_pool.lock);
+    return ok;
+}
+
+/* 得到虚拟地址映射到的物理地址 */
+uint32_t addr_v2p(uint32_t vaddr)
+{
+    /* 4M大页(包括内核的直接映射区)没有页表,pde的高10位就是大页的物理起始地址 */
+    uint32_t *pde = pde_ptr(vaddr);
+    if (*pde & PG_PS)
+    {
+        return (*pde & 0xffc00000) + (vaddr & 0x003fffff);
+    }
+    uint32_t *pte = pte_ptr(vaddr);
+    /* (*pte)的值是页表所在的物理页框地址,
+     * 去掉其低12位的页表项属性+虚拟地址vaddr的低12位 */
+    return ((*pte & 0xfffff000) + (vaddr & 0x00000fff));
+}
+
+/* 返回arena中第idx个内存块的地址,desc为arena的规格 */
+static struct mem_block *arena2block(struct arena *a, struct mem_block_desc *desc, uint32_t idx)
+{
+    return (struct mem_block *)((uint32_t)a + sizeof(struct arena) + idx * desc->block_size);
+}
+
+/* 返回内存块b所在的arena地址 */
+static struct arena *block2arena(struct mem_block *b)
+{
+    return (struct arena *)((uint32_t)b & 0xfffff000);
+}
+
+/* arena的owner:用户进程的arena属于进程自己,内核线程共用k_block_descs,所有内核arena同属一个owner */
+static pid_t arena_owner(enum pool_flags PF)
+{
+    return PF == PF_USER ? running_thread()->pid : -1;
+}
+
+/* 从descs[desc_idx]中取出一个内存块,优先用部分空闲的arena,没有时再用全空的arena或新建arena.
+ * 内核的描述符由所有内核线程共用,调用者须持有kernel_pool的锁;用户进程的描述符只有进程自己访问,
+ * 调用者不能持有user_pool的锁,因为arena在用户页中,访问时可能缺页换入.成功返回内存块,失败返回NULL */
+static struct mem_block *block_get(enum pool_flags PF, struct mem_block_desc *descs, uint8_t desc_idx)
+{
+    struct mem_block_desc *desc = &descs[desc_idx];
+    struct arena *a;
+    struct mem_block *b;
+
+    if (!list_empty(&desc->partial_arenas))
+    {
+        a = elem2entry(struct arena, arena_elem, desc->partial_arenas.head.next);
+    }
+    else if (!list_empty(&desc->empty_arenas))
+    {
+        a = elem2entry(struct arena, arena_elem, list_pop(&desc->empty_arenas));
+        list_push(&desc->partial_arenas, &a->arena_elem);
+    }
+    else
+    {
+        /* 没有可用的mem_block了,就创建新的arena提供mem_block */
+        struct pool *mem_pool = PF == PF_USER ? &user_pool : &kernel_pool;
+        lock_acquire(&mem_pool->lock);
+        a = malloc_page(PF, 1); // 分配1页框做为arena
+        lock_release(&mem_pool->lock);
+        if (a == NULL)
+        {
+            return NULL;
+        }
+
+        /* 对于分配的小块内存,记下内存块规格和owner,
+         * cnt置为此arena可用的内存块数,large置为false */
+        a->desc_idx = desc_idx;
+        a->owner = arena_owner(PF);
+        a->large = false;
+        a->cnt = desc->blocks_per_arena;
+        list_init(&a->free_list);
+        uint32_t block_idx;
+
+        /* 开始将arena拆分成内存块,并添加到arena自己的free_list中.
+         * free_list只在持有内存池锁时访问,不必再关中断 */
+        for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++)
+        {
+            b = arena2block(a, desc, block_idx);
+            list_append(&a->free_list, &b->free_elem);
+        }
+        list_push(&desc->partial_arenas, &a->arena_elem);
+    }
+
+    b = elem2entry(struct mem_block, free_elem, list_pop(&a->free_list));
+    /* 将此arena中的空闲内存块数减1,分完了就移到full_arenas */
+    if (--a->cnt == 0)
+    {
+        list_remove(&a->arena_elem);
+        list_append(&desc->full_arenas, &a->arena_elem);
+    }
+    return b;
+}
+
+/* 将内存块b归还到所属arena的free_list,若此arena中的内存块都空闲了,
+ * 则在全空arena已够数时释放此arena.descs为当前任务的内存块描述符数组,持锁的要求同block_get */
+static void block_put(enum pool_flags PF, struct mem_block_desc *descs, struct mem_block *b)
+{
+    struct arena *a = block2arena(b);
+    struct mem_block_desc *desc = &descs[a->desc_idx];
+    pid_t owner = arena_owner(PF);
+
+    /* 先将内存块回收到arena的free_list */
+    list_push(&a->free_list, &b->free_elem);
+
+    if (a->owner != owner)
+    { /* fork前父进程建的arena,arena_elem还指向父进程pcb中的链表,不能摘链.
+       * 子进程只在第一次往里归还内存块时收养它,挂到自己的链表上 */
+        a->owner = owner;
+        a->cnt++;
+        list_push(&desc->partial_arenas, &a->arena_elem);
+    }
+    else if (a->cnt++ == 0)
+    { // 原本已分完的arena有了空闲块,移回partial_arenas
+        list_remove(&a->arena_elem);
+        list_push(&desc->partial_arenas, &a->arena_elem);
+    }
+
+    /* 再判断此arena中的内存块是否都是空闲,如果是就整体回收,无须逐块摘链 */
+    if (a->cnt == desc->blocks_per_arena)
+    {
+        list_remove(&a->arena_elem);
+        if (list_len(&desc->empty_arenas) < ARENA_EMPTY_KEEP)
+        {
+            list_push(&desc->empty_arenas, &a->arena_elem);
+        }
+        else
+        {
+            struct pool *mem_pool = PF == PF_USER ? &user_pool : &kernel_pool;
+            lock_acquire(&mem_pool->lock);
+            mfree_page(PF, a, 1);
+            lock_release(&mem_pool->lock);
+        }
+    }
+}
+
+/* 在堆中申请size字节内存,flags为AF_NOZERO时不清0 */
+void *sys_malloc_flags(uint32_t size, uint8_t flags)
+{
+    enum pool_flags PF;
+    struct pool *mem_pool;
+    uint32_t pool_size;
+    struct mem_block_desc *descs;
+    struct task_struct *cur_thread = running_thread();
+
+    /* 判断用哪个内存池*/
+    if (cur_thread->pgdir == NULL)
+    { // 若为内核线程
+        PF = PF_KERNEL;
+        pool_size = kernel_pool.pool_size;
+        mem_pool = &kernel_pool;
+        descs = k_block_descs;
+    }
+    else
+    { // 用户进程pcb中的pgdir会在为其分配页表时创建
+        PF = PF_USER;
+        pool_size = user_pool.pool_size;
+        mem_pool = &user_pool;
+        descs = cur_thread->u_block_desc;
+    }
+
+    /* 若申请的内存不在内存池容量范围内则直接返回NULL */
+    if (!(size > 0 && size < pool_size))
+    {
+        return NULL;
+    }
+    struct arena *a;
+    struct mem_block *b;
+    /* 超过最大内存块1024, 就分配页框 */
+    if (size > 1024)
+    {
+        uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE); // 向上取整需要的页框数
+
+        lock_acquire(&mem_pool->lock);
+        mem_pool->malloc_lock_cnt++;
+        /* 用户页在缺页时才映射且映射时已清0,不必在此逐页访问 */
+        if (PF == PF_USER || (flags & AF_NOZERO))
+        {
+            a = malloc_page(PF, page_cnt);
+        }
+        else
+        {
+            a = malloc_kernel_page_zero(page_cnt);
+        }
+
+        lock_release(&mem_pool->lock);
+        if (a == NULL)
+        {
+            return NULL;
+        }
+        /* 对于分配的大块页框,cnt置为页框数,large置为true.
+         * 用户页此时还没有映射,写arena时会缺页,要在放开锁之后写 */
+        a->cnt = page_cnt;
+        a->large = true;
+        return (void *)(a + 1); // 跨过arena大小，把剩下的内存返回
+    }
+    else
+    { // 若申请的内存小于等于1024,可在各种规格的mem_block_desc中去适配
+        uint8_t desc_idx;
+
+        /* 从内存块描述符中匹配合适的内存块规格 */
+        for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++)
+        {
+            if (size <= descs[desc_idx].block_size)
+            { // 从小往大后,找到后退出
+                break;
+            }
+        }
+
+        /* 优先从本任务的magazine中取,magazine空了才从arena批量补充,内核的arena要持锁 */
+        struct mem_magazine *mag = &cur_thread->mem_mags[desc_idx];
+        if (mag->cnt == 0)
+        {
+            if (PF == PF_KERNEL)
+            {
+                lock_acquire(&mem_pool->lock);
+                mem_pool->malloc_lock_cnt++;
+            }
+            while (mag->cnt < MAG_BATCH)
+            {
+                b = block_get(PF, descs, desc_idx);
+                if (b == NULL)
+                {
+                    break;
+                }
+                mag->blocks[mag->cnt++] = b;
+            }
+            if (PF == PF_KERNEL)
+            {
+                lock_release(&mem_pool->lock);
+            }
+            if (mag->cnt == 0)
+            {
+                return NULL;
+            }
+        }
+
+        /* 开始分配内存块 */
+        b = mag->blocks[--mag->cnt];
+        if (!(flags & AF_NOZERO))
         {
-            bitmap_set(&cur_thread->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
+            memset(b, 0, descs[desc_idx].block_size);
         }
+        return (void *)b;
+    }
+}
+
+/* 在堆中申请size字节清0的内存 */
+void *sys_malloc(uint32_t size)
+{
+    return sys_malloc_flags(size, 0);
+}
+
+/* 将物理地址pg_phy_addr回收到物理内存池 */
+void pfree(uint32_t pg_phy_addr)
+{
+    struct pool *mem_pool;
+    uint32_t pg_idx = 0;
+    if (pg_phy_addr >= user_pool.phy_addr_start)
+    { // 用户物理内存池
+        mem_pool = &user_pool;
+        pg_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
+    }
+    else
+    { // 内核物理内存池
+        mem_pool = &kernel_pool;
+        pg_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
+    }
+    struct page *pg = &mem_pool->mem_map[pg_idx];
+    ASSERT(!(pg->flags & PAGE_BUDDY) && pg->ref_cnt > 0);
+    /* 页框仍被其它进程以写时复制方式共享,只减少引用计数 */
+    if (--pg->ref_cnt > 0)
+    {
+        return;
+    }
+    if (cma_contains(pg_phy_addr))
+    { // 预留区的页框不属于伙伴系统
+        cma_free_page(pg_phy_addr);
+        return;
+    }
+    buddy_free_block(mem_pool, pg_idx, 0); // 还给伙伴系统,能合并则合并
+}
+
+/* 从当前进程的区域中去掉以_vaddr起始的连续pg_cnt个虚拟页 */
+static void vaddr_remove(void *_vaddr, uint32_t pg_cnt)
+{
+    uint32_t vaddr = (uint32_t)_vaddr;
+    struct task_struct *cur_thread = running_thread();
+    /* 每次申请各自成为一个区域,整段释放时不会拆分区域,也就不会申请内存 */
+    if (!vma_remove(&cur_thread->vma_list, vaddr, vaddr + pg_cnt * PG_SIZE))
+    {
+        PANIC("vaddr_remove: no memory to split vm_area");
     }
 }
 
@@ -469,180 +1640,470 @@ void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
     uint32_t pg_phy_addr;
     uint32_t vaddr = (int32_t)_vaddr, page_cnt = 0;
     ASSERT(pg_cnt >= 1 && vaddr % PG_SIZE == 0);
-    pg_phy_addr = addr_v2p(vaddr); // 获取虚拟地址vaddr对应的物理地址
-
-    /* 确保待释放的物理内存在低端1M+1k大小的页目录+1k大小的页表地址范围外 */
-    ASSERT((pg_phy_addr % PG_SIZE) == 0 && pg_phy_addr >= 0x102000);
 
-    /* 判断pg_phy_addr属于用户物理内存池还是内核物理内存池 */
-    if (pg_phy_addr >= user_pool.phy_addr_start)
-    { // 位于user_pool内存池
-        vaddr -= PG_SIZE;
-        while (page_cnt < pg_cnt)
+    /* 内核内存在直接映射区中,映射一直存在,只需归还页框 */
+    if (pf == PF_KERNEL)
+    {
+        pg_phy_addr = K_V2P(vaddr);
+        /* 确保待释放的物理内存只属于内核物理内存池 */
+        ASSERT(pg_phy_addr >= kernel_pool.phy_addr_start &&
+               pg_phy_addr + pg_cnt * PG_SIZE <= user_pool.phy_addr_start);
+        while (page_cnt++ < pg_cnt)
         {
-            vaddr += PG_SIZE;
-            pg_phy_addr = addr_v2p(vaddr);
+            pfree(pg_phy_addr);
+            pg_phy_addr += PG_SIZE;
+        }
+        return;
+    }
 
-            /* 确保物理地址属于用户物理内存池 */
-            ASSERT((pg_phy_addr % PG_SIZE) == 0 && pg_phy_addr >= user_pool.phy_addr_start);
+    /* 用户内存是按需映射的,从未访问过的页没有物理页框,unmap_range会跳过它们.
+     * 释放的总是一次申请的整段,大页只会整个落在其中,不必拆分,也就不会失败 */
+    bool unmapped = unmap_range(vaddr, pg_cnt);
+    ASSERT(unmapped);
 
-            /* 先将对应的物理页框归还到内存池 */
-            pfree(pg_phy_addr);
+    /* 从进程的区域中去掉这段虚拟地址 */
+    vaddr_remove(_vaddr, pg_cnt);
+}
+
+/* 回收内存ptr */
+void sys_free(void *ptr)
+{
+    ASSERT(ptr != NULL);
+    if (ptr != NULL)
+    {
+        enum pool_flags PF;
+        struct pool *mem_pool;
+        struct mem_block_desc *descs;
+        struct task_struct *cur_thread = running_thread();
+
+        /* 判断是线程还是进程 */
+        if (cur_thread->pgdir == NULL)
+        {
+            ASSERT((uint32_t)ptr >= K_PHY_BASE);
+            PF = PF_KERNEL;
+            mem_pool = &kernel_pool;
+            descs = k_block_descs;
+        }
+        else
+        {
+            PF = PF_USER;
+            mem_pool = &user_pool;
+            descs = cur_thread->u_block_desc;
+        }
+
+        struct mem_block *b = ptr;
+        struct arena *a = block2arena(b); // 把mem_block转换成arena,获取元信息
+        ASSERT(a->large == 0 || a->large == 1);
+        if (a->large == true)
+        { // 大于1024的内存,页数在持锁前读出,用户的arena可能已被换出
+            uint32_t pg_cnt = a->cnt;
+            lock_acquire(&mem_pool->lock);
+            mem_pool->malloc_lock_cnt++;
+            mfree_page(PF, a, pg_cnt);
+            lock_release(&mem_pool->lock);
+            return;
+        }
 
-            /* 再从页表中清除此虚拟地址所在的页表项pte */
-            page_table_pte_remove(vaddr);
+        /* 小于等于1024的内存块先放回本任务的magazine,
+         * magazine满了才把栈底的MAG_BATCH个内存块还给各自的arena,内核的arena要持锁 */
+        ASSERT(a->desc_idx < DESC_CNT);
+        struct mem_magazine *mag = &cur_thread->mem_mags[a->desc_idx];
+        if (mag->cnt == MAG_SIZE)
+        {
+            uint32_t blk_idx;
+            if (PF == PF_KERNEL)
+            {
+                lock_acquire(&mem_pool->lock);
+                mem_pool->malloc_lock_cnt++;
+            }
+            for (blk_idx = 0; blk_idx < MAG_BATCH; blk_idx++)
+            {
+                block_put(PF, descs, mag->blocks[blk_idx]);
+            }
+            if (PF == PF_KERNEL)
+            {
+                lock_release(&mem_pool->lock);
+            }
 
-            page_cnt++;
+            /* 栈底的块已还回,剩下的块整体下移 */
+            for (blk_idx = MAG_BATCH; blk_idx < MAG_SIZE; blk_idx++)
+            {
+                mag->blocks[blk_idx - MAG_BATCH] = mag->blocks[blk_idx];
+            }
+            mag->cnt -= MAG_BATCH;
         }
-        /* 清空虚拟地址的位图中的相应位 */
-        vaddr_remove(pf, _vaddr, pg_cnt);
+        mag->blocks[mag->cnt++] = b;
     }
-    else
-    { // 位于kernel_pool内存池
-        vaddr -= PG_SIZE;
-        while (page_cnt < pg_cnt)
+}
+
+/* 把当前进程的堆顶移到brk.堆区域按页伸缩:增长时只扩大区域,页在首次访问时按需映射;
+ * 收缩时释放高出新堆顶的页.brk为0、低于堆起始地址或增长会碰到其它区域时堆顶不变.
+ * 返回调整后的堆顶 */
+uint32_t sys_brk(uint32_t brk)
+{
+    struct task_struct *cur = running_thread();
+    if (brk < cur->brk_start || brk > 0xc0000000 - USER_STACK_PAGES * PG_SIZE)
+    {
+        return cur->brk;
+    }
+    uint32_t old_end = (cur->brk + PG_SIZE - 1) & 0xfffff000, new_end = (brk + PG_SIZE - 1) & 0xfffff000;
+
+    lock_acquire(&user_pool.lock);
+    if (new_end > old_end)
+    {
+        /* 新增的部分不能与其它区域重叠 */
+        if (vma_intersects(&cur->vma_list, old_end, new_end))
         {
-            vaddr += PG_SIZE;
-            pg_phy_addr = addr_v2p(vaddr);
-            /* 确保待释放的物理内存只属于内核物理内存池 */
-            ASSERT((pg_phy_addr % PG_SIZE) == 0 &&
-                   pg_phy_addr >= kernel_pool.phy_addr_start &&
-                   pg_phy_addr < user_pool.phy_addr_start);
+            lock_release(&user_pool.lock);
+            return cur->brk;
+        }
 
-            /* 先将对应的物理页框归还到内存池 */
-            pfree(pg_phy_addr);
+        /* 堆紧接着已有的堆区域时直接延长它,堆只占一个区域 */
+        struct vm_area *heap = old_end > cur->brk_start ? vma_find(&cur->vma_list, old_end - 1) : NULL;
+        if (heap != NULL && heap->type == VMA_HEAP)
+        {
+            heap->end = new_end;
+        }
+        else if (!vma_add(&cur->vma_list, old_end, new_end, VM_READ | VM_WRITE, VMA_HEAP))
+        {
+            lock_release(&user_pool.lock);
+            return cur->brk;
+        }
+    }
+    else if (new_end < old_end)
+    {
+        /* 堆区域不用大页映射,unmap_range不会失败 */
+        bool unmapped = unmap_range(new_end, (old_end - new_end) / PG_SIZE);
+        ASSERT(unmapped);
+        vaddr_remove((void *)new_end, (old_end - new_end) / PG_SIZE);
+    }
+    cur->brk = brk;
+    lock_release(&user_pool.lock);
+    return brk;
+}
+
+/* 把文件或匿名内存映射到当前进程,参数见struct mmap_args.映射只记录为区域,
+ * 页在首次访问时由缺页异常读入或清0.成功返回起始地址,失败返回NULL */
+void *sys_mmap(struct mmap_args *args)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t addr = (uint32_t)args->addr, len = (args->length + PG_SIZE - 1) & 0xfffff000;
+    if (len == 0 || args->offset % PG_SIZE != 0)
+    {
+        return NULL;
+    }
+    struct inode *inode = NULL;
+    if (!(args->flags & MAP_ANON) && (inode = fd_inode_get(args->fd)) == NULL)
+    {
+        return NULL;
+    }
+    uint8_t prot = args->prot & (VM_READ | VM_WRITE | VM_EXEC);
+
+    lock_acquire(&user_pool.lock);
+    /* 期望的地址可用就用它,否则另找一段空闲的虚拟地址 */
+    if (addr % PG_SIZE != 0 || addr < USER_VADDR_START || addr + len > 0xc0000000 || addr + len < addr ||
+        vma_intersects(&cur->vma_list, addr, addr + len))
+    {
+        addr = vma_get_unmapped(&cur->vma_list, len, PG_SIZE);
+    }
+    bool ok = addr != 0 && (inode != NULL ? vma_add_file(&cur->vma_list, addr, addr + len, prot, inode, args->offset)
+                                          : vma_add(&cur->vma_list, addr, addr + len, prot, VMA_ANON));
+    lock_release(&user_pool.lock);
+    return ok ? (void *)addr : NULL;
+}
 
-            /* 再从页表中清除此虚拟地址所在的页表项pte */
-            page_table_pte_remove(vaddr);
+/* 解除当前进程[addr, addr + length)内的映射,已映射的页框被释放.成功返回0,失败返回-1 */
+int32_t sys_munmap(void *_addr, uint32_t length)
+{
+    uint32_t addr = (uint32_t)_addr, len = (length + PG_SIZE - 1) & 0xfffff000;
+    if (addr % PG_SIZE != 0 || len == 0 || addr < USER_VADDR_START || addr + len > 0xc0000000 || addr + len < addr)
+    {
+        return -1;
+    }
+    int32_t ret = -1;
+    lock_acquire(&user_pool.lock);
+    /* 能失败的两步都放在释放页框之前:只解除大页的一部分时先拆成4K页,拆开不改变映射的内容;
+     * 从区域中间挖洞时要申请新的vm_area,申请不到时区域不变.这两步成功后unmap_range不会再失败 */
+    if (huge_page_split_partial(addr, addr, addr + len) && huge_page_split_partial(addr + len - 1, addr, addr + len) &&
+        vma_remove(&running_thread()->vma_list, addr, addr + len))
+    {
+        bool unmapped = unmap_range(addr, len / PG_SIZE);
+        ASSERT(unmapped);
+        ret = 0;
+    }
+    lock_release(&user_pool.lock);
+    return ret;
+}
 
-            page_cnt++;
+/* exec时释放旧程序的整个用户空间:程序段、堆、匿名内存和文件映射区连同其页框、交换槽一起去掉,
+ * 文件映射区占的inode打开数随区域关闭.栈区域保留,其中的页同样释放,新程序用到时再缺页.
+ * malloc的内存块描述符和magazine指向的都是旧堆中的内存,一并恢复初始状态.
+ * 大页只会整个落在一个区域中,整段解除区域不必拆分,也就不会失败 */
+void user_image_release(void)
+{
+    struct task_struct *cur = running_thread();
+    lock_acquire(&user_pool.lock);
+    struct list_elem *elem = cur->vma_list.head.next;
+    while (elem != &cur->vma_list.tail)
+    {
+        struct vm_area *vma = elem2entry(struct vm_area, vma_tag, elem);
+        uint32_t pg_cnt = (vma->end - vma->start) / PG_SIZE;
+        elem = elem->next;
+        bool unmapped = unmap_range(vma->start, pg_cnt);
+        ASSERT(unmapped);
+        if (vma->type != VMA_STACK)
+        {
+            vaddr_remove((void *)vma->start, pg_cnt);
         }
-        /* 清空虚拟地址的位图中的相应位 */
-        vaddr_remove(pf, _vaddr, pg_cnt);
     }
+    cur->brk_start = cur->brk = USER_VADDR_START;
+    block_desc_init(cur->u_block_desc);
+    memset(cur->mem_mags, 0, sizeof(cur->mem_mags));
+    lock_release(&user_pool.lock);
 }
 
-/* 回收内存ptr */
-void sys_free(void *ptr)
+/* 从loader保存的e820结果中取出4G以下的可用内存,按页向内对齐,
+ * 再按起始地址排序并合并重叠或相邻的区域,结果存入ranges,返回区域数.
+ * e820失败时loader改用e801或0x88,只有内存总量,就当作1M以上的内存都可用 */
+static uint32_t usable_ranges_get(struct mem_range *ranges, uint32_t all_mem)
 {
-    ASSERT(ptr != NULL);
-    if (ptr != NULL)
+    struct ards *ards = (struct ards *)K_P2V(ARDS_BUF_ADDR);
+    uint32_t ards_nr = *(uint16_t *)K_P2V(ARDS_NR_ADDR), range_cnt = 0, idx;
+    if (ards_nr > ARDS_MAX)
     {
-        enum pool_flags PF;
-        struct pool *mem_pool;
+        ards_nr = ARDS_MAX;
+    }
+    if (ards_nr == 0)
+    {
+        ranges[0].start = 0x100000;
+        ranges[0].end = all_mem & 0xfffff000;
+        return 1;
+    }
 
-        /* 判断是线程还是进程 */
-        if (running_thread()->pgdir == NULL)
+    for (idx = 0; idx < ards_nr; idx++)
+    {
+        /* 4G以上的内存用不到,跨过4G的截到PHY_MEM_END */
+        if (ards[idx].type != ARDS_TYPE_USABLE || ards[idx].base_high != 0 || ards[idx].base_low >= PHY_MEM_END)
         {
-            ASSERT((uint32_t)ptr >= K_HEAP_START);
-            PF = PF_KERNEL;
-            mem_pool = &kernel_pool;
+            continue;
         }
-        else
+        uint32_t start = (ards[idx].base_low + PG_SIZE - 1) & 0xfffff000, end = PHY_MEM_END;
+        if (ards[idx].length_high == 0 && ards[idx].length_low < PHY_MEM_END - ards[idx].base_low)
         {
-            PF = PF_USER;
-            mem_pool = &user_pool;
+            end = (ards[idx].base_low + ards[idx].length_low) & 0xfffff000;
+        }
+        if (start >= end)
+        {
+            continue;
         }
 
-        lock_acquire(&mem_pool->lock);
-        struct mem_block *b = ptr;
-        struct arena *a = block2arena(b); // 把mem_block转换成arena,获取元信息
-        ASSERT(a->large == 0 || a->large == 1);
-        if (a->desc == NULL && a->large == true)
-        { // 大于1024的内存
-            mfree_page(PF, a, a->cnt);
+        /* 插入排序,区域数最多ARDS_MAX个 */
+        uint32_t pos = range_cnt++;
+        while (pos > 0 && ranges[pos - 1].start > start)
+        {
+            ranges[pos] = ranges[pos - 1];
+            pos--;
         }
-        else
-        { // 小于等于1024的内存块
-            /* 先将内存块回收到free_list */
-            list_append(&a->desc->free_list, &b->free_elem);
+        ranges[pos].start = start;
+        ranges[pos].end = end;
+    }
 
-            /* 再判断此arena中的内存块是否都是空闲,如果是就释放arena */
-            if (++a->cnt == a->desc->blocks_per_arena)
+    /* 重叠的区域若不合并,同一页框会被两次放入伙伴系统 */
+    uint32_t merged = 0;
+    for (idx = 1; idx < range_cnt; idx++)
+    {
+        if (ranges[idx].start <= ranges[merged].end)
+        {
+            if (ranges[idx].end > ranges[merged].end)
             {
-                uint32_t block_idx;
-                for (block_idx = 0; block_idx < a->desc->blocks_per_arena; block_idx++)
-                {
-                    struct mem_block *b = arena2block(a, block_idx);
-                    ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
-                    list_remove(&b->free_elem);
-                }
-                mfree_page(PF, a, 1);
+                ranges[merged].end = ranges[idx].end;
             }
         }
-        lock_release(&mem_pool->lock);
+        else
+        {
+            ranges[++merged] = ranges[idx];
+        }
+    }
+    return range_cnt == 0 ? 0 : merged + 1;
+}
+
+/* 把[start, end)中属于m_pool的页框放回伙伴系统 */
+static void pool_free_range(struct pool *m_pool, uint32_t start, uint32_t end)
+{
+    uint32_t pool_end = m_pool->phy_addr_start + m_pool->pool_size;
+    if (start < m_pool->phy_addr_start)
+    {
+        start = m_pool->phy_addr_start;
+    }
+    if (end > pool_end)
+    {
+        end = pool_end;
+    }
+    if (start >= end)
+    {
+        return;
     }
+    buddy_free_range(m_pool, (start - m_pool->phy_addr_start) / PG_SIZE, (end - start) / PG_SIZE);
+    m_pool->present_pages += (end - start) / PG_SIZE;
 }
 
 /* 初始化内存池 */
+/* 从用户内存池顶端取出一个完整空闲的4M块作为连续分配的预留区.
+ * 不取用户池最底下的块,那是pool_grow向内核池让出的块;也不取高端内存,
+ * 连续分配的缓冲区要由内核经直接映射区访问.内存太小时不预留 */
+static void cma_init(void)
+{
+    uint32_t chunk_idx = user_pool.pool_size / HUGE_PG_SIZE;
+    cma.base = 0;
+    if (user_pool.phy_addr_start % HUGE_PG_SIZE != 0 || user_pool.free_pages < CMA_PAGES + POOL_RESERVE_PAGES)
+    {
+        return;
+    }
+    while (chunk_idx-- > 1)
+    {
+        struct page *chunk = &user_pool.mem_map[chunk_idx * CMA_PAGES];
+        if (user_pool.phy_addr_start + (chunk_idx + 1) * HUGE_PG_SIZE > DIRECT_MAP_SIZE)
+        {
+            continue;
+        }
+        if ((chunk->flags & PAGE_BUDDY) && chunk->order == MAX_ORDER - 1)
+        {
+            list_remove(&chunk->free_elem);
+            chunk->flags &= ~PAGE_BUDDY;
+            user_pool.free_area[MAX_ORDER - 1].nr_free--;
+            user_pool.free_pages -= CMA_PAGES;
+            user_pool.present_pages -= CMA_PAGES;
+            cma.base = user_pool.phy_addr_start + chunk_idx * HUGE_PG_SIZE;
+            break;
+        }
+    }
+    cma.btmp.bits = cma.bits;
+    cma.btmp.btmp_bytes_len = CMA_PAGES / 8;
+    bitmap_init(&cma.btmp);
+    cma.contig_pages = cma.movable_pages = cma.alloc_cnt = cma.fail_cnt = 0;
+    cma.migrate_cnt = cma.total_kcycles = cma.max_cycles = 0;
+}
+
 static void mem_pool_init(uint32_t all_mem)
 {
     put_str("   mem_pool_init start\n");
-    uint32_t page_table_size = PG_SIZE * 256;       // 页表大小= 1页的页目录表+第0和第768个页目录项指向同一个页表+
-                                                    // 第769~1022个页目录项共指向254个页表,共256个页框
-    uint32_t used_mem = page_table_size + 0x100000; // 0x100000为低端1M内存
-    uint32_t free_mem = all_mem - used_mem;
-    uint16_t all_free_pages = free_mem / PG_SIZE; // 1页为4k,不管总内存是不是4k的倍数,
-                                                  // 对于以页为单位的内存分配策略，不足1页的内存不用考虑了。
-    uint16_t kernel_free_pages = all_free_pages / 2;
-    uint16_t user_free_pages = all_free_pages - kernel_free_pages;
-
-    /* 为简化位图操作，余数不处理，坏处是这样做会丢内存。
-    好处是不用做内存的越界检查,因为位图表示的内存少于实际物理内存*/
-    uint32_t kbm_length = kernel_free_pages / 8; // Kernel BitMap的长度,位图中的一位表示一页,以字节为单位
-    uint32_t ubm_length = user_free_pages / 8;   // User BitMap的长度.
-
-    uint32_t kp_start = used_mem;                               // Kernel Pool start,内核内存池的起始地址
-    uint32_t up_start = kp_start + kernel_free_pages * PG_SIZE; // User Pool start,用户内存池的起始地址
-
-    kernel_pool.phy_addr_start = kp_start;
-    user_pool.phy_addr_start = up_start;
+    /* 只有e820报告为可用的内存才交给伙伴系统.内核内存池只在直接映射区中,
+     * 超出直接映射区的高端内存全部归用户内存池,其页框只经用户页表或kmap_atomic访问 */
+    struct mem_range ranges[ARDS_MAX];
+    uint32_t range_cnt = usable_ranges_get(ranges, all_mem), idx;
+    if (range_cnt == 0)
+    {
+        PANIC("mem_pool_init: no usable memory");
+    }
+    uint32_t all_pages = ranges[range_cnt - 1].end / PG_SIZE; // 最高的可用页框之下都要有描述符
+
+    /* 所有页框的描述符数组mem_map按物理页框号下标,放在低端1M和页目录之后,
+     * 大小随内存的最高地址而定.直接映射用的都是4M大页,只有1页的页目录表,不再需要页表 */
+    uint32_t mem_map_start = 0x100000 + PG_SIZE; // 0x100000为低端1M内存
+    uint32_t mem_map_pages = DIV_ROUND_UP(all_pages * sizeof(struct page), PG_SIZE);
+    uint32_t used_mem = mem_map_start + mem_map_pages * PG_SIZE;
 
-    kernel_pool.pool_size = kernel_free_pages * PG_SIZE;
-    user_pool.pool_size = user_free_pages * PG_SIZE;
+    /* 数出used_mem之上直接映射区中的可用页框,分界先放在一半处,高端内存不参与划分 */
+    uint32_t all_free_pages = 0, half_pages, up_start = used_mem;
+    for (idx = 0; idx < range_cnt; idx++)
+    {
+        uint32_t end = ranges[idx].end < DIRECT_MAP_SIZE ? ranges[idx].end : DIRECT_MAP_SIZE;
+        if (end > used_mem)
+        {
+            all_free_pages += (end - (ranges[idx].start > used_mem ? ranges[idx].start : used_mem)) / PG_SIZE;
+        }
+    }
+    half_pages = all_free_pages / 2;
+    for (idx = 0; idx < range_cnt && half_pages > 0; idx++)
+    {
+        if (ranges[idx].end <= used_mem || ranges[idx].start >= DIRECT_MAP_SIZE)
+        {
+            continue;
+        }
+        uint32_t start = ranges[idx].start > used_mem ? ranges[idx].start : used_mem;
+        uint32_t end = ranges[idx].end < DIRECT_MAP_SIZE ? ranges[idx].end : DIRECT_MAP_SIZE;
+        uint32_t pages = (end - start) / PG_SIZE;
+        if (pages > half_pages)
+        {
+            pages = half_pages;
+        }
+        up_start = start + pages * PG_SIZE;
+        half_pages -= pages;
+    }
+
+    /* User Pool start,用户内存池的起始地址.分界处向下对齐到4M,
+     * 这样伙伴系统中最大的块在物理上也是4M对齐的,可以直接用作用户的4M大页,
+     * 之后哪边内存不足就由pool_grow按4M块移动分界 */
+    if ((up_start & ~(HUGE_PG_SIZE - 1)) > used_mem)
+    {
+        up_start &= ~(HUGE_PG_SIZE - 1);
+    } // 否则内存太小,不对齐了
 
-    kernel_pool.pool_bitmap.btmp_bytes_len = kbm_length;
-    user_pool.pool_bitmap.btmp_bytes_len = ubm_length;
+    /* 内核内存池从物理地址0开始,下标就是页框号,开头已被占用的页框不交给伙伴系统 */
+    kernel_pool.phy_addr_start = 0;
+    kernel_pool.pool_size = up_start;
+    user_pool.phy_addr_start = up_start;
+    user_pool.pool_size = all_pages * PG_SIZE - up_start;
 
-    /*********    内核内存池和用户内存池位图   ***********
-     *   位图是全局的数据，长度不固定。
-     *   全局或静态的数组需要在编译时知道其长度，
-     *   而我们需要根据总内存大小算出需要多少字节。
-     *   所以改为指定一块内存来生成位图.
-     *   ************************************************/
-    // 内核使用的最高地址是0xc009f000,这是主线程的栈地址.(内核的大小预计为70K左右)
-    // 32M内存占用的位图是2k.内核内存池的位图先定在MEM_BITMAP_BASE(0xc009a000)处.
-    kernel_pool.pool_bitmap.bits = (void *)MEM_BITMAP_BASE;
+    /* mem_map所在的页框已在直接映射区中,直接使用即可 */
+    kernel_pool.mem_map = K_P2V(mem_map_start);
+    memset(kernel_pool.mem_map, 0, mem_map_pages * PG_SIZE);
+    user_pool.mem_map = kernel_pool.mem_map + up_start / PG_SIZE;
 
-    /* 用户内存池的位图紧跟在内核内存池位图之后 */
-    user_pool.pool_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length);
     /******************** 输出内存池信息 **********************/
-    put_str("      kernel_pool_bitmap_start:");
-    put_int((int)kernel_pool.pool_bitmap.bits);
-    put_str(" kernel_pool_phy_addr_start:");
-    put_int(kernel_pool.phy_addr_start);
+    put_str("      usable memory:");
+    for (idx = 0; idx < range_cnt; idx++)
+    {
+        put_str(" ");
+        put_int(ranges[idx].start);
+        put_str("-");
+        put_int(ranges[idx].end);
+    }
+    put_str("\n");
+    put_str("      mem_map_start:");
+    put_int((int)kernel_pool.mem_map);
+    put_str(" kernel_pool_first_free_page:");
+    put_int(used_mem);
     put_str("\n");
-    put_str("      user_pool_bitmap_start:");
-    put_int((int)user_pool.pool_bitmap.bits);
-    put_str(" user_pool_phy_addr_start:");
+    put_str("      user_pool_phy_addr_start:");
     put_int(user_pool.phy_addr_start);
     put_str("\n");
 
-    /* 将位图置0*/
-    bitmap_init(&kernel_pool.pool_bitmap);
-    bitmap_init(&user_pool.pool_bitmap);
+    /* 初始时可用内存中的页框全部空闲,按最大的对齐块挂入伙伴系统,空洞中的页框不会成为任何块的一部分 */
+    uint8_t order;
+    for (order = 0; order < MAX_ORDER; order++)
+    {
+        list_init(&kernel_pool.free_area[order].free_list);
+        list_init(&user_pool.free_area[order].free_list);
+        kernel_pool.free_area[order].nr_free = user_pool.free_area[order].nr_free = 0;
+    }
+    kernel_pool.free_pages = user_pool.free_pages = 0;
+    kernel_pool.present_pages = user_pool.present_pages = 0;
+    kernel_pool.malloc_lock_cnt = user_pool.malloc_lock_cnt = 0;
+    kernel_pool.grown_chunks = user_pool.grown_chunks = 0;
+    list_init(&kernel_pool.zeroed_list);
+    list_init(&user_pool.zeroed_list);
+    kernel_pool.zeroed_cnt = user_pool.zeroed_cnt = 0;
+    highmem_pages = 0;
+    for (idx = 0; idx < range_cnt; idx++)
+    {
+        uint32_t start = ranges[idx].start > used_mem ? ranges[idx].start : used_mem;
+        pool_free_range(&kernel_pool, start, ranges[idx].end);
+        pool_free_range(&user_pool, start, ranges[idx].end);
+        if (ranges[idx].end > DIRECT_MAP_SIZE)
+        {
+            highmem_pages += (ranges[idx].end - (start > DIRECT_MAP_SIZE ? start : DIRECT_MAP_SIZE)) / PG_SIZE;
+        }
+    }
 
     lock_init(&kernel_pool.lock);
     lock_init(&user_pool.lock);
 
-    /* 下面初始化内核虚拟地址的位图,按实际物理内存大小生成数组。*/
-    kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length; // 用于维护内核堆的虚拟地址,所以要和内核内存池大小一致
-
-    /* 位图的数组指向一块未使用的内存,目前定位在内核内存池和用户内存池之外*/
-    kernel_vaddr.vaddr_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length + ubm_length);
+    cma_init();
+    put_str("      cma_base:");
+    put_int(cma.base);
+    put_str("\n");
 
-    kernel_vaddr.vaddr_start = K_HEAP_START;
-    bitmap_init(&kernel_vaddr.vaddr_bitmap);
     put_str("   mem_pool_init done\n");
 }
 
@@ -659,19 +2120,476 @@ void block_desc_init(struct mem_block_desc *desc_array)
         /* 初始化arena中的内存块数量 */
         desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
 
-        list_init(&desc_array[desc_idx].free_list);
+        list_init(&desc_array[desc_idx].partial_arenas);
+        list_init(&desc_array[desc_idx].full_arenas);
+        list_init(&desc_array[desc_idx].empty_arenas);
 
         block_size *= 2; // 更新为下一个规格内存块
     }
 }
 
+/* 输出内存池m_pool中伙伴系统各阶的空闲块数 */
+static void pool_info(char *name, struct pool *m_pool)
+{
+    uint32_t nr_free[MAX_ORDER];
+    uint32_t pages, free_pages, malloc_lock_cnt, zeroed_cnt, grown_chunks;
+    uint8_t order;
+
+    /* 先在锁内拍下快照,避免打印时持锁 */
+    lock_acquire(&m_pool->lock);
+    for (order = 0; order < MAX_ORDER; order++)
+    {
+        nr_free[order] = m_pool->free_area[order].nr_free;
+    }
+    pages = m_pool->present_pages;
+    free_pages = m_pool->free_pages;
+    malloc_lock_cnt = m_pool->malloc_lock_cnt;
+    zeroed_cnt = m_pool->zeroed_cnt;
+    grown_chunks = m_pool->grown_chunks;
+    lock_release(&m_pool->lock);
+
+    char buf[128] = {0};
+    uint32_t len = sprintf(buf, "   free blocks per order:");
+    for (order = 0; order < MAX_ORDER; order++)
+    {
+        len += sprintf(buf + len, " %d", nr_free[order]);
+    }
+    uint32_t used_pages = pages - free_pages - zeroed_cnt;
+    printk("%s: %d pages (%d used, %d percent utilization), %d free, %d pre-zeroed, %d 4M chunks borrowed, malloc/free lock acquisitions %d\n%s\n",
+           name, pages, used_pages, pages == 0 ? 0 : used_pages * 100 / pages, free_pages, zeroed_cnt, grown_chunks,
+           malloc_lock_cnt, buf);
+}
+
+/* 输出连续分配预留区的使用情况及palloc_contig的耗时 */
+static void cma_info(void)
+{
+    lock_acquire(&user_pool.lock);
+    struct cma_area snap = cma;
+    lock_release(&user_pool.lock);
+    if (snap.base == 0)
+    {
+        printk("cma: not reserved\n");
+        return;
+    }
+    uint32_t calls = snap.alloc_cnt + snap.fail_cnt;
+    printk("cma: %d pages at 0x%x, %d allocated contiguously, %d lent to user pages\n",
+           CMA_PAGES, snap.base, snap.contig_pages, snap.movable_pages);
+    printk("   palloc_contig: %d done, %d failed, %d pages migrated, avg %dK cycles, max %dK cycles\n",
+           snap.alloc_cnt, snap.fail_cnt, snap.migrate_cnt,
+           calls == 0 ? 0 : snap.total_kcycles / calls, snap.max_cycles >> 10);
+}
+
+/* 打印物理内存池及各对象缓存的使用情况,用于观察伙伴系统的碎片程度和slab的命中率 */
+void sys_meminfo(void)
+{
+    pool_info("kernel_pool", &kernel_pool);
+    pool_info("user_pool", &user_pool);
+    printk("pool boundary: 0x%x, %d user pages in highmem above 0x%x\n", user_pool.phy_addr_start, highmem_pages,
+           DIRECT_MAP_SIZE);
+    printk("demand paging: %d user pages mapped on fault, %d read from mapped files\n", demand_page_cnt, file_page_cnt);
+    printk("copy-on-write: %d pages copied, %d pages reused\n", cow_copy_cnt, cow_reuse_cnt);
+    printk("huge pages: %d user 4M pages mapped\n", huge_page_cnt);
+    printk("kmap: %d temporary page mappings\n", kmap_cnt);
+    cma_info();
+    swap_info();
+    vmalloc_info();
+    tlb_info();
+    kmem_cache_info();
+}
+
+/* 由空闲线程调用:从伙伴系统中取1个空闲页框,经临时映射窗口清0后放入预清0链表,
+ * 之后的分配就不必再现场清0.预清0的页框已够数、没有空闲页框或内存池正被占用时返回false */
+bool prezero_free_page(void)
+{
+    struct pool *mem_pool;
+    if (user_pool.zeroed_cnt < PREZERO_PAGES)
+    { // 用户进程的缺页最频繁,先补用户内存池
+        mem_pool = &user_pool;
+    }
+    else if (kernel_pool.zeroed_cnt < PREZERO_PAGES)
+    {
+        mem_pool = &kernel_pool;
+    }
+    else
+    {
+        return false;
+    }
+
+    /* 空闲线程阻塞后就没有可调度的任务了,所以不能等锁 */
+    if (!lock_try_acquire(&mem_pool->lock))
+    {
+        return false;
+    }
+    int32_t pg_idx = buddy_alloc_block(mem_pool, 0);
+    if (pg_idx != -1)
+    {
+        clear_phys_page(pg_idx * PG_SIZE + mem_pool->phy_addr_start);
+        list_append(&mem_pool->zeroed_list, &mem_pool->mem_map[pg_idx].free_elem);
+        mem_pool->zeroed_cnt++;
+    }
+    lock_release(&mem_pool->lock);
+    return pg_idx != -1;
+}
+
+/* 返回物理地址pg_phy_addr所在页框的描述符 */
+static struct page *phys2page(uint32_t pg_phy_addr)
+{
+    struct pool *mem_pool = pg_phy_addr >= user_pool.phy_addr_start ? &user_pool : &kernel_pool;
+    return &mem_pool->mem_map[(pg_phy_addr - mem_pool->phy_addr_start) / PG_SIZE];
+}
+
+/* cow_share_user_pages中途失败时撤销已对child_pgdir做的共享:减回页框和交换槽的引用计数,
+ * 已没有其它共享者的页恢复当前进程的可写属性,并归还子进程已建好的页表.调用者须持有user_pool的锁 */
+static void cow_unshare_user_pages(uint32_t *child_pgdir)
+{
+    uint32_t *pde = (uint32_t *)0xfffff000; // 当前进程的页目录
+    uint32_t pde_idx, pte_idx;
+    for (pde_idx = 0; pde_idx < PDE_IDX(K_PHY_BASE); pde_idx++)
+    {
+        if (!(child_pgdir[pde_idx] & PG_P_1))
+        {
+            continue;
+        }
+        if (child_pgdir[pde_idx] & PG_PS)
+        {
+            uint32_t page_phyaddr = child_pgdir[pde_idx] & 0xffc00000;
+            for (pte_idx = 0; pte_idx < HUGE_PG_PAGES; pte_idx++)
+            {
+                phys2page(page_phyaddr + pte_idx * PG_SIZE)->ref_cnt--;
+            }
+            if (phys2page(page_phyaddr)->ref_cnt == 1)
+            {
+                pde[pde_idx] |= PG_RW_W;
+            }
+        }
+        else
+        {
+            uint32_t *child_pt = K_P2V(child_pgdir[pde_idx] & 0xfffff000);
+            uint32_t *pt = (uint32_t *)(0xffc00000 + pde_idx * PG_SIZE);
+            for (pte_idx = 0; pte_idx < 1024; pte_idx++)
+            {
+                if (child_pt[pte_idx] & PG_P_1)
+                {
+                    struct page *pg = phys2page(child_pt[pte_idx] & 0xfffff000);
+                    if (--pg->ref_cnt == 1)
+                    {
+                        pt[pte_idx] |= PG_RW_W;
+                    }
+                }
+                else if (child_pt[pte_idx] & PG_SWAP)
+                {
+                    swap_slot_free(child_pt[pte_idx] >> 12);
+                }
+            }
+            free_kernel_pages(child_pt, 1);
+        }
+        child_pgdir[pde_idx] = 0;
+    }
+}
+
+/* fork时为子进程复制当前进程用户空间的页表,父子的页表项都改为只读并共享页框,
+ * 页框引用计数加1,真正的复制推迟到任一方首次写入时由缺页异常完成.
+ * 只遍历进程已记录的区域所涉及的pde,不必扫描整个用户空间的页目录.
+ * child_pgdir中只有内核部分的pde,成功返回true.申请页表失败返回false,此时已做的共享全部撤销 */
+bool cow_share_user_pages(uint32_t *child_pgdir)
+{
+    uint32_t *pde = (uint32_t *)0xfffff000; // 当前进程的页目录
+    struct list *vmas = &running_thread()->vma_list;
+    struct list_elem *elem = vmas->head.next;
+    uint32_t pte_idx;
+    bool ok = true;
+    lock_acquire(&user_pool.lock);
+    while (ok && elem != &vmas->tail)
+    {
+        struct vm_area *vma = elem2entry(struct vm_area, vma_tag, elem);
+        uint32_t vma_last = vma->end - 1;
+        uint32_t pde_idx = PDE_IDX(vma->start), pde_last = PDE_IDX(vma_last);
+        for (; pde_idx <= pde_last; pde_idx++)
+        {
+            /* 相邻的区域可能落在同一个4M中,子进程的pde已经建好就不再重复 */
+            if (!(pde[pde_idx] & PG_P_1) || (child_pgdir[pde_idx] & PG_P_1))
+            {
+                continue;
+            }
+            if (pde[pde_idx] & PG_PS)
+            {
+                /* 4M大页整个共享,写入时再拆成4K页复制 */
+                pde[pde_idx] &= ~PG_RW_W;
+                for (pte_idx = 0; pte_idx < HUGE_PG_PAGES; pte_idx++)
+                {
+                    phys2page((pde[pde_idx] & 0xffc00000) + pte_idx * PG_SIZE)->ref_cnt++;
+                }
+                child_pgdir[pde_idx] = pde[pde_idx];
+                continue;
+            }
+
+            uint32_t *child_pt = get_kernel_pages(1);
+            if (child_pt == NULL)
+            {
+                ok = false;
+                break;
+            }
+            /* 页目录最后一项指向页目录自己,经它访问的第pde_idx页就是该pde所指的页表 */
+            uint32_t *pt = (uint32_t *)(0xffc00000 + pde_idx * PG_SIZE);
+            for (pte_idx = 0; pte_idx < 1024; pte_idx++)
+            {
+                if (pt[pte_idx] & PG_P_1)
+                {
+                    pt[pte_idx] &= ~PG_RW_W;
+                    phys2page(pt[pte_idx] & 0xfffff000)->ref_cnt++;
+                    child_pt[pte_idx] = pt[pte_idx];
+                }
+                else if (pt[pte_idx] & PG_SWAP)
+                { // 已换出的页父子共用交换槽,各自缺页时读回自己的副本
+                    swap_slot_dup(pt[pte_idx] >> 12);
+                    child_pt[pte_idx] = pt[pte_idx];
+                }
+            }
+            child_pgdir[pde_idx] = addr_v2p((uint32_t)child_pt) | PG_US_U | PG_RW_W | PG_P_1;
+        }
+        elem = elem->next;
+    }
+    if (!ok)
+    {
+        cow_unshare_user_pages(child_pgdir);
+    }
+    lock_release(&user_pool.lock);
+
+    /* 当前进程的页表项改成了只读,重新加载cr3使tlb中可写的旧项失效 */
+    asm volatile("movl %%cr3, %%eax; movl %%eax, %%cr3" ::: "eax", "memory");
+    return ok;
+}
+
+/* 写时复制:当前进程写入与其它进程共享的只读页vaddr时,使它拥有一个可写的私有页.
+ * 成功或页已不在时返回true,后者由进程重新访问时再缺页;没有空闲物理页时返回false */
+static bool cow_copy_page(uint32_t vaddr)
+{
+    uint32_t *pte = pte_ptr(vaddr);
+    lock_acquire(&user_pool.lock);
+    void *page_phyaddr = NULL;
+    if (phys2page(*pte & 0xfffff000)->ref_cnt > 1)
+    {
+        page_phyaddr = palloc(&user_pool);
+        if (page_phyaddr == NULL)
+        {
+            lock_release(&user_pool.lock);
+            return false;
+        }
+    }
+    /* palloc换出页时会暂时放开锁,其间其它共享者可能复制或释放了此页,此页也可能随后被换出,
+     * 页表项要在分配之后重新读 */
+    if (!(*pte & PG_P_1))
+    {
+        if (page_phyaddr != NULL)
+        {
+            pfree((uint32_t)page_phyaddr);
+        }
+        lock_release(&user_pool.lock);
+        return true;
+    }
+    struct page *old_pg = phys2page(*pte & 0xfffff000);
+    if (old_pg->ref_cnt == 1)
+    {
+        /* 其它共享者都已复制或释放了此页,直接恢复可写 */
+        if (page_phyaddr != NULL)
+        {
+            pfree((uint32_t)page_phyaddr);
+        }
+        *pte |= PG_RW_W;
+        cow_reuse_cnt++;
+    }
+    else
+    {
+        /* 新页框还没有用户映射,经临时映射窗口复制好再让pte指向它 */
+        void *dst = kmap_atomic((uint32_t)page_phyaddr, KM_DST);
+        memcpy(dst, (void *)vaddr, PG_SIZE);
+        kunmap_atomic(dst, KM_DST);
+        *pte = (uint32_t)page_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+        old_pg->ref_cnt--;
+        cow_copy_cnt++;
+    }
+    asm volatile("invlpg %0" ::"m"(*(char *)vaddr) : "memory"); // 更新tlb
+    lock_release(&user_pool.lock);
+    return true;
+}
+
+/* 把已换出到交换区的用户页vaddr读回新的页框并映射,交换槽随之释放.
+ * 调用者须先持有swap_io_lock再持有user_pool的锁,没有空闲页框时返回false */
+static bool swap_in_page(uint32_t vaddr)
+{
+    uint32_t *pte = pte_ptr(vaddr);
+    void *page_phyaddr = palloc(&user_pool);
+    if (page_phyaddr == NULL)
+    {
+        return false;
+    }
+    /* 不存在的pte只有本进程会改,新页框也还没有映射,读盘时放开user_pool的锁.
+     * swap_buf由swap_io_lock保护,palloc中换出页时用过它,要在分配之后再读 */
+    uint32_t slot = *pte >> 12;
+    lock_release(&user_pool.lock);
+    swap_read(slot, swap_buf);
+    lock_acquire(&user_pool.lock);
+    void *dst = kmap_atomic((uint32_t)page_phyaddr, KM_DST);
+    memcpy(dst, swap_buf, PG_SIZE);
+    kunmap_atomic(dst, KM_DST);
+    /* 原来的pte不存在,不会缓存在tlb中 */
+    *pte = (uint32_t)page_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    swap_slot_free(slot);
+    return true;
+}
+
+/* 把文件映射区域vma中vaddr所在的页从文件读入.调用者须持有user_pool的锁,读盘期间放开它,
+ * 其它任务的缺页和分配不必等磁盘.先读到内核缓冲区,不在映射着的用户页上直接读盘,
+ * 以免读盘中途此页被换出、在磁盘传输当中又缺页去读交换区.没有内存时返回false */
+static bool file_page_in(struct vm_area *vma, uint32_t vaddr)
+{
+    lock_release(&user_pool.lock);
+    void *buf = get_kernel_pages_flags(1, AF_NOZERO);
+    if (buf != NULL)
+    { // 区域和不存在的页表项都只有本进程会改,放开锁期间不会变
+        file_read_page(vma->inode, vma->file_off + (vaddr - vma->start), buf);
+    }
+    lock_acquire(&user_pool.lock);
+    if (buf == NULL)
+    {
+        return false;
+    }
+
+    void *page_phyaddr = palloc(&user_pool);
+    bool mapped = false;
+    if (page_phyaddr != NULL)
+    {
+        /* 新页框还没有映射,经临时映射窗口填好再装入 */
+        void *dst = kmap_atomic((uint32_t)page_phyaddr, KM_DST);
+        memcpy(dst, buf, PG_SIZE);
+        kunmap_atomic(dst, KM_DST);
+        ASSERT(!page_present(vaddr));
+        mapped = map_range(vaddr, (uint32_t)page_phyaddr, 1);
+        if (!mapped)
+        {
+            pfree((uint32_t)page_phyaddr);
+        }
+    }
+    free_kernel_pages(buf, 1);
+    if (mapped)
+    {
+        file_page_cnt++;
+    }
+    return mapped;
+}
+
+/* 缺页异常错误码的P位,为1表示页存在但访问违反了保护属性,为0表示页不存在 */
+#define PF_ERR_P 1
+/* 缺页异常错误码的W位,为1表示由写操作引发 */
+#define PF_ERR_W 2
+
+/* 缺页异常处理程序.
+ * 落在用户进程已记录的区域中但还未映射的页(堆、栈、.bss等),
+ * 在首次访问时于此分配物理页并清0;写fork后共享的只读页时做写时复制.
+ * 其它缺页都是真正的错误,交给general_intr_handler */
+static void page_fault_handler(uint32_t vec_nr)
+{
+    /* 中断入口压入的上下文从参数vec_nr所在处开始,正好是struct intr_stack */
+    struct intr_stack *frame = (struct intr_stack *)&vec_nr;
+    struct task_struct *cur = running_thread();
+    uint32_t fault_vaddr;
+    asm volatile("movl %%cr2, %0" : "=r"(fault_vaddr)); // cr2是存放造成page_fault的地址
+
+    /* 区域的访问权限目前只做记录,所有用户页仍按可读写映射 */
+    struct vm_area *vma = cur->pgdir != NULL && fault_vaddr < 0xc0000000 ? vma_find(&cur->vma_list, fault_vaddr) : NULL;
+    bool in_vma = vma != NULL;
+    if (!(frame->err_code & PF_ERR_P) && in_vma)
+    {
+        uint32_t vaddr = fault_vaddr & 0xfffff000;
+        bool mapped;
+        ASSERT(user_pool.lock.holder != cur); // 见swap_out_pages,持有user_pool的锁时不能访问用户页
+        /* 不存在的页表项只有本进程会改,不持锁读也不会变.换入要先持swap_io_lock,
+         * 正在写盘的页要等写完才能读回 */
+        uint32_t pde = *pde_ptr(vaddr);
+        bool swapped = (pde & PG_P_1) && !(pde & PG_PS) && (*pte_ptr(vaddr) & PG_SWAP);
+        if (swapped)
+        {
+            lock_acquire(&swap_io_lock);
+        }
+        lock_acquire(&user_pool.lock);
+        if (swapped)
+        { // 已换出的页从交换区读回
+            mapped = swap_in_page(vaddr);
+        }
+        else if (vma->type == VMA_FILE)
+        { // 映射的文件从文件读入
+            mapped = file_page_in(vma, vaddr);
+        }
+        else
+        {
+            bool zeroed;
+            void *page_phyaddr = palloc_zero(&user_pool, &zeroed);
+            if (page_phyaddr != NULL && !map_range(vaddr, (uint32_t)page_phyaddr, 1))
+            {
+                pfree((uint32_t)page_phyaddr);
+                page_phyaddr = NULL;
+            }
+            if (page_phyaddr != NULL)
+            {
+                if (!zeroed)
+                {
+                    memset((void *)vaddr, 0, PG_SIZE);
+                }
+                demand_page_cnt++;
+            }
+            mapped = page_phyaddr != NULL;
+        }
+        lock_release(&user_pool.lock);
+        if (swapped)
+        {
+            lock_release(&swap_io_lock);
+        }
+        if (mapped)
+        {
+            return;
+        }
+    }
+
+    /* 写fork后共享的只读用户页.cr0的WP位已置1,内核写用户页时同样会走到这里 */
+    if ((frame->err_code & PF_ERR_P) && (frame->err_code & PF_ERR_W) && in_vma)
+    {
+        /* 共享的4M大页先拆成4K页,只复制被写的那一页 */
+        uint32_t *pde = pde_ptr(fault_vaddr);
+        if (*pde & PG_PS)
+        {
+            lock_acquire(&user_pool.lock);
+            if (*pde & PG_PS)
+            {
+                huge_page_split(fault_vaddr);
+            }
+            lock_release(&user_pool.lock);
+        }
+        if (!(*pde & PG_PS) && !(*pte_ptr(fault_vaddr) & PG_RW_W) && cow_copy_page(fault_vaddr & 0xfffff000))
+        {
+            return;
+        }
+    }
+    general_intr_handler(vec_nr);
+}
+
 /* 内存管理部分初始化入口 */
 void mem_init()
 {
     put_str("mem_init start\n");
-    uint32_t mem_bytes_total = (*(uint32_t *)(0xb00));
+    uint32_t mem_bytes_total = *(uint32_t *)K_P2V(TOTAL_MEM_BYTES_ADDR);
     mem_pool_init(mem_bytes_total); // 初始化内存池
                                     /* 初始化mem_block_desc数组descs,为malloc做准备 */
     block_desc_init(k_block_descs);
+    kmem_cache_init(); // 初始化对象缓存
+    vma_init();
+    kmap_init();
+    vmalloc_init();
+    demand_page_cnt = file_page_cnt = cow_copy_cnt = cow_reuse_cnt = huge_page_cnt = kmap_cnt = 0;
+    clock_pid = -1;
+    clock_vaddr = 0;
+    lock_init(&swap_io_lock);
+    /* 置cr0的WP位,使内核写只读的用户页时也引发缺页异常,否则会绕过写时复制 */
+    asm volatile("movl %%cr0, %%eax; orl $0x10000, %%eax; movl %%eax, %%cr0" ::: "eax", "memory");
+    register_handler(0x0e, page_fault_handler); // 注册缺页异常处理程序
     put_str("mem_init done\n");
 }
\ No newline at end of file
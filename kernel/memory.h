@@ -11,19 +11,59 @@ enum pool_flags
     PF_USER = 2    // User memory pool
 };
 
+/* 申请内存时的附加标志 */
+#define AF_NOZERO 1 // 调用者会完全覆盖申请到的内存,不必清0
+
+#define PREZERO_PAGES 64 // 空闲线程为每个内存池预先清0的页框数上限
+
 #define PG_P_1 1
 #define PG_P_0 0
 #define PG_RW_R 0
 #define PG_RW_W 2
 #define PG_US_S 0
 #define PG_US_U 4
+#define PG_PS 0x80 // pde的PS位,置1时该pde直接映射一个4M大页
+#define PG_A 0x20  // 访问位,cpu访问页时置1,换出页时用它判断页最近是否被访问过
+#define PG_G 0x100 // 全局页,重新加载cr3时tlb中的表项不被刷掉
+#define PG_SWAP 0x200 // pte的P位为0时,此位为1表示页已换出到交换区,高20位为交换槽号
+
+#define HUGE_PG_SIZE 0x400000 // 4M大页的大小
+#define HUGE_PG_PAGES 1024    // 一个4M大页所含的4K页数
+
+/* 物理内存的前DIRECT_MAP_SIZE字节由loader用4M大页映射在K_PHY_BASE之上,
+ * 物理地址x对应的内核虚拟地址就是K_PHY_BASE+x.须与boot.inc中的DIRECT_MAP_PDES一致.
+ * 其上的高端内存只归用户内存池,没有K_P2V地址,内核要经kmap_atomic访问 */
+#define K_PHY_BASE 0xc0000000
+#define DIRECT_MAP_SIZE 0x38000000
+#define K_P2V(phy) ((void *)((uint32_t)(phy) + K_PHY_BASE))
+#define K_V2P(vaddr) ((uint32_t)(vaddr) - K_PHY_BASE)
 
-struct virtual_addr
+/* 临时映射窗口:页目录第1022项对应的4M虚拟地址中留出的几页,每页一个槽位.
+ * 任意物理页框都可以经槽位短暂映射来访问,用完即解除,不必切换cr3 */
+#define KMAP_BASE 0xff800000
+
+/* kmap的槽位,同时要映射两个页框的路径(如复制)各用一个 */
+enum km_type
 {
-    struct bitmap vaddr_bitmap; // Bitmap for virtual addresses
-    uint32_t vaddr_start;       // Start address of the virtual memory area
+    KM_SRC,
+    KM_DST,
+    KM_TYPE_NR
 };
 
+#define MAX_ORDER 11 // 伙伴系统的阶数,最大的块为2^10个页框即4M
+
+/* 物理页框描述符,每个页框对应一个,统一存放在mem_map数组中 */
+struct page
+{
+    struct list_elem free_elem; // 页框为空闲块首页时挂在伙伴系统对应阶的空闲链表上,预先清0时挂在预清0链表上
+    uint8_t order;              // 空闲块的阶,仅对空闲块首页有效
+    uint8_t flags;              // 页框状态标志
+    uint16_t ref_cnt;           // 映射此页框的页表项数,fork后父子以写时复制共享时大于1
+};
+
+#define PAGE_BUDDY 1   // 页框是伙伴系统中某个空闲块的首页
+#define PAGE_MOVABLE 2 // 页框是从连续分配预留区借给用户页的,需要连续内存时可以迁走
+
 struct mem_block
 {
     struct list_elem free_elem; // List element for linking blocks
@@ -31,16 +71,33 @@ struct mem_block
 
 struct mem_block_desc
 {
-    uint32_t block_size;       // Size of each memory block
-    uint32_t blocks_per_arena; // Number of blocks in an arena
-    struct list free_list;     // List of free memory blocks
+    uint32_t block_size;        // Size of each memory block
+    uint32_t blocks_per_arena;  // Number of blocks in an arena
+    struct list partial_arenas; // 部分内存块空闲的arena,分配时优先使用
+    struct list full_arenas;    // 内存块全部分配出去的arena
+    struct list empty_arenas;   // 内存块全部空闲的arena,最多保留ARENA_EMPTY_KEEP个
 };
 
+#define ARENA_EMPTY_KEEP 1 // 每种规格最多保留的全空arena数,避免申请释放交替时反复归还页框
+
 #define DESC_CNT 7 // Number of memory block descriptors
 
+#define MAG_SIZE 6  // 每种规格的magazine最多缓存的内存块数
+#define MAG_BATCH 3 // magazine空或满时,与arena之间一次搬运的内存块数
+
+/* 任务私有的内存块缓存,每种规格一个,按后进先出缓存最近释放的内存块.
+ * 只有所属任务自己会访问,因此存取时不必持有内存池的锁 */
+struct mem_magazine
+{
+    uint32_t cnt;                       // 当前缓存的内存块数
+    struct mem_block *blocks[MAG_SIZE]; // 内存块栈,blocks[cnt-1]为栈顶
+};
+
 extern struct pool kernel_pool, user_pool;
 void mem_init(void);
 void *get_kernel_pages(uint32_t pg_cnt);
+void *get_kernel_pages_flags(uint32_t pg_cnt, uint8_t flags);
+void free_kernel_pages(void *vaddr, uint32_t pg_cnt);
 void *malloc_page(enum pool_flags pf, uint32_t pg_cnt);
 void malloc_init(void);
 uint32_t *pte_ptr(uint32_t vaddr);
@@ -50,9 +107,29 @@ void *get_user_pages(uint32_t pg_cnt);
 void *get_a_page(enum pool_flags pf, uint32_t vaddr);
 void block_desc_init(struct mem_block_desc *desc_array);
 void *sys_malloc(uint32_t size);
+void *sys_malloc_flags(uint32_t size, uint8_t flags);
 void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt);
 void pfree(uint32_t pg_phy_addr);
 void sys_free(void *ptr);
+uint32_t sys_brk(uint32_t brk);
+struct mmap_args;
+void *sys_mmap(struct mmap_args *args);
+int32_t sys_munmap(void *_addr, uint32_t length);
+void user_image_release(void);
 void *get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr);
+bool page_present(uint32_t vaddr);
+bool map_range(uint32_t vaddr, uint32_t page_phyaddr, uint32_t pg_cnt);
+bool unmap_range(uint32_t vaddr, uint32_t pg_cnt);
+void populate_user_pages(uint32_t vaddr, uint32_t pg_cnt);
+bool cow_share_user_pages(uint32_t *child_pgdir);
+bool prezero_free_page(void);
+uint32_t user_frame_alloc(void);
+void user_frame_free(uint32_t pg_phy_addr);
+bool user_page_install(uint32_t vaddr, uint32_t pg_phy_addr);
+void *palloc_contig(uint8_t order);
+void pfree_contig(uint32_t pg_phy_addr, uint8_t order);
+void *kmap_atomic(uint32_t pg_phy_addr, enum km_type type);
+void kunmap_atomic(void *vaddr, enum km_type type);
+void sys_meminfo(void);
 
 #endif
\ No newline at end of file
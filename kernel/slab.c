@@ -0,0 +1,252 @@
+#include "slab.h"
+#include "memory.h"
+#include "global.h"
+#include "debug.h"
+#include "../lib/string.h"
+#include "../lib/kernel/print.h"
+#include "../lib/kernel/stdio_kernel.h"
+
+/* slab元信息,位于slab所在页框的起始处,其后紧跟各个对象.
+ * 空闲对象的首4字节用来存放下一个空闲对象的地址 */
+struct slab
+{
+    struct list_elem slab_elem; // 用于挂在所属cache的slab链表上
+    struct kmem_cache *cache;   // 此slab所属的cache
+    void *free_obj;             // 空闲对象单链表的表头
+    uint32_t inuse;             // 已分配出去的对象数
+};
+
+/* 每个cache最多保留的空闲slab数,多余的空闲slab归还给内核内存池,
+ * 留一个是为了避免同一个对象反复申请释放时频繁申请释放页框 */
+#define SLAB_FREE_KEEP 1
+
+static struct kmem_cache kmem_caches[KMEM_CACHE_MAX]; // 所有对象缓存
+static uint32_t kmem_cache_cnt;                       // 已创建的对象缓存数
+
+/* 对象大小超过此值时一页只能放下1个对象,干脆按整页分配,不设slab元信息 */
+#define SLAB_OBJ_MAX ((PG_SIZE - sizeof(struct slab)) / 2)
+
+/* 返回对象obj所在的slab */
+static struct slab *obj2slab(void *obj)
+{
+    return (struct slab *)((uint32_t)obj & 0xfffff000);
+}
+
+/* 判断cache是否为整页对象的cache */
+static bool is_page_cache(struct kmem_cache *cache)
+{
+    return cache->obj_size == PG_SIZE;
+}
+
+/* 为cache新建一个slab,并把其中的对象串成空闲链表,失败返回NULL */
+static struct slab *slab_create(struct kmem_cache *cache)
+{
+    struct slab *slab = get_kernel_pages_flags(1, AF_NOZERO); // 对象在kmem_cache_alloc时才清0
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_obj = NULL;
+
+    /* 倒序串起来,使分配时按地址从低到高取出对象 */
+    uint32_t obj_idx = cache->objs_per_slab;
+    while (obj_idx-- > 0)
+    {
+        void *obj = (void *)((uint32_t)(slab + 1) + obj_idx * cache->obj_size);
+        *(void **)obj = slab->free_obj;
+        slab->free_obj = obj;
+    }
+    cache->nr_slabs++;
+    return slab;
+}
+
+/* 初始化对象缓存子系统,须在内存池初始化后调用 */
+void kmem_cache_init(void)
+{
+    put_str("   kmem_cache_init start\n");
+    kmem_cache_cnt = 0; // 内核的bss不会被清0,需显式初始化
+    put_str("   kmem_cache_init done\n");
+}
+
+/* 创建名为name、对象大小为size字节的对象缓存,
+ * ctor为对象构造函数,可为NULL.成功返回cache,失败返回NULL */
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size, kmem_ctor *ctor)
+{
+    ASSERT(size > 0 && size <= PG_SIZE);
+    ASSERT(strlen(name) < KMEM_CACHE_NAME_LEN);
+    if (kmem_cache_cnt == KMEM_CACHE_MAX)
+    {
+        return NULL;
+    }
+    struct kmem_cache *cache = &kmem_caches[kmem_cache_cnt++];
+    memset(cache, 0, sizeof(struct kmem_cache));
+    strcpy(cache->name, name);
+
+    /* 空闲对象要存放下一个空闲对象的地址,故至少4字节并按4字节对齐 */
+    size = (size + 3) & ~3;
+    if (size > SLAB_OBJ_MAX)
+    {
+        cache->obj_size = PG_SIZE;
+        cache->objs_per_slab = 1;
+    }
+    else
+    {
+        cache->obj_size = size;
+        cache->objs_per_slab = (PG_SIZE - sizeof(struct slab)) / size;
+    }
+    cache->ctor = ctor;
+
+    list_init(&cache->slabs_partial);
+    list_init(&cache->slabs_full);
+    list_init(&cache->slabs_free);
+    lock_init(&cache->lock);
+    return cache;
+}
+
+/* 从cache中分配一个对象,对象清0后若有构造函数则调用之.失败返回NULL */
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    void *obj;
+    lock_acquire(&cache->lock);
+    cache->alloc_cnt++;
+    if (is_page_cache(cache))
+    {
+        /* 整页对象,空闲页框的首部用来挂在slabs_free上 */
+        if (!list_empty(&cache->slabs_free))
+        {
+            obj = list_pop(&cache->slabs_free);
+            cache->hit_cnt++;
+        }
+        else
+        {
+            obj = get_kernel_pages_flags(1, AF_NOZERO);
+            if (obj == NULL)
+            {
+                lock_release(&cache->lock);
+                return NULL;
+            }
+            cache->nr_slabs++;
+        }
+    }
+    else
+    {
+        struct slab *slab;
+        if (!list_empty(&cache->slabs_partial))
+        {
+            slab = elem2entry(struct slab, slab_elem, cache->slabs_partial.head.next);
+            cache->hit_cnt++;
+        }
+        else
+        {
+            if (!list_empty(&cache->slabs_free))
+            {
+                slab = elem2entry(struct slab, slab_elem, list_pop(&cache->slabs_free));
+                cache->hit_cnt++;
+            }
+            else
+            {
+                slab = slab_create(cache);
+                if (slab == NULL)
+                {
+                    lock_release(&cache->lock);
+                    return NULL;
+                }
+            }
+            list_push(&cache->slabs_partial, &slab->slab_elem);
+        }
+
+        obj = slab->free_obj;
+        slab->free_obj = *(void **)obj;
+        /* 最后一个空闲对象分配出去后,slab移到slabs_full中 */
+        if (++slab->inuse == cache->objs_per_slab)
+        {
+            list_remove(&slab->slab_elem);
+            list_append(&cache->slabs_full, &slab->slab_elem);
+        }
+    }
+    cache->active_objs++;
+    lock_release(&cache->lock);
+
+    memset(obj, 0, cache->obj_size);
+    if (cache->ctor != NULL)
+    {
+        cache->ctor(obj);
+    }
+    return obj;
+}
+
+/* 将对象obj归还给cache */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    ASSERT(obj != NULL);
+    lock_acquire(&cache->lock);
+    cache->active_objs--;
+    if (is_page_cache(cache))
+    {
+        ASSERT(((uint32_t)obj & 0xfff) == 0);
+        if (list_len(&cache->slabs_free) < SLAB_FREE_KEEP)
+        {
+            list_push(&cache->slabs_free, (struct list_elem *)obj);
+        }
+        else
+        {
+            free_kernel_pages(obj, 1);
+            cache->nr_slabs--;
+        }
+        lock_release(&cache->lock);
+        return;
+    }
+
+    struct slab *slab = obj2slab(obj);
+    ASSERT(slab->cache == cache && slab->inuse > 0);
+    *(void **)obj = slab->free_obj;
+    slab->free_obj = obj;
+
+    /* 满的slab有了空闲对象,移回slabs_partial */
+    if (slab->inuse-- == cache->objs_per_slab)
+    {
+        list_remove(&slab->slab_elem);
+        list_push(&cache->slabs_partial, &slab->slab_elem);
+    }
+
+    /* slab中的对象全部空闲了,保留少量备用,其余归还内核内存池 */
+    if (slab->inuse == 0)
+    {
+        list_remove(&slab->slab_elem);
+        if (list_len(&cache->slabs_free) < SLAB_FREE_KEEP)
+        {
+            list_push(&cache->slabs_free, &slab->slab_elem);
+        }
+        else
+        {
+            free_kernel_pages(slab, 1);
+            cache->nr_slabs--;
+        }
+    }
+    lock_release(&cache->lock);
+}
+
+/* 打印各对象缓存的使用情况及命中次数 */
+void kmem_cache_info(void)
+{
+    uint32_t cache_idx = 0;
+    printk("slab caches: name size objs/slab active/total slabs allocs hits\n");
+    while (cache_idx < kmem_cache_cnt)
+    {
+        struct kmem_cache *cache = &kmem_caches[cache_idx];
+        uint32_t active_objs, nr_slabs, alloc_cnt, hit_cnt;
+
+        lock_acquire(&cache->lock);
+        active_objs = cache->active_objs;
+        nr_slabs = cache->nr_slabs;
+        alloc_cnt = cache->alloc_cnt;
+        hit_cnt = cache->hit_cnt;
+        lock_release(&cache->lock);
+
+        printk("   %s %d %d %d/%d %d %d %d\n", cache->name, cache->obj_size, cache->objs_per_slab,
+               active_objs, nr_slabs * cache->objs_per_slab, nr_slabs, alloc_cnt, hit_cnt);
+        cache_idx++;
+    }
+}
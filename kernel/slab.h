@@ -0,0 +1,39 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+
+#include "../lib/stdint.h"
+#include "../lib/kernel/list.h"
+#include "../thread/sync.h"
+
+#define KMEM_CACHE_MAX 16      // 系统中最多的对象缓存数
+#define KMEM_CACHE_NAME_LEN 16 // 对象缓存名字的最大长度
+
+/* 对象构造函数,每次分配出对象并清0后调用 */
+typedef void kmem_ctor(void *obj);
+
+/* 对象缓存,为一种固定大小的内核对象提供内存 */
+struct kmem_cache
+{
+    char name[KMEM_CACHE_NAME_LEN];
+    uint32_t obj_size;      // 对象大小,已按4字节对齐,整页对象为PG_SIZE
+    uint32_t objs_per_slab; // 每个slab中的对象数,整页对象时为1
+    kmem_ctor *ctor;        // 构造函数,可为NULL
+
+    struct list slabs_partial; // 部分对象已分配的slab
+    struct list slabs_full;    // 对象全部分配出去的slab
+    struct list slabs_free;    // 对象全部空闲的slab,整页对象时为空闲的页
+
+    uint32_t nr_slabs;    // 持有的slab(页框)总数
+    uint32_t active_objs; // 已分配出去的对象数
+    uint32_t alloc_cnt;   // 累计分配次数
+    uint32_t hit_cnt;     // 无需向内核内存池申请新页即可满足的分配次数
+    struct lock lock;
+};
+
+void kmem_cache_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size, kmem_ctor *ctor);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+void kmem_cache_info(void);
+
+#endif
@@ -0,0 +1,128 @@
+#include "swap.h"
+#include "memory.h"
+#include "global.h"
+#include "debug.h"
+#include "../device/ide.h"
+#include "../fs/fs.h"
+#include "../lib/string.h"
+#include "../lib/kernel/bitmap.h"
+#include "../lib/kernel/list.h"
+#include "../lib/kernel/stdio_kernel.h"
+
+/* 交换区从分区的第8个扇区开始,跳过引导扇区和超级块,
+ * 这样filesys_init仍认得分区上的文件系统魔数,不会每次开机都重新格式化它 */
+#define SWAP_START_SECTS 8
+#define SECTS_PER_SLOT (PG_SIZE / SECTOR_SIZE) // 每个交换槽存放一页
+
+static struct partition *swap_part; // 交换分区,为NULL时不换出
+static struct bitmap slot_btmp;     // 交换槽位图,1表示已占用
+static uint16_t *slot_refs;         // 各交换槽被页表项引用的次数,fork后父子共享同一个槽,与页框的ref_cnt同宽
+static uint32_t slot_cnt;           // 交换槽总数
+static uint32_t used_slots;         // 已占用的交换槽数
+static uint32_t swap_out_cnt;       // 换出的页数
+static uint32_t swap_in_cnt;        // 换入的页数
+
+/* 在分区链表中找名为arg的分区,找到时记入swap_part并返回true停止遍历 */
+static bool swap_part_find(struct list_elem *pelem, int arg)
+{
+    struct partition *part = elem2entry(struct partition, part_tag, pelem);
+    if (!strcmp(part->name, (char *)arg))
+    {
+        swap_part = part;
+        return true;
+    }
+    return false;
+}
+
+/* 初始化交换区,须在ide_init之后调用.没有交换分区时只打印提示,内存不足时仍直接失败 */
+void swap_init(void)
+{
+    swap_part = NULL;
+    slot_cnt = used_slots = swap_out_cnt = swap_in_cnt = 0;
+    list_traversal(&partition_list, swap_part_find, (int)SWAP_PART_NAME);
+    if (swap_part == NULL || swap_part->sec_cnt < SWAP_START_SECTS + SECTS_PER_SLOT)
+    {
+        swap_part = NULL;
+        printk("swap: no partition %s, swapping disabled\n", SWAP_PART_NAME);
+        return;
+    }
+
+    slot_cnt = (swap_part->sec_cnt - SWAP_START_SECTS) / SECTS_PER_SLOT;
+    slot_btmp.btmp_bytes_len = DIV_ROUND_UP(slot_cnt, 8);
+    slot_btmp.bits = sys_malloc(slot_btmp.btmp_bytes_len);
+    slot_refs = sys_malloc(slot_cnt * sizeof(uint16_t));
+    if (slot_btmp.bits == NULL || slot_refs == NULL)
+    {
+        PANIC("swap_init: alloc memory failed!");
+    }
+    bitmap_init(&slot_btmp);
+    /* 位图最后一个字节中多出来的位没有对应的槽,置1免得分配出去 */
+    uint32_t bit_idx;
+    for (bit_idx = slot_cnt; bit_idx < slot_btmp.btmp_bytes_len * 8; bit_idx++)
+    {
+        bitmap_set(&slot_btmp, bit_idx, 1);
+    }
+    printk("swap: %s, %d slots\n", swap_part->name, slot_cnt);
+}
+
+/* 申请一个交换槽,引用计数为1.没有交换区或已满时返回-1.
+ * 以下对交换槽的操作都由调用者负责互斥,内存管理中都在user_pool的锁内调用 */
+int32_t swap_slot_alloc(void)
+{
+    if (swap_part == NULL)
+    {
+        return -1;
+    }
+    int32_t slot = bitmap_scan(&slot_btmp, 1);
+    if (slot != -1)
+    {
+        bitmap_set(&slot_btmp, slot, 1);
+        slot_refs[slot] = 1;
+        used_slots++;
+    }
+    return slot;
+}
+
+/* fork时子进程的页表项也引用了交换槽slot */
+void swap_slot_dup(uint32_t slot)
+{
+    ASSERT(slot < slot_cnt && slot_refs[slot] > 0 && slot_refs[slot] < 0xffff);
+    slot_refs[slot]++;
+}
+
+/* 去掉对交换槽slot的一个引用,没有引用时释放它 */
+void swap_slot_free(uint32_t slot)
+{
+    ASSERT(slot < slot_cnt && slot_refs[slot] > 0);
+    if (--slot_refs[slot] == 0)
+    {
+        bitmap_set(&slot_btmp, slot, 0);
+        used_slots--;
+    }
+}
+
+/* 把一页buf写入交换槽slot */
+void swap_write(uint32_t slot, void *buf)
+{
+    ide_write(swap_part->my_disk, swap_part->start_lba + SWAP_START_SECTS + slot * SECTS_PER_SLOT, buf, SECTS_PER_SLOT);
+    swap_out_cnt++;
+}
+
+/* 从交换槽slot读出一页到buf */
+void swap_read(uint32_t slot, void *buf)
+{
+    ide_read(swap_part->my_disk, swap_part->start_lba + SWAP_START_SECTS + slot * SECTS_PER_SLOT, buf, SECTS_PER_SLOT);
+    swap_in_cnt++;
+}
+
+/* 打印交换区的使用情况 */
+void swap_info(void)
+{
+    if (swap_part == NULL)
+    {
+        printk("swap: disabled\n");
+        return;
+    }
+    printk("swap: %d of %d slots used, %d pages swapped out, %d swapped in\n",
+           used_slots, slot_cnt, swap_out_cnt, swap_in_cnt);
+}
@@ -0,0 +1,16 @@
+#ifndef __KERNEL_SWAP_H
+#define __KERNEL_SWAP_H
+
+#include "../lib/stdint.h"
+
+#define SWAP_PART_NAME "sdb5" // 用作交换区的分区,不挂载文件系统
+
+void swap_init(void);
+int32_t swap_slot_alloc(void);
+void swap_slot_dup(uint32_t slot);
+void swap_slot_free(uint32_t slot);
+void swap_write(uint32_t slot, void *buf);
+void swap_read(uint32_t slot, void *buf);
+void swap_info(void);
+
+#endif
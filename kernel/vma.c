@@ -0,0 +1,236 @@
+#include "vma.h"
+#include "slab.h"
+#include "global.h"
+#include "debug.h"
+#include "../userprog/process.h"
+
+static struct kmem_cache *vma_cache; // vm_area的对象缓存
+
+void vma_init(void)
+{
+    vma_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), NULL);
+    if (vma_cache == NULL)
+    {
+        PANIC("vma_init: create kmem_cache failed");
+    }
+}
+
+/* 返回vmas中包含vaddr的区域,vaddr不在任何区域中时返回NULL */
+struct vm_area *vma_find(struct list *vmas, uint32_t vaddr)
+{
+    struct list_elem *elem = vmas->head.next;
+    while (elem != &vmas->tail)
+    {
+        struct vm_area *vma = elem2entry(struct vm_area, vma_tag, elem);
+        if (vaddr < vma->start)
+        { // 区域按起始地址排序,后面的不会再包含vaddr
+            break;
+        }
+        if (vaddr < vma->end)
+        {
+            return vma;
+        }
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/* 在USER_MMAP_BASE之上的空洞中首次适配一段size字节、起始地址按align对齐的虚拟地址,
+ * 只查找不占用.成功返回起始地址,没有足够大的空洞时返回0 */
+uint32_t vma_get_unmapped(struct list *vmas, uint32_t size, uint32_t align)
+{
+    uint32_t start = (USER_MMAP_BASE + align - 1) & ~(align - 1);
+    struct list_elem *elem = vmas->head.next;
+    while (elem != &vmas->tail)
+    {
+        struct vm_area *vma = elem2entry(struct vm_area, vma_tag, elem);
+        if (start + size >= start && start + size <= vma->start)
+        {
+            return start;
+        }
+        if (vma->end > start)
+        {
+            start = (vma->end + align - 1) & ~(align - 1);
+        }
+        elem = elem->next;
+    }
+    if (start != 0 && start + size >= start && start + size <= 0xc0000000)
+    {
+        return start;
+    }
+    return 0;
+}
+
+/* 判断[start, end)是否与vmas中的某个区域相交 */
+bool vma_intersects(struct list *vmas, uint32_t start, uint32_t end)
+{
+    struct list_elem *elem = vmas->head.next;
+    while (elem != &vmas->tail)
+    {
+        struct vm_area *vma = elem2entry(struct vm_area, vma_tag, elem);
+        if (vma->start >= end)
+        {
+            break;
+        }
+        if (vma->end > start)
+        {
+            return true;
+        }
+        elem = elem->next;
+    }
+    return false;
+}
+
+/* 在vmas中按顺序插入区域[start, end),该范围不能与已有区域重叠.成功返回新区域,内存不足时返回NULL */
+static struct vm_area *vma_insert(struct list *vmas, uint32_t start, uint32_t end, uint8_t prot, uint8_t type)
+{
+    ASSERT(start < end && start % PG_SIZE == 0 && end % PG_SIZE == 0);
+    struct vm_area *vma = kmem_cache_alloc(vma_cache);
+    if (vma == NULL)
+    {
+        return NULL;
+    }
+    vma->start = start;
+    vma->end = end;
+    vma->prot = prot;
+    vma->type = type;
+    vma->inode = NULL;
+    vma->file_off = 0;
+
+    struct list_elem *elem = vmas->head.next;
+    struct vm_area *next = NULL, *prev = NULL;
+    while (elem != &vmas->tail)
+    {
+        next = elem2entry(struct vm_area, vma_tag, elem);
+        if (next->start >= start)
+        {
+            break;
+        }
+        elem = elem->next;
+    }
+    if (elem->prev != &vmas->head)
+    {
+        prev = elem2entry(struct vm_area, vma_tag, elem->prev);
+    }
+    ASSERT(elem == &vmas->tail || next->start >= end);
+    ASSERT(prev == NULL || prev->end <= start);
+    list_insert_before(elem, &vma->vma_tag);
+    return vma;
+}
+
+/* 在vmas中按顺序插入区域[start, end),该范围不能与已有区域重叠.内存不足时返回false */
+bool vma_add(struct list *vmas, uint32_t start, uint32_t end, uint8_t prot, uint8_t type)
+{
+    return vma_insert(vmas, start, end, prot, type) != NULL;
+}
+
+/* 插入映射文件inode中file_off处内容的区域[start, end),区域持有inode的一次打开数.内存不足时返回false */
+bool vma_add_file(struct list *vmas, uint32_t start, uint32_t end, uint8_t prot, struct inode *inode, uint32_t file_off)
+{
+    ASSERT(file_off % PG_SIZE == 0);
+    struct vm_area *vma = vma_insert(vmas, start, end, prot, VMA_FILE);
+    if (vma == NULL)
+    {
+        return false;
+    }
+    vma->inode = inode;
+    vma->file_off = file_off;
+    inode->i_open_cnts++;
+    return true;
+}
+
+/* 从vmas中去掉[start, end)范围,与之相交的区域被删除或截短,
+ * 范围落在一个区域中间时把它一分为二.只改区域记录,不动页表.
+ * 拆分时申请不到vm_area则返回false.要拆分的区域是唯一与范围相交的区域,此时什么都没有改 */
+bool vma_remove(struct list *vmas, uint32_t start, uint32_t end)
+{
+    struct list_elem *elem = vmas->head.next;
+    while (elem != &vmas->tail)
+    {
+        struct vm_area *vma = elem2entry(struct vm_area, vma_tag, elem);
+        elem = elem->next;
+        if (vma->start >= end)
+        {
+            break;
+        }
+        if (vma->end <= start)
+        {
+            continue;
+        }
+
+        if (vma->start < start && vma->end > end)
+        { // 从中间挖掉,后半段成为新的区域
+            struct vm_area *tail = kmem_cache_alloc(vma_cache);
+            if (tail == NULL)
+            {
+                return false;
+            }
+            *tail = *vma;
+            tail->start = end;
+            if (tail->inode != NULL)
+            { // 后半段同样映射着文件,另占一次打开数
+                tail->file_off += end - vma->start;
+                tail->inode->i_open_cnts++;
+            }
+            vma->end = start;
+            list_insert_before(elem, &tail->vma_tag);
+            break;
+        }
+        if (vma->start < start)
+        {
+            vma->end = start;
+        }
+        else if (vma->end > end)
+        {
+            vma->file_off += vma->inode != NULL ? end - vma->start : 0;
+            vma->start = end;
+        }
+        else
+        {
+            if (vma->inode != NULL)
+            {
+                inode_close(vma->inode);
+            }
+            list_remove(&vma->vma_tag);
+            kmem_cache_free(vma_cache, vma);
+        }
+    }
+    return true;
+}
+
+/* fork时把src中的区域逐个复制到空链表dst.内存不足时返回false */
+bool vma_copy(struct list *dst, struct list *src)
+{
+    struct list_elem *elem = src->head.next;
+    while (elem != &src->tail)
+    {
+        struct vm_area *vma = elem2entry(struct vm_area, vma_tag, elem);
+        struct vm_area *copy = kmem_cache_alloc(vma_cache);
+        if (copy == NULL)
+        {
+            return false;
+        }
+        *copy = *vma;
+        if (copy->inode != NULL)
+        {
+            copy->inode->i_open_cnts++;
+        }
+        list_append(dst, &copy->vma_tag);
+        elem = elem->next;
+    }
+    return true;
+}
+
+/* 删除vmas中的全部区域,映射文件的区域同时关闭其inode.只改区域记录,不动页表 */
+void vma_clear(struct list *vmas)
+{
+    while (!list_empty(vmas))
+    {
+        struct vm_area *vma = elem2entry(struct vm_area, vma_tag, list_pop(vmas));
+        if (vma->inode != NULL)
+        {
+            inode_close(vma->inode);
+        }
+        kmem_cache_free(vma_cache, vma);
+    }
+}
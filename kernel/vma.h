@@ -0,0 +1,45 @@
+#ifndef __KERNEL_VMA_H
+#define __KERNEL_VMA_H
+
+#include "../lib/stdint.h"
+#include "../lib/kernel/list.h"
+#include "../fs/inode.h"
+
+/* 区域的访问权限 */
+#define VM_READ 1
+#define VM_WRITE 2
+#define VM_EXEC 4
+
+/* 区域的来源,即缺页时页的内容从何而来.文件映射区从文件读入,其余都在缺页时填0页 */
+enum vma_type
+{
+    VMA_ANON,  // 堆等匿名内存
+    VMA_STACK, // 用户栈
+    VMA_ELF,   // 程序段,文件数据在exec时读入,.bss部分填0页
+    VMA_HEAP,  // brk堆,随sys_brk增长收缩
+    VMA_FILE   // mmap映射的文件,缺页时从文件读入,写入只对本进程可见
+};
+
+/* 用户进程一段已占用的虚拟地址区域[start, end),同一进程的区域按起始地址排序、互不重叠 */
+struct vm_area
+{
+    struct list_elem vma_tag; // 用于挂在进程的vma_list上
+    uint32_t start;           // 起始地址,按页对齐
+    uint32_t end;             // 结束地址(不含),按页对齐
+    uint8_t prot;             // VM_READ、VM_WRITE、VM_EXEC的组合
+    uint8_t type;             // enum vma_type
+    struct inode *inode;      // VMA_FILE区域映射的文件,每个区域各占一次打开数
+    uint32_t file_off;        // start处对应的文件偏移,按页对齐
+};
+
+void vma_init(void);
+struct vm_area *vma_find(struct list *vmas, uint32_t vaddr);
+uint32_t vma_get_unmapped(struct list *vmas, uint32_t size, uint32_t align);
+bool vma_add(struct list *vmas, uint32_t start, uint32_t end, uint8_t prot, uint8_t type);
+bool vma_add_file(struct list *vmas, uint32_t start, uint32_t end, uint8_t prot, struct inode *inode, uint32_t file_off);
+bool vma_intersects(struct list *vmas, uint32_t start, uint32_t end);
+bool vma_remove(struct list *vmas, uint32_t start, uint32_t end);
+bool vma_copy(struct list *dst, struct list *src);
+void vma_clear(struct list *vmas);
+
+#endif
@@ -0,0 +1,220 @@
+#include "vmalloc.h"
+#include "slab.h"
+#include "global.h"
+#include "debug.h"
+#include "../thread/sync.h"
+#include "../lib/kernel/list.h"
+#include "../lib/kernel/stdio_kernel.h"
+
+#define VMALLOC_LAZY_MAX 1024 // 已释放但tlb中可能还有旧项的页数超过此值时,集中刷新一次
+#define VMALLOC_INVLPG_MAX 32 // 刷新的页数超过此值时,改为清掉包括全局页在内的整个tlb
+
+/* vmalloc区中的一段虚拟地址,每段之后留一页不映射的保护页,越界访问会引发缺页异常 */
+struct vm_struct
+{
+    struct list_elem area_tag; // 用于挂在area_list上
+    uint32_t addr;             // 起始地址
+    uint32_t pg_cnt;           // 映射的页数,不含保护页
+    bool lazy;                 // 已释放,页表项已清除但还没有刷新tlb,刷新前这段地址不能再分配
+};
+
+static struct list area_list;          // vmalloc区中所有区域,按地址排序
+static struct lock vmalloc_lock;       // 分配释放时互斥
+static struct kmem_cache *area_cache;  // vm_struct的对象缓存
+static uint32_t vmalloc_pages;         // 当前映射着的页数
+static uint32_t lazy_pages;            // 等待刷新tlb的页数
+static uint32_t purge_cnt;             // 集中刷新tlb的次数
+
+/* 为整个vmalloc区分配页表并挂在内核页目录上.
+ * 进程的页目录在创建时复制内核部分的pde,所以必须在创建任何进程之前调用 */
+void vmalloc_init(void)
+{
+    list_init(&area_list);
+    lock_init(&vmalloc_lock);
+    area_cache = kmem_cache_create("vm_struct", sizeof(struct vm_struct), NULL);
+    if (area_cache == NULL)
+    {
+        PANIC("vmalloc_init: create kmem_cache failed");
+    }
+
+    uint32_t vaddr;
+    for (vaddr = VMALLOC_START; vaddr < VMALLOC_END; vaddr += HUGE_PG_SIZE)
+    {
+        uint32_t *pde = pde_ptr(vaddr);
+        ASSERT(!(*pde & PG_P_1));
+        void *pt = get_kernel_pages(1);
+        if (pt == NULL)
+        {
+            PANIC("vmalloc_init: no page for page table");
+        }
+        *pde = K_V2P(pt) | PG_RW_W | PG_P_1;
+    }
+    vmalloc_pages = lazy_pages = purge_cnt = 0;
+}
+
+/* 刷新所有已释放区域在tlb中的旧项,之后这些地址可以再分配.调用者须持有vmalloc_lock */
+static void vmalloc_purge(void)
+{
+    struct list_elem *elem = area_list.head.next;
+    bool flush_all = lazy_pages > VMALLOC_INVLPG_MAX;
+    if (flush_all)
+    {
+        /* vmalloc区的页是全局页,重新加载cr3刷不掉,要清掉cr4的PGE位再置回 */
+        asm volatile("movl %%cr4, %%eax; andl $~0x80, %%eax; movl %%eax, %%cr4; orl $0x80, %%eax; movl %%eax, %%cr4" ::: "eax", "memory");
+    }
+    while (elem != &area_list.tail)
+    {
+        struct vm_struct *area = elem2entry(struct vm_struct, area_tag, elem);
+        elem = elem->next;
+        if (!area->lazy)
+        {
+            continue;
+        }
+        if (!flush_all)
+        {
+            uint32_t vaddr;
+            for (vaddr = area->addr; vaddr < area->addr + area->pg_cnt * PG_SIZE; vaddr += PG_SIZE)
+            {
+                asm volatile("invlpg %0" ::"m"(*(char *)vaddr) : "memory");
+            }
+        }
+        list_remove(&area->area_tag);
+        kmem_cache_free(area_cache, area);
+    }
+    lazy_pages = 0;
+    purge_cnt++;
+}
+
+/* 在vmalloc区中首次适配pg_cnt页加一页保护页的空洞,找到时返回起始地址并在*next中返回其后的区域节点,
+ * 找不到时返回0.调用者须持有vmalloc_lock */
+static uint32_t area_find(uint32_t pg_cnt, struct list_elem **next)
+{
+    uint32_t size = (pg_cnt + 1) * PG_SIZE, start = VMALLOC_START;
+    struct list_elem *elem = area_list.head.next;
+    while (elem != &area_list.tail)
+    {
+        struct vm_struct *area = elem2entry(struct vm_struct, area_tag, elem);
+        if (area->addr - start >= size)
+        {
+            break;
+        }
+        start = area->addr + (area->pg_cnt + 1) * PG_SIZE;
+        elem = elem->next;
+    }
+    if (VMALLOC_END - start < size)
+    {
+        return 0;
+    }
+    *next = elem;
+    return start;
+}
+
+/* 解除area中前pg_cnt页的映射并把页框还给内核内存池,不刷新tlb.调用者须持有vmalloc_lock */
+static void area_unmap(struct vm_struct *area, uint32_t pg_cnt)
+{
+    uint32_t idx;
+    for (idx = 0; idx < pg_cnt; idx++)
+    {
+        uint32_t *pte = pte_ptr(area->addr + idx * PG_SIZE);
+        ASSERT(*pte & PG_P_1);
+        free_kernel_pages(K_P2V(*pte & 0xfffff000), 1);
+        *pte = 0;
+    }
+    vmalloc_pages -= pg_cnt;
+}
+
+/* 申请size字节虚拟地址连续的内核内存,物理页框逐页申请,不要求连续.
+ * flags同sys_malloc_flags.成功返回起始地址,地址或内存不足时返回NULL */
+void *vmalloc_flags(uint32_t size, uint8_t flags)
+{
+    uint32_t pg_cnt = DIV_ROUND_UP(size, PG_SIZE), idx;
+    if (pg_cnt == 0)
+    {
+        return NULL;
+    }
+
+    lock_acquire(&vmalloc_lock);
+    struct list_elem *next;
+    uint32_t addr = area_find(pg_cnt, &next);
+    if (addr == 0 && lazy_pages > 0)
+    { // 地址被等待刷新的区域占着,提前刷新后再找一次
+        vmalloc_purge();
+        addr = area_find(pg_cnt, &next);
+    }
+    struct vm_struct *area = addr == 0 ? NULL : kmem_cache_alloc(area_cache);
+    if (area == NULL)
+    {
+        lock_release(&vmalloc_lock);
+        return NULL;
+    }
+    area->addr = addr;
+    area->pg_cnt = pg_cnt;
+    area->lazy = false;
+    list_insert_before(next, &area->area_tag);
+
+    /* 这段地址上次释放后已刷新过tlb,直接填写页表项 */
+    for (idx = 0; idx < pg_cnt; idx++)
+    {
+        void *page = get_kernel_pages_flags(1, flags);
+        if (page == NULL)
+        {
+            area_unmap(area, idx);
+            list_remove(&area->area_tag);
+            kmem_cache_free(area_cache, area);
+            lock_release(&vmalloc_lock);
+            return NULL;
+        }
+        *pte_ptr(addr + idx * PG_SIZE) = K_V2P(page) | PG_G | PG_RW_W | PG_P_1;
+        vmalloc_pages++;
+    }
+    lock_release(&vmalloc_lock);
+    return (void *)addr;
+}
+
+/* 申请size字节清0的虚拟地址连续的内核内存 */
+void *vmalloc(uint32_t size)
+{
+    return vmalloc_flags(size, 0);
+}
+
+/* 释放vmalloc申请的内存.页框立即归还,tlb则攒够VMALLOC_LAZY_MAX页再一并刷新,
+ * 在此之前这段地址不会再分配出去,tlb中的旧项只可能被释放后仍访问它的错误代码用到 */
+void vfree(void *addr)
+{
+    if (addr == NULL)
+    {
+        return;
+    }
+    lock_acquire(&vmalloc_lock);
+    struct list_elem *elem = area_list.head.next;
+    struct vm_struct *area = NULL;
+    while (elem != &area_list.tail)
+    {
+        area = elem2entry(struct vm_struct, area_tag, elem);
+        if (area->addr == (uint32_t)addr && !area->lazy)
+        {
+            break;
+        }
+        elem = elem->next;
+    }
+    if (elem == &area_list.tail)
+    {
+        PANIC("vfree: not a vmalloc address");
+    }
+
+    area_unmap(area, area->pg_cnt);
+    area->lazy = true;
+    lazy_pages += area->pg_cnt;
+    if (lazy_pages > VMALLOC_LAZY_MAX)
+    {
+        vmalloc_purge();
+    }
+    lock_release(&vmalloc_lock);
+}
+
+/* 打印vmalloc区的使用情况 */
+void vmalloc_info(void)
+{
+    printk("vmalloc: %d pages mapped, %d pages waiting for tlb purge, %d purges\n",
+           vmalloc_pages, lazy_pages, purge_cnt);
+}
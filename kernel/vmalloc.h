@@ -0,0 +1,17 @@
+#ifndef __KERNEL_VMALLOC_H
+#define __KERNEL_VMALLOC_H
+
+#include "../lib/stdint.h"
+#include "memory.h"
+
+/* vmalloc区紧接在直接映射区最大范围之后,共64M,页表在初始化时一次建好,所有进程共用 */
+#define VMALLOC_START (K_PHY_BASE + DIRECT_MAP_SIZE)
+#define VMALLOC_END (VMALLOC_START + 0x4000000)
+
+void vmalloc_init(void);
+void *vmalloc(uint32_t size);
+void *vmalloc_flags(uint32_t size, uint8_t flags);
+void vfree(void *addr);
+void vmalloc_info(void);
+
+#endif
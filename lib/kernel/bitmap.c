@@ -6,6 +6,46 @@
 #include "../../kernel/debug.h"
 #include "../../kernel/global.h"
 
+/* 位图按32位字扫描,一个字全0或全1时一条比较就能跳过32位 */
+#define BITMAP_WORD_BITS 32
+#define BITMAP_WORD_FULL 0xffffffff
+
+/* 最低的置1位的下标,word不能为0 */
+static inline uint32_t bit_first_set(uint32_t word)
+{
+    uint32_t idx;
+    asm("bsfl %1, %0" : "=r"(idx) : "rm"(word));
+    return idx;
+}
+
+/* 最高的置1位的下标,word不能为0 */
+static inline uint32_t bit_last_set(uint32_t word)
+{
+    uint32_t idx;
+    asm("bsrl %1, %0" : "=r"(idx) : "rm"(word));
+    return idx;
+}
+
+/* 取位图的第word_idx个32位字.位图长度不是4的倍数时,
+ * 最后一个字超出btmp_bytes_len的部分按已占用处理,扫描不会越界 */
+static uint32_t bitmap_word(struct bitmap *btmp, uint32_t word_idx)
+{
+    uint32_t byte_idx = word_idx * 4;
+    if (byte_idx + 4 <= btmp->btmp_bytes_len)
+    {
+        return ((uint32_t *)btmp->bits)[word_idx];
+    }
+
+    uint32_t word = BITMAP_WORD_FULL, shift = 0;
+    while (byte_idx < btmp->btmp_bytes_len)
+    {
+        word &= ~(0xffU << shift);
+        word |= (uint32_t)btmp->bits[byte_idx++] << shift;
+        shift += 8;
+    }
+    return word;
+}
+
 void bitmap_init(struct bitmap *btmp)
 {
     memset(btmp->bits, 0, btmp->btmp_bytes_len);
@@ -18,57 +58,94 @@ bool bitmap_scan_test(struct bitmap *btmp, uint32_t bit_idx)
     return (btmp->bits[byte_idx] & (BITMAP_MASK << bit_odd));
 }
 
+/* 在位图中找连续cnt个空闲位,成功返回起始下标,失败返回-1.
+ * 逐字扫描,run记录跨字延续下来的空闲位数:
+ * 全0的字整体并入run,全1的字让run归零,
+ * 其余的字用bsf得到低端接续run的空闲位数,用bsr得到高端留给下一字的空闲位数,
+ * 不足一字的cnt还要在字内找被占用位隔开的空闲段 */
 int bitmap_scan(struct bitmap *btmp, uint32_t cnt)
 {
-    uint32_t idx_byte = 0;
-
-    while ((0xff == btmp->bits[idx_byte]) && (idx_byte < btmp->btmp_bytes_len))
-    {
-        idx_byte++;
-    }
+    uint32_t *words = (uint32_t *)btmp->bits;
+    uint32_t whole_words = btmp->btmp_bytes_len / 4;
+    uint32_t word_cnt = DIV_ROUND_UP(btmp->btmp_bytes_len, 4);
+    uint32_t word_idx = 0, run = 0, run_start = 0;
 
-    ASSERT(idx_byte < btmp->btmp_bytes_len);
-    if (idx_byte == btmp->btmp_bytes_len)
+    if (cnt == 0)
     {
-        return -1; // No free bits found
+        return -1;
     }
 
-    int idx_bit = 0;
-    while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte])
+    while (word_idx < word_cnt)
     {
-        idx_bit++;
-    }
+        /* 位图前部往往已被占满,没有run要接续时先成片跳过全1的字 */
+        if (run == 0)
+        {
+            while (word_idx < whole_words && words[word_idx] == BITMAP_WORD_FULL)
+            {
+                word_idx++;
+            }
+            if (word_idx == word_cnt)
+            {
+                break;
+            }
+        }
 
-    int bit_idx_start = idx_byte * 8 + idx_bit;
-    if (cnt == 1)
-    {
-        return bit_idx_start; // Return the index of the first free bit
-    }
+        uint32_t used = word_idx < whole_words ? words[word_idx] : bitmap_word(btmp, word_idx);
+        uint32_t word_start = word_idx * BITMAP_WORD_BITS;
+        word_idx++;
 
-    uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start);
-    uint32_t next_bit = bit_idx_start + 1;
-    uint32_t count = 1;
+        if (used == 0)
+        {
+            if (run == 0)
+            {
+                run_start = word_start;
+            }
+            run += BITMAP_WORD_BITS;
+            if (run >= cnt)
+            {
+                return run_start;
+            }
+            continue;
+        }
+        if (used == BITMAP_WORD_FULL)
+        {
+            run = 0;
+            continue;
+        }
 
-    bit_idx_start = -1; // Reset to indicate no valid start found yet
-    while (bit_left-- > 0)
-    {
-        if (!bitmap_scan_test(btmp, next_bit))
+        /* 低端空闲位接在上一个字的run后面 */
+        uint32_t low_free = bit_first_set(used);
+        if (run == 0)
         {
-            count++;
+            run_start = word_start;
         }
-        else
+        if (run + low_free >= cnt)
         {
-            count = 0; // Reset count if a used bit is found
+            return run_start;
         }
 
-        if (count == cnt)
+        /* 字内空闲段:free中每个1位表示其上连续len位都空闲,移位相与倍增len直到cnt */
+        if (cnt < BITMAP_WORD_BITS)
         {
-            bit_idx_start = next_bit - cnt + 1; // Found a sequence of free bits
-            break;                              // Exit the loop as we found the required sequence
+            uint32_t free = ~used, len = 1;
+            while (len < cnt && free != 0)
+            {
+                uint32_t step = len < cnt - len ? len : cnt - len;
+                free &= free >> step;
+                len += step;
+            }
+            if (free != 0)
+            {
+                return word_start + bit_first_set(free);
+            }
         }
-        next_bit++;
+
+        /* 高端空闲位留给下一个字接续 */
+        uint32_t high_used = bit_last_set(used);
+        run = BITMAP_WORD_BITS - 1 - high_used;
+        run_start = word_start + high_used + 1;
     }
-    return bit_idx_start; // Return the starting index of the free bits or -1 if not found
+    return -1; // No free bits found
 }
 
 void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value)
@@ -85,4 +162,39 @@ void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value)
     {
         btmp->bits[byte_idx] &= ~(BITMAP_MASK << bit_odd); // Clear the bit
     }
-}
\ No newline at end of file
+}
+
+/* 将从bit_idx开始的cnt位都置为value,首尾不足一字的部分逐位处理,中间整字写入 */
+static void bitmap_fill_range(struct bitmap *btmp, uint32_t bit_idx, uint32_t cnt, int8_t value)
+{
+    uint32_t bit_end = bit_idx + cnt;
+    ASSERT(bit_end >= bit_idx && bit_end <= btmp->btmp_bytes_len * 8);
+
+    while (bit_idx < bit_end && bit_idx % BITMAP_WORD_BITS != 0)
+    {
+        bitmap_set(btmp, bit_idx++, value);
+    }
+
+    uint32_t *word = (uint32_t *)btmp->bits + bit_idx / BITMAP_WORD_BITS;
+    uint32_t fill = value ? BITMAP_WORD_FULL : 0;
+    while (bit_idx + BITMAP_WORD_BITS <= bit_end)
+    {
+        *word++ = fill;
+        bit_idx += BITMAP_WORD_BITS;
+    }
+
+    while (bit_idx < bit_end)
+    {
+        bitmap_set(btmp, bit_idx++, value);
+    }
+}
+
+void bitmap_set_range(struct bitmap *btmp, uint32_t bit_idx, uint32_t cnt)
+{
+    bitmap_fill_range(btmp, bit_idx, cnt, 1);
+}
+
+void bitmap_clear_range(struct bitmap *btmp, uint32_t bit_idx, uint32_t cnt)
+{
+    bitmap_fill_range(btmp, bit_idx, cnt, 0);
+}
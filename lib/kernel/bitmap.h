@@ -13,4 +13,6 @@ void bitmap_init(struct bitmap *btmp);
 bool bitmap_scan_test(struct bitmap *btmp, uint32_t bit_idx);
 int bitmap_scan(struct bitmap *btmp, uint32_t cnt);
 void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value);
+void bitmap_set_range(struct bitmap *btmp, uint32_t bit_idx, uint32_t cnt);
+void bitmap_clear_range(struct bitmap *btmp, uint32_t bit_idx, uint32_t cnt);
 #endif
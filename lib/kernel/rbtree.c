@@ -0,0 +1,269 @@
+#include "rbtree.h"
+
+/* 初始化空树 */
+void rb_init(struct rb_root *root)
+{
+    root->node = NULL;
+    root->leftmost = NULL;
+}
+
+/* 判断树是否为空 */
+bool rb_empty(struct rb_root *root)
+{
+    return root->node == NULL;
+}
+
+/* 用new替换old在其父节点(或树根)中的位置 */
+static void rb_replace_child(struct rb_root *root, struct rb_node *old, struct rb_node *new)
+{
+    struct rb_node *parent = old->parent;
+    if (parent == NULL)
+    {
+        root->node = new;
+    }
+    else if (parent->left == old)
+    {
+        parent->left = new;
+    }
+    else
+    {
+        parent->right = new;
+    }
+    if (new != NULL)
+    {
+        new->parent = parent;
+    }
+}
+
+/* 以node为轴左旋,node的右孩子成为子树的根 */
+static void rb_rotate_left(struct rb_root *root, struct rb_node *node)
+{
+    struct rb_node *right = node->right;
+    node->right = right->left;
+    if (right->left != NULL)
+    {
+        right->left->parent = node;
+    }
+    rb_replace_child(root, node, right);
+    right->left = node;
+    node->parent = right;
+}
+
+/* 以node为轴右旋,node的左孩子成为子树的根 */
+static void rb_rotate_right(struct rb_root *root, struct rb_node *node)
+{
+    struct rb_node *left = node->left;
+    node->left = left->right;
+    if (left->right != NULL)
+    {
+        left->right->parent = node;
+    }
+    rb_replace_child(root, node, left);
+    left->right = node;
+    node->parent = left;
+}
+
+#define rb_is_red(node) ((node) != NULL && (node)->color == RB_RED)
+
+/* 按less把node插入树中,与已有节点相等时排在它们之后 */
+void rb_insert(struct rb_root *root, struct rb_node *node, rb_less *less)
+{
+    struct rb_node **link = &root->node, *parent = NULL;
+    bool leftmost = true;
+    while (*link != NULL)
+    {
+        parent = *link;
+        if (less(node, parent))
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+    if (leftmost)
+    {
+        root->leftmost = node;
+    }
+
+    /* 自下而上消除连续的红节点 */
+    while (rb_is_red(node->parent))
+    {
+        parent = node->parent;
+        struct rb_node *grand = parent->parent; // 父节点是红的,必不是根,祖父节点存在
+        struct rb_node *uncle = parent == grand->left ? grand->right : grand->left;
+        if (rb_is_red(uncle))
+        { // 叔节点也是红的,把黑色从祖父节点下推一层,问题上移到祖父节点
+            parent->color = uncle->color = RB_BLACK;
+            grand->color = RB_RED;
+            node = grand;
+            continue;
+        }
+        if (parent == grand->left)
+        {
+            if (node == parent->right)
+            { // 先转成同侧
+                rb_rotate_left(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            rb_rotate_right(root, grand);
+        }
+        else
+        {
+            if (node == parent->left)
+            {
+                rb_rotate_right(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+            rb_rotate_left(root, grand);
+        }
+        parent->color = RB_BLACK;
+        grand->color = RB_RED;
+        break;
+    }
+    root->node->color = RB_BLACK;
+}
+
+/* 返回中序遍历中node的后继,node是最大节点时返回NULL */
+struct rb_node *rb_next(struct rb_node *node)
+{
+    if (node->right != NULL)
+    {
+        node = node->right;
+        while (node->left != NULL)
+        {
+            node = node->left;
+        }
+        return node;
+    }
+    while (node->parent != NULL && node == node->parent->right)
+    {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/* 把node从树中删除 */
+void rb_erase(struct rb_root *root, struct rb_node *node)
+{
+    if (root->leftmost == node)
+    {
+        root->leftmost = rb_next(node);
+    }
+
+    /* child顶替被摘下的位置,parent是其父节点.child可能为NULL,所以单独记parent */
+    struct rb_node *child, *parent;
+    uint8_t removed_color;
+    if (node->left == NULL || node->right == NULL)
+    {
+        child = node->left != NULL ? node->left : node->right;
+        parent = node->parent;
+        removed_color = node->color;
+        rb_replace_child(root, node, child);
+    }
+    else
+    { // 有两个孩子时用后继succ(右子树的最小节点)顶替node,实际摘下的是succ原来的位置
+        struct rb_node *succ = node->right;
+        while (succ->left != NULL)
+        {
+            succ = succ->left;
+        }
+        child = succ->right;
+        removed_color = succ->color;
+        if (succ->parent == node)
+        {
+            parent = succ;
+        }
+        else
+        {
+            parent = succ->parent;
+            rb_replace_child(root, succ, child);
+            succ->right = node->right;
+            succ->right->parent = succ;
+        }
+        rb_replace_child(root, node, succ);
+        succ->left = node->left;
+        succ->left->parent = succ;
+        succ->color = node->color;
+    }
+    if (removed_color == RB_RED)
+    {
+        return;
+    }
+
+    /* 摘下的是黑节点,child所在的一侧少了一个黑节点,自下而上补上 */
+    while (child != root->node && !rb_is_red(child))
+    {
+        if (child == parent->left)
+        {
+            struct rb_node *sibling = parent->right;
+            if (rb_is_red(sibling))
+            {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(root, parent);
+                sibling = parent->right;
+            }
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right))
+            {
+                sibling->color = RB_RED;
+                child = parent;
+                parent = child->parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->right))
+            {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rb_rotate_left(root, parent);
+        }
+        else
+        {
+            struct rb_node *sibling = parent->left;
+            if (rb_is_red(sibling))
+            {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(root, parent);
+                sibling = parent->left;
+            }
+            if (!rb_is_red(sibling->left) && !rb_is_red(sibling->right))
+            {
+                sibling->color = RB_RED;
+                child = parent;
+                parent = child->parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->left))
+            {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rb_rotate_right(root, parent);
+        }
+        child = root->node;
+    }
+    if (child != NULL)
+    {
+        child->color = RB_BLACK;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+#include "../../kernel/global.h"
+#include "../stdint.h"
+
+/* 侵入式红黑树的节点,嵌在宿主结构中,用elem2entry取回宿主 */
+struct rb_node
+{
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    uint8_t color; // RB_RED或RB_BLACK
+};
+
+/* 树根,另缓存最左(最小)的节点,取最小节点为O(1) */
+struct rb_root
+{
+    struct rb_node *node;
+    struct rb_node *leftmost;
+};
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+/* 比较函数,a应排在b之前时返回true */
+typedef bool(rb_less)(struct rb_node *a, struct rb_node *b);
+
+void rb_init(struct rb_root *root);
+void rb_insert(struct rb_root *root, struct rb_node *node, rb_less *less);
+void rb_erase(struct rb_root *root, struct rb_node *node);
+struct rb_node *rb_next(struct rb_node *node);
+bool rb_empty(struct rb_root *root);
+#endif
@@ -0,0 +1,354 @@
+#include "malloc.h"
+#include "syscall.h"
+#include "../string.h"
+#include "../../kernel/global.h"
+
+/***************************  用户态堆分配器  ***************************
+ * 堆是brk之下的一段连续内存,切成一个个首尾相接的块,每块前有8字节的块头.
+ * 空闲块按大小挂在各档的链表上:小于SMALL_LIMIT的块每8字节一档,只放同样大小的块;
+ * 更大的块每档覆盖[2^k, 2^(k+1)).释放时与前后相邻的空闲块合并,
+ * 堆末尾的空闲部分是top块,不挂在任何档上,不够时用sbrk扩展.
+ * 小块的申请和释放都在用户态完成,不必陷入内核.不小于LARGE_SIZE的申请直接向内核按页申请.
+ * 分配器的状态在全局变量中,每个由exec加载的程序各有一份;
+ * 内核中创建的用户进程共用内核映像的数据,它们之间不能共用此分配器
+ ************************************************************************/
+
+#define ALIGN 8              // 交给用户的地址按8字节对齐
+#define CHUNK_HDR 8          // 块头大小,即prev_size和size
+#define MIN_CHUNK 16         // 最小的块要能放下空闲链表的两个指针
+#define INUSE 1              // size的最低位,块已分配
+#define LARGE 2              // size的次低位,块由内核按页分配
+#define SMALL_LIMIT 512      // 小于此大小的块按8字节精确分档
+#define SMALL_BINS (SMALL_LIMIT / ALIGN)
+#define NBINS (SMALL_BINS + 24)
+#define HEAP_GROW 0x10000    // 堆不够时至少扩展64K,减少sbrk次数
+#define HEAP_TRIM 0x40000    // top块超过256K时把多出HEAP_GROW的整页还给内核
+#define LARGE_SIZE 0x20000   // 不小于128K的申请不占用堆
+#define PAGE_SIZE 4096
+
+/* 块头.prev_size总是有效,释放时据此找到物理上的前一块 */
+struct chunk
+{
+    uint32_t prev_size; // 物理上前一块的大小,为0表示本块是堆中的第一块
+    uint32_t size;      // 本块大小(含块头),低两位是INUSE和LARGE
+    /* 以下两项仅空闲块有,已分配的块中这里是用户数据 */
+    struct chunk *next;
+    struct chunk *prev;
+};
+
+static struct chunk *bins[NBINS];           // 各档空闲块链表
+static uint32_t binmap[(NBINS + 31) / 32]; // 各档是否非空的位图,用于跳过空档
+static struct chunk *top;                   // 堆末尾的空闲块,其结尾即堆顶
+
+#define chunk_size(c) ((c)->size & ~(INUSE | LARGE))
+#define chunk2mem(c) ((void *)((uint8_t *)(c) + CHUNK_HDR))
+#define mem2chunk(p) ((struct chunk *)((uint8_t *)(p) - CHUNK_HDR))
+#define next_chunk(c) ((struct chunk *)((uint8_t *)(c) + chunk_size(c)))
+#define prev_chunk(c) ((struct chunk *)((uint8_t *)(c) - (c)->prev_size))
+
+/* 返回大小为size的块所属的档 */
+static uint32_t bin_index(uint32_t size)
+{
+    if (size < SMALL_LIMIT)
+    {
+        return size / ALIGN;
+    }
+    /* 512对应SMALL_BINS,之后每翻一倍一档 */
+    return SMALL_BINS + (31 - __builtin_clz(size)) - 9;
+}
+
+/* 把空闲块c挂到所属档的链表头 */
+static void bin_insert(struct chunk *c)
+{
+    uint32_t idx = bin_index(chunk_size(c));
+    c->prev = NULL;
+    c->next = bins[idx];
+    if (c->next != NULL)
+    {
+        c->next->prev = c;
+    }
+    bins[idx] = c;
+    binmap[idx / 32] |= 1 << (idx % 32);
+}
+
+/* 把空闲块c从所属档的链表中摘下 */
+static void bin_remove(struct chunk *c)
+{
+    uint32_t idx = bin_index(chunk_size(c));
+    if (c->prev != NULL)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        bins[idx] = c->next;
+        if (bins[idx] == NULL)
+        {
+            binmap[idx / 32] &= ~(1 << (idx % 32));
+        }
+    }
+    if (c->next != NULL)
+    {
+        c->next->prev = c->prev;
+    }
+}
+
+/* 找一个不小于need的空闲块并摘下,没有则返回NULL.
+ * 小块的本档正好都是need大小;大块的本档要逐个比较,更高的档中任一块都够大 */
+static struct chunk *bin_take(uint32_t need)
+{
+    uint32_t idx = bin_index(need);
+    struct chunk *c = NULL;
+    if (idx >= SMALL_BINS)
+    {
+        c = bins[idx];
+        while (c != NULL && chunk_size(c) < need)
+        {
+            c = c->next;
+        }
+        idx++;
+    }
+    while (c == NULL && idx < NBINS)
+    {
+        uint32_t word = binmap[idx / 32] & (~0u << (idx % 32));
+        if (word != 0)
+        {
+            c = bins[idx / 32 * 32 + __builtin_ctz(word)];
+        }
+        else
+        {
+            idx = (idx / 32 + 1) * 32;
+        }
+    }
+    if (c != NULL)
+    {
+        bin_remove(c);
+    }
+    return c;
+}
+
+/* 扩展堆使top块至少再多出bytes字节,堆还没建立时先建立.失败返回false */
+static bool heap_grow(uint32_t bytes)
+{
+    uint32_t incr = bytes > HEAP_GROW ? bytes : HEAP_GROW;
+    incr = (incr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint8_t *old_brk = sbrk(incr);
+    if (old_brk == (void *)-1)
+    {
+        return false;
+    }
+    if (top == NULL)
+    { // 堆起始地址按页对齐,第一块就是top
+        top = (struct chunk *)old_brk;
+        top->prev_size = 0;
+        top->size = incr;
+        return true;
+    }
+    /* 堆顶只由本分配器移动,新内存正好接在top之后 */
+    if (old_brk != (uint8_t *)next_chunk(top))
+    {
+        sbrk(-(int32_t)incr);
+        return false;
+    }
+    top->size += incr;
+    return true;
+}
+
+/* top块超过HEAP_TRIM时把多余的整页还给内核 */
+static void heap_trim(void)
+{
+    if (top->size <= HEAP_TRIM)
+    {
+        return;
+    }
+    uint32_t release = (top->size - HEAP_GROW) & ~(PAGE_SIZE - 1);
+    if (sbrk(-(int32_t)release) != (void *)-1)
+    {
+        top->size -= release;
+    }
+}
+
+/* 把已分配的块c截成need字节,多出的部分不小于MIN_CHUNK时作为空闲块挂到档上.
+ * c不能是top,且其后一块不是空闲块 */
+static void chunk_split(struct chunk *c, uint32_t need)
+{
+    uint32_t size = chunk_size(c);
+    if (size - need < MIN_CHUNK)
+    {
+        return;
+    }
+    struct chunk *rest = (struct chunk *)((uint8_t *)c + need);
+    c->size = need | INUSE;
+    rest->prev_size = need;
+    rest->size = size - need;
+    next_chunk(rest)->prev_size = rest->size;
+    bin_insert(rest);
+}
+
+/* 申请size字节的内存,内容未初始化.size为0或内存不足时返回NULL */
+void *malloc(uint32_t size)
+{
+    if (size == 0 || size > 0xc0000000)
+    {
+        return NULL;
+    }
+    uint32_t need = (size + CHUNK_HDR + ALIGN - 1) & ~(ALIGN - 1);
+    if (need < MIN_CHUNK)
+    {
+        need = MIN_CHUNK;
+    }
+
+    /* 大块向内核按页申请,块头只用来在释放时识别 */
+    if (need >= LARGE_SIZE)
+    {
+        struct chunk *c = malloc_pages(need);
+        if (c == NULL)
+        {
+            return NULL;
+        }
+        c->prev_size = 0;
+        c->size = need | INUSE | LARGE;
+        return chunk2mem(c);
+    }
+
+    struct chunk *c = bin_take(need);
+    if (c != NULL)
+    {
+        c->size |= INUSE;
+        chunk_split(c, need);
+        return chunk2mem(c);
+    }
+
+    /* 从top块切,切完top至少还要留下一个块头的位置 */
+    if ((top == NULL || top->size < need + MIN_CHUNK) &&
+        !heap_grow(need + MIN_CHUNK - (top == NULL ? 0 : top->size)))
+    {
+        return NULL;
+    }
+    c = top;
+    top = (struct chunk *)((uint8_t *)c + need);
+    top->prev_size = need;
+    top->size = c->size - need;
+    c->size = need | INUSE;
+    return chunk2mem(c);
+}
+
+/* 释放ptr指向的内存,与相邻的空闲块合并 */
+void free(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+    struct chunk *c = mem2chunk(ptr);
+    if (c->size & LARGE)
+    {
+        free_pages(c);
+        return;
+    }
+
+    uint32_t size = chunk_size(c);
+    struct chunk *next = next_chunk(c);
+    if (c->prev_size != 0 && !(prev_chunk(c)->size & INUSE))
+    {
+        struct chunk *prev = prev_chunk(c);
+        bin_remove(prev);
+        size += prev->size;
+        c = prev;
+    }
+    if (next == top)
+    { // 并入top块
+        c->size = size + top->size;
+        top = c;
+        heap_trim();
+        return;
+    }
+    if (!(next->size & INUSE))
+    {
+        bin_remove(next);
+        size += next->size;
+    }
+    c->size = size;
+    next_chunk(c)->prev_size = size;
+    bin_insert(c);
+}
+
+/* 把ptr指向的内存调整为size字节,原有内容保留.能在原地伸缩时不复制.
+ * ptr为NULL时同malloc,size为0时同free并返回NULL;失败时返回NULL,原内存不变 */
+void *realloc(void *ptr, uint32_t size)
+{
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+    if (size > 0xc0000000)
+    {
+        return NULL;
+    }
+    struct chunk *c = mem2chunk(ptr);
+    uint32_t need = (size + CHUNK_HDR + ALIGN - 1) & ~(ALIGN - 1), cur = chunk_size(c);
+    if (need < MIN_CHUNK)
+    {
+        need = MIN_CHUNK;
+    }
+
+    if (!(c->size & LARGE))
+    {
+        struct chunk *next = next_chunk(c);
+        if (next == top && need < LARGE_SIZE)
+        { // 紧挨着top,从top中借或还给top
+            if (cur + top->size < need + MIN_CHUNK &&
+                !heap_grow(need + MIN_CHUNK - cur - top->size))
+            {
+                goto move;
+            }
+            uint32_t top_end = cur + top->size;
+            top = (struct chunk *)((uint8_t *)c + need);
+            top->prev_size = need;
+            top->size = top_end - need;
+            c->size = need | INUSE;
+            return ptr;
+        }
+        if (need <= cur)
+        { // 缩小,多出的部分经free与后面的空闲块合并
+            if (cur - need >= MIN_CHUNK)
+            {
+                struct chunk *rest = (struct chunk *)((uint8_t *)c + need);
+                c->size = need | INUSE;
+                rest->prev_size = need;
+                rest->size = (cur - need) | INUSE;
+                next->prev_size = cur - need;
+                free(chunk2mem(rest));
+            }
+            return ptr;
+        }
+        if (next != top && !(next->size & INUSE) && cur + next->size >= need)
+        { // 吞并后面的空闲块
+            bin_remove(next);
+            cur += next->size;
+            c->size = cur | INUSE;
+            next_chunk(c)->prev_size = cur;
+            chunk_split(c, need);
+            return ptr;
+        }
+    }
+    else if (need <= cur)
+    {
+        return ptr;
+    }
+
+move:;
+    void *new = malloc(size);
+    if (new == NULL)
+    {
+        return NULL;
+    }
+    memcpy(new, ptr, (cur < need ? cur : need) - CHUNK_HDR);
+    free(ptr);
+    return new;
+}
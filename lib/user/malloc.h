@@ -0,0 +1,10 @@
+#ifndef __LIB_USER_MALLOC_H
+#define __LIB_USER_MALLOC_H
+
+#include "../stdint.h"
+
+void *malloc(uint32_t size);
+void free(void *ptr);
+void *realloc(void *ptr, uint32_t size);
+
+#endif
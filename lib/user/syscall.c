@@ -60,12 +60,14 @@ uint32_t write(int32_t fd, const void *buf, uint32_t count)
     return _syscall3(SYS_WRITE, fd, buf, count);
 }
 
-void *malloc(uint32_t size)
+/* 由内核按页分配size字节的内存,malloc用它满足大块申请 */
+void *malloc_pages(uint32_t size)
 {
     return (void *)_syscall1(SYS_MALLOC, size);
 }
 
-void free(void *ptr)
+/* 释放malloc_pages申请的内存 */
+void free_pages(void *ptr)
 {
     _syscall1(SYS_FREE, ptr);
 }
@@ -177,4 +179,79 @@ void ps(void)
 int execv(const char *pathname, char **argv)
 {
     return _syscall2(SYS_EXECV, pathname, argv);
-}
\ No newline at end of file
+}
+
+/* 显示物理内存使用情况 */
+void meminfo(void)
+{
+    _syscall0(SYS_MEMINFO);
+}
+/* 把堆顶设为addr,成功返回0,失败返回-1 */
+int32_t brk(void *addr)
+{
+    return (uint32_t)_syscall1(SYS_BRK, addr) == (uint32_t)addr ? 0 : -1;
+}
+
+/* 把堆顶移动increment字节,成功返回原来的堆顶,失败返回(void *)-1.
+ * 堆顶每次都向内核查询,不在用户态缓存 */
+void *sbrk(int32_t increment)
+{
+    uint32_t old_brk = _syscall1(SYS_BRK, 0);
+    if (increment == 0)
+    {
+        return (void *)old_brk;
+    }
+    uint32_t new_brk = old_brk + increment;
+    if ((uint32_t)_syscall1(SYS_BRK, new_brk) != new_brk)
+    {
+        return (void *)-1;
+    }
+    return (void *)old_brk;
+}
+
+/* 把文件fd中从offset起的length字节或匿名内存映射到进程空间,成功返回映射的起始地址,失败返回NULL.
+ * 映射的页在首次访问时才读入或清0 */
+void *mmap(void *addr, uint32_t length, uint8_t prot, uint8_t flags, int32_t fd, uint32_t offset)
+{
+    struct mmap_args args = {addr, length, prot, flags, fd, offset};
+    return (void *)_syscall1(SYS_MMAP, &args);
+}
+
+/* 解除[addr, addr + length)内的映射,成功返回0,失败返回-1 */
+int32_t munmap(void *addr, uint32_t length)
+{
+    return _syscall2(SYS_MUNMAP, addr, length);
+}
+
+/* 把当前进程的nice值加上increment,返回新的nice值.nice值越小,分得的cpu时间越多 */
+int32_t nice(int32_t increment)
+{
+    return _syscall1(SYS_NICE, increment);
+}
+
+/* 把pid为pid的进程(pid为0时是当前进程)的nice值设为nice,成功返回0,失败返回-1 */
+int32_t setpriority(int16_t pid, int32_t nice)
+{
+    return _syscall2(SYS_SETPRIORITY, pid, nice);
+}
+
+/* 把pid为pid的进程(pid为0时是当前进程)的调度策略设为policy,实时策略的优先级为priority.
+ * 成功返回0,失败返回-1 */
+int32_t sched_setscheduler(int16_t pid, uint8_t policy, uint8_t priority)
+{
+    return _syscall3(SYS_SCHED_SETSCHEDULER, pid, policy, priority);
+}
+
+/* 睡眠req指定的时间,睡眠期间不占用cpu.精度为一个时钟嘀嗒.成功返回0,参数不对返回-1 */
+int32_t nanosleep(const struct timespec *req)
+{
+    return _syscall1(SYS_NANOSLEEP, req);
+}
+
+/* 睡眠seconds秒,返回0 */
+uint32_t sleep(uint32_t seconds)
+{
+    struct timespec req = {seconds, 0};
+    nanosleep(&req);
+    return 0;
+}
@@ -31,12 +31,52 @@ enum SYSCALL_NR
     SYS_STAT,
     SYS_PS,
     SYS_EXECV,
+    SYS_MEMINFO,
+    SYS_BRK,
+    SYS_MMAP,
+    SYS_MUNMAP,
+    SYS_NICE,
+    SYS_SETPRIORITY,
+    SYS_SCHED_SETSCHEDULER,
+    SYS_NANOSLEEP,
+};
+
+/* mmap的访问权限,与区域的VM_READ、VM_WRITE、VM_EXEC取值相同 */
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define PROT_EXEC 4
+
+/* mmap的映射方式.文件映射都是私有的,写入不会写回文件 */
+#define MAP_ANON 1 // 匿名映射,忽略fd和offset
+
+/* 调度策略.SCHED_FIFO和SCHED_RR属于实时类,总是先于SCHED_NORMAL的任务运行 */
+#define SCHED_NORMAL 0 // 公平调度,按nice值分配cpu时间
+#define SCHED_FIFO 1   // 实时,同优先级先到先运行,直到阻塞或让出
+#define SCHED_RR 2     // 实时,同优先级轮流运行,每次最多一个时间片
+#define RT_PRIO_MAX 31 // 实时优先级为1~RT_PRIO_MAX,越大越优先
+
+/* nanosleep的睡眠时长 */
+struct timespec
+{
+    uint32_t tv_sec;  // 秒
+    uint32_t tv_nsec; // 纳秒,须小于10^9
+};
+
+/* mmap的参数超过了系统调用能用寄存器传递的3个,打包后传地址 */
+struct mmap_args
+{
+    void *addr;      // 期望的起始地址,为NULL或已被占用时由内核选择
+    uint32_t length; // 映射的字节数,向上取整到页
+    uint8_t prot;    // PROT_READ、PROT_WRITE、PROT_EXEC的组合
+    uint8_t flags;   // MAP_ANON或0
+    int32_t fd;      // 被映射文件的文件描述符
+    uint32_t offset; // 文件中的起始偏移,须按页对齐
 };
 
 uint32_t getpid(void);
 uint32_t write(int32_t fd, const void *buf, uint32_t count);
-void *malloc(uint32_t size);
-void free(void *ptr);
+void *malloc_pages(uint32_t size);
+void free_pages(void *ptr);
 int16_t fork(void);
 int32_t read(int32_t fd, void *buf, uint32_t count);
 void putchar(char char_asci);
@@ -56,5 +96,15 @@ int32_t stat(const char *path, struct stat *buf);
 int32_t chdir(const char *path);
 void ps(void);
 int execv(const char *pathname, char **argv);
+void meminfo(void);
+int32_t brk(void *addr);
+void *sbrk(int32_t increment);
+void *mmap(void *addr, uint32_t length, uint8_t prot, uint8_t flags, int32_t fd, uint32_t offset);
+int32_t munmap(void *addr, uint32_t length);
+int32_t nice(int32_t increment);
+int32_t setpriority(int16_t pid, int32_t nice);
+int32_t sched_setscheduler(int16_t pid, uint8_t policy, uint8_t priority);
+int32_t nanosleep(const struct timespec *req);
+uint32_t sleep(uint32_t seconds);
 
 #endif
\ No newline at end of file
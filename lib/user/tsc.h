@@ -0,0 +1,13 @@
+#ifndef __LIB_USER_TSC_H
+#define __LIB_USER_TSC_H
+#include "../stdint.h"
+
+/* 读取时间戳计数器 */
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#endif
@@ -278,6 +278,17 @@ void buildin_clear(uint32_t argc, char **argv UNUSED)
     clear();
 }
 
+/* meminfo命令内建函数 */
+void buildin_meminfo(uint32_t argc, char **argv UNUSED)
+{
+    if (argc != 1)
+    {
+        printf("meminfo: no argument support!\n");
+        return;
+    }
+    meminfo();
+}
+
 /* mkdir命令内建函数 */
 int32_t buildin_mkdir(uint32_t argc, char **argv)
 {
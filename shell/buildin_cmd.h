@@ -11,5 +11,6 @@ int32_t buildin_rm(uint32_t argc, char **argv);
 void buildin_pwd(uint32_t argc, char **argv);
 void buildin_ps(uint32_t argc, char **argv);
 void buildin_clear(uint32_t argc, char **argv);
+void buildin_meminfo(uint32_t argc, char **argv);
 
 #endif
\ No newline at end of file
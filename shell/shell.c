@@ -185,15 +185,22 @@ void my_shell(void)
         {
             buildin_rm(argc, argv);
         }
+        else if (!strcmp("meminfo", argv[0]))
+        {
+            buildin_meminfo(argc, argv);
+        }
         else
         { // 如果是外部命令,需要从磁盘上加载
             int32_t pid = fork();
             if (pid)
             { // 父进程
                 /* 下面这个while必须要加上,否则父进程一般情况下会比子进程先执行,
-                因此会进行下一轮循环将findl_path清空,这样子进程将无法从final_path中获得参数*/
+                因此会进行下一轮循环将findl_path清空,这样子进程将无法从final_path中获得参数.
+                shell是实时任务,忙等会使子进程永远得不到cpu,没有wait只能睡眠让出cpu */
                 while (1)
-                    ;
+                {
+                    sleep(3600);
+                }
             }
             else
             { // 子进程
@@ -211,7 +218,9 @@ void my_shell(void)
                     execv(argv[0], argv);
                 }
                 while (1)
-                    ;
+                { // 没有exit,执行失败的子进程睡眠而不是忙等
+                    sleep(3600);
+                }
             }
         }
         int32_t arg_idx = 0;
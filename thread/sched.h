@@ -0,0 +1,43 @@
+#ifndef __THREAD_SCHED_H
+#define __THREAD_SCHED_H
+#include "../lib/stdint.h"
+#include "../kernel/global.h"
+
+struct task_struct;
+
+/* enqueue的flags,说明任务为何进入就绪队列 */
+#define ENQUEUE_WAKEUP 1 // 阻塞后被唤醒
+#define ENQUEUE_NEW 2    // 新建的任务第一次就绪
+#define ENQUEUE_YIELD 4  // 主动让出cpu
+
+/***************************  调度类  ***************************
+ * 每个任务属于一个调度类,由调度类管理它在就绪队列中的位置.
+ * 各调度类按优先级由next串成链,schedule从最高的调度类起依次询问,
+ * 第一个返回任务的调度类胜出.所有操作都在关中断时调用
+ ****************************************************************/
+struct sched_class
+{
+    const struct sched_class *next; // 下一个(更低优先级的)调度类
+
+    /* 把就绪的任务加入本类的就绪队列 */
+    void (*enqueue)(struct task_struct *pthread, uint8_t flags);
+    /* 把任务从本类的就绪队列中摘下,任务必须在队列中 */
+    void (*dequeue)(struct task_struct *pthread);
+    /* 从就绪队列中取出下一个该运行的任务,没有返回NULL */
+    struct task_struct *(*pick_next)(void);
+    /* 时钟中断中为正在运行的cur记账,返回true表示应当重新调度 */
+    bool (*tick)(struct task_struct *cur);
+    /* 被唤醒的woken与正在运行的cur同属本类时,返回true表示woken应立即抢占cur */
+    bool (*check_preempt)(struct task_struct *cur, struct task_struct *woken);
+};
+
+extern const struct sched_class rt_sched_class;
+extern const struct sched_class fair_sched_class;
+extern const struct sched_class idle_sched_class;
+
+#define sched_class_highest (&rt_sched_class)
+
+void sched_rt_init(void);
+void sched_fair_init(void);
+
+#endif
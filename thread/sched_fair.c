@@ -0,0 +1,171 @@
+#include "sched.h"
+#include "thread.h"
+#include "../lib/stdint.h"
+#include "../lib/kernel/rbtree.h"
+#include "../kernel/global.h"
+#include "../kernel/debug.h"
+
+/***************************  公平调度类  ***************************
+ * 每个任务有一个虚拟运行时间vruntime,运行一个嘀嗒增加的量与任务的权重成反比,
+ * 就绪的任务按vruntime排在红黑树中,总是挑vruntime最小的任务运行.
+ * 于是长期来看各任务得到的cpu时间与权重成正比,nice每差1,权重约差1.25倍.
+ * 正在运行的任务不在树中,schedule把它放回树后再挑下一个
+ *******************************************************************/
+
+#define NICE_0_WEIGHT 1024
+#define NICE_0_DELTA (NICE_0_WEIGHT << 10)       // nice为0的任务每个嘀嗒增加的vruntime
+#define SCHED_LATENCY 6                         // 调度周期的嘀嗒数,周期内每个就绪任务都应运行一次
+#define WAKEUP_GRAN NICE_0_DELTA                // 正在运行的任务领先最左任务超过此值时被抢占
+#define SLEEPER_CREDIT (SCHED_LATENCY / 2 * NICE_0_DELTA) // 被唤醒的任务最多比min_vruntime少这么多
+
+/* nice值-20~19对应的权重,相邻两档约差1.25倍,nice为0时是1024 */
+static const uint32_t prio_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548, 7620, 6100, 4904, 3906,
+    /*  -5 */ 3121, 2501, 1991, 1586, 1277,
+    /*   0 */ 1024, 820, 655, 526, 423,
+    /*   5 */ 335, 272, 215, 172, 137,
+    /*  10 */ 110, 87, 70, 56, 45,
+    /*  15 */ 36, 29, 23, 18, 15,
+};
+
+static struct rb_root timeline; // 就绪任务按vruntime排序的红黑树
+static uint32_t nr_queued;      // 树中的任务数
+static uint32_t queued_weight;  // 树中任务的权重之和
+static uint64_t min_vruntime;   // 只增不减,新建和被唤醒的任务以它为基准安放
+
+#define run_node2task(node) elem2entry(struct task_struct, run_node, node)
+
+/* vruntime的比较.vruntime只增不减,用差值的符号比较,即使回绕也不会出错 */
+#define vruntime_before(a, b) ((int64_t)((a) - (b)) < 0)
+
+static uint32_t task_weight(struct task_struct *pthread)
+{
+    return prio_to_weight[pthread->nice - NICE_MIN];
+}
+
+static bool vruntime_less(struct rb_node *a, struct rb_node *b)
+{
+    struct task_struct *ta = run_node2task(a);
+    struct task_struct *tb = run_node2task(b);
+    return vruntime_before(ta->vruntime, tb->vruntime);
+}
+
+/* 树中vruntime最小的任务,树空时返回NULL */
+static struct task_struct *leftmost_task(void)
+{
+    if (timeline.leftmost == NULL)
+    {
+        return NULL;
+    }
+    return run_node2task(timeline.leftmost);
+}
+
+/* 把min_vruntime推进到cur(正在运行的公平任务,可为NULL)与最左任务中较小的vruntime,但不后退 */
+static void update_min_vruntime(struct task_struct *cur)
+{
+    struct task_struct *left = leftmost_task();
+    uint64_t vruntime;
+    if (cur != NULL && (left == NULL || vruntime_before(cur->vruntime, left->vruntime)))
+    {
+        vruntime = cur->vruntime;
+    }
+    else if (left != NULL)
+    {
+        vruntime = left->vruntime;
+    }
+    else
+    {
+        return;
+    }
+    if (vruntime_before(min_vruntime, vruntime))
+    {
+        min_vruntime = vruntime;
+    }
+}
+
+static void enqueue_fair(struct task_struct *pthread, uint8_t flags)
+{
+    /* 睡眠期间或属于实时类期间vruntime不增长,再入队时最多只补偿SLEEPER_CREDIT,
+     * 不能凭落后的vruntime独占cpu */
+    uint64_t floor = min_vruntime - SLEEPER_CREDIT;
+    if (flags & ENQUEUE_NEW)
+    { // 新任务从当前的min_vruntime开始,不能靠0起步压过已有的任务
+        floor = min_vruntime;
+    }
+    else if ((flags & ENQUEUE_YIELD) && leftmost_task() != NULL)
+    { // 主动让出的任务排到最左任务之后
+        floor = leftmost_task()->vruntime;
+    }
+    if (vruntime_before(pthread->vruntime, floor))
+    {
+        pthread->vruntime = floor;
+    }
+    rb_insert(&timeline, &pthread->run_node, vruntime_less);
+    nr_queued++;
+    queued_weight += task_weight(pthread);
+}
+
+static void dequeue_fair(struct task_struct *pthread)
+{
+    ASSERT(nr_queued > 0);
+    rb_erase(&timeline, &pthread->run_node);
+    nr_queued--;
+    queued_weight -= task_weight(pthread);
+}
+
+static struct task_struct *pick_next_fair(void)
+{
+    struct task_struct *next = leftmost_task();
+    if (next != NULL)
+    {
+        dequeue_fair(next);
+        update_min_vruntime(next);
+    }
+    return next;
+}
+
+/* cur运行满本周期中按权重分得的嘀嗒数,或vruntime领先最左任务太多时让出cpu */
+static bool tick_fair(struct task_struct *cur)
+{
+    uint32_t weight = task_weight(cur);
+    cur->vruntime += NICE_0_DELTA / weight;
+    update_min_vruntime(cur);
+
+    struct task_struct *left = leftmost_task();
+    if (left == NULL)
+    {
+        return false;
+    }
+    uint32_t period = nr_queued + 1 > SCHED_LATENCY ? nr_queued + 1 : SCHED_LATENCY;
+    uint32_t slice = period * weight / (queued_weight + weight);
+    if (cur->slice_ticks >= (slice > 0 ? slice : 1))
+    {
+        return true;
+    }
+    return (int64_t)(cur->vruntime - left->vruntime) > WAKEUP_GRAN;
+}
+
+/* 被唤醒的任务落后cur超过WAKEUP_GRAN时抢占,差得不多时等cur用完本次的份额 */
+static bool check_preempt_fair(struct task_struct *cur, struct task_struct *woken)
+{
+    return (int64_t)(cur->vruntime - woken->vruntime) > WAKEUP_GRAN;
+}
+
+const struct sched_class fair_sched_class = {
+    .next = &idle_sched_class,
+    .enqueue = enqueue_fair,
+    .dequeue = dequeue_fair,
+    .pick_next = pick_next_fair,
+    .tick = tick_fair,
+    .check_preempt = check_preempt_fair,
+};
+
+void sched_fair_init(void)
+{
+    rb_init(&timeline);
+    nr_queued = 0;
+    queued_weight = 0;
+    min_vruntime = 0;
+}
@@ -0,0 +1,94 @@
+#include "sched.h"
+#include "thread.h"
+#include "../lib/stdint.h"
+#include "../lib/kernel/list.h"
+#include "../lib/user/syscall.h"
+#include "../kernel/global.h"
+#include "../kernel/debug.h"
+
+/***************************  实时调度类  ***************************
+ * 每个实时优先级一条先进先出的就绪队列,总是运行最高优先级队列的队首任务,
+ * 只要有实时任务就绪,公平类的任务就得不到cpu.
+ * SCHED_FIFO的任务一直运行到阻塞或让出;SCHED_RR的任务用完RR_TIMESLICE后排到本级队尾.
+ * 就绪的实时任务挂在general_tag上,就绪的任务不会同时在信号量的等待队列中
+ *******************************************************************/
+
+#define RR_TIMESLICE 10 // SCHED_RR任务每次最多连续运行的嘀嗒数
+
+static struct list rt_queues[RT_PRIO_MAX + 1]; // 各优先级的就绪队列,0号不用
+static uint32_t rt_bitmap;                     // 第i位为1表示优先级i的就绪队列非空
+
+static void enqueue_rt(struct task_struct *pthread, uint8_t flags)
+{
+    struct list *queue = &rt_queues[pthread->rt_priority];
+    ASSERT(!elem_find(queue, &pthread->general_tag));
+    /* 被更高优先级抢占的任务回到本级队首,下次仍先运行它;其余情况排到队尾 */
+    if (flags == 0 && (pthread->policy == SCHED_FIFO || pthread->slice_ticks < RR_TIMESLICE))
+    {
+        list_push(queue, &pthread->general_tag);
+    }
+    else
+    {
+        list_append(queue, &pthread->general_tag);
+    }
+    rt_bitmap |= 1u << pthread->rt_priority;
+}
+
+static void dequeue_rt(struct task_struct *pthread)
+{
+    list_remove(&pthread->general_tag);
+    if (list_empty(&rt_queues[pthread->rt_priority]))
+    {
+        rt_bitmap &= ~(1u << pthread->rt_priority);
+    }
+}
+
+static struct task_struct *pick_next_rt(void)
+{
+    if (rt_bitmap == 0)
+    {
+        return NULL;
+    }
+    uint8_t prio = 31 - __builtin_clz(rt_bitmap);
+    struct list_elem *elem = list_pop(&rt_queues[prio]);
+    if (list_empty(&rt_queues[prio]))
+    {
+        rt_bitmap &= ~(1u << prio);
+    }
+    return elem2entry(struct task_struct, general_tag, elem);
+}
+
+/* 有更高优先级的实时任务就绪,或SCHED_RR任务用完时间片且本级还有其它任务时让出cpu */
+static bool tick_rt(struct task_struct *cur)
+{
+    if (rt_bitmap & ~((2u << cur->rt_priority) - 1))
+    {
+        return true;
+    }
+    return cur->policy == SCHED_RR && cur->slice_ticks >= RR_TIMESLICE &&
+           !list_empty(&rt_queues[cur->rt_priority]);
+}
+
+static bool check_preempt_rt(struct task_struct *cur, struct task_struct *woken)
+{
+    return woken->rt_priority > cur->rt_priority;
+}
+
+const struct sched_class rt_sched_class = {
+    .next = &fair_sched_class,
+    .enqueue = enqueue_rt,
+    .dequeue = dequeue_rt,
+    .pick_next = pick_next_rt,
+    .tick = tick_rt,
+    .check_preempt = check_preempt_rt,
+};
+
+void sched_rt_init(void)
+{
+    uint8_t prio;
+    for (prio = 0; prio <= RT_PRIO_MAX; prio++)
+    {
+        list_init(&rt_queues[prio]);
+    }
+    rt_bitmap = 0;
+}
@@ -50,6 +50,10 @@ void sema_up(struct semaphore *psema)
 
     psema->value++;              // Increase the semaphore value
     ASSERT(psema->value == 1);   // Ensure semaphore value is positive
+    if (old_status == INTR_ON)
+    { // Let a higher-priority waiter run now; callers that disabled interrupts are in a critical section
+        thread_preempt();
+    }
     intr_set_status(old_status); // Restore previous interrupt status
 }
 
@@ -68,6 +72,19 @@ void lock_acquire(struct lock *plock)
     }
 }
 
+bool lock_try_acquire(struct lock *plock)
+{
+    enum intr_status old_status = intr_disable(); // Check and acquire atomically
+    /* The holder is cleared before sema_up in lock_release, so test the semaphore instead */
+    bool acquired = plock->holder == running_thread() || plock->semaphore.value > 0;
+    if (acquired)
+    {
+        lock_acquire(plock); // Will not block here
+    }
+    intr_set_status(old_status);
+    return acquired;
+}
+
 void lock_release(struct lock *plock)
 {
     ASSERT(plock->holder == running_thread()); // Ensure the current thread holds the lock
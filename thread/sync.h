@@ -23,6 +23,7 @@ void sema_down(struct semaphore *sema);
 void sema_up(struct semaphore *sema);
 void lock_init(struct lock *plock);
 void lock_acquire(struct lock *plock);
+bool lock_try_acquire(struct lock *plock);
 void lock_release(struct lock *plock);
 
 #endif
@@ -10,30 +10,87 @@
 #include "sync.h"
 #include "../fs/file.h"
 #include "../lib/stdio.h"
+#include "../kernel/slab.h"
+#include "sched.h"
+#include "../lib/user/syscall.h"
+#include "../device/timer.h"
 
 #define PG_SIZE 4096
 
 struct task_struct *idle_thread;     // 空闲线程的pcb
 struct task_struct *main_thread;     // 主线程的pcb
-struct list thread_ready_list;       // 就绪线程队列
+static uint32_t nr_ready;            // 各调度类就绪队列中的任务总数,不含空闲线程
+static bool need_resched;            // 被唤醒的任务应抢占当前任务,到下一个抢占点调度
 struct list thread_all_list;         // 所有线程队列
-static struct list_elem *thread_tag; // 用于遍历线程链表的指针
+struct kmem_cache *task_cache;       // pcb的对象缓存,每个pcb独占一页
 
 struct lock pid_lock; // 保护pid的锁,防止pid被多个线程同时修改
 
+/* 任务从被唤醒到被调度上cpu的延迟,按所属调度类分别统计 */
+struct wakeup_latency
+{
+    uint32_t cnt;           // 统计的唤醒次数
+    uint32_t total_kcycles; // 总延迟,以1024个时钟周期为单位
+    uint32_t max_cycles;    // 最大延迟
+};
+static struct wakeup_latency rt_latency, fair_latency;
+
 extern void switch_to(struct task_struct *cur, struct task_struct *next);
 extern void init(void);
 
+/* 空闲线程不进任何就绪队列,其它调度类都没有任务时由空闲调度类选中 */
 static void idle(void *arg UNUSED)
 {
     while (1)
     {
-        thread_block(TASK_BLOCKED); // 空闲线程阻塞,等待调度
-                                    // 执行hlt时必须要保证目前处在开中断的情况下
-        asm volatile("sti; hlt" : : : "memory");
+        /* 没有其它任务可运行时,在后台把空闲页框预先清0,分配时就不必现场清0了 */
+        while (nr_ready == 0 && prezero_free_page())
+            ;
+
+        /* 执行hlt时必须要保证目前处在开中断的情况下.
+         * 关中断后再检查就绪队列,sti要到下一条指令后才生效,hlt之前不会漏掉中断.
+         * halt期间不需要周期时钟,改为在最近的定时器到期时才产生时钟中断 */
+        intr_disable();
+        if (nr_ready == 0)
+        {
+            tick_nohz_idle_enter();
+            asm volatile("sti; hlt" : : : "memory");
+        }
+        else
+        {
+            intr_enable();
+        }
+        thread_yield(); // 中断可能唤醒了任务,让它们运行
     }
 }
 
+static void enqueue_idle(struct task_struct *pthread UNUSED, uint8_t flags UNUSED)
+{
+}
+
+static void dequeue_idle(struct task_struct *pthread UNUSED)
+{
+}
+
+static struct task_struct *pick_next_idle(void)
+{
+    return idle_thread;
+}
+
+/* 空闲线程每个嘀嗒都让出cpu,时钟中断中唤醒的任务最多等一个嘀嗒 */
+static bool tick_idle(struct task_struct *cur UNUSED)
+{
+    return true;
+}
+
+const struct sched_class idle_sched_class = {
+    .next = NULL,
+    .enqueue = enqueue_idle,
+    .dequeue = dequeue_idle,
+    .pick_next = pick_next_idle,
+    .tick = tick_idle,
+};
+
 static pid_t allocate_pid(void)
 {
     static pid_t next_pid = 0; // 下一个可用的pid
@@ -81,8 +138,98 @@ void thread_create(struct task_struct *pthread, thread_func *function, void *fun
     kthread_stack->esi = 0;             // esi初始化为0
 }
 
+/* 读时间戳计数器的低32位,用于统计唤醒延迟 */
+static uint32_t rdtsc32(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo;
+}
+
+/* 把就绪的pthread交给所属调度类的就绪队列.须在关中断时调用 */
+static void enqueue_task(struct task_struct *pthread, uint8_t flags)
+{
+    pthread->sched_class->enqueue(pthread, flags);
+    if (pthread != idle_thread)
+    {
+        nr_ready++;
+    }
+}
+
+/* 把就绪的pthread从所属调度类的就绪队列中摘下.须在关中断时调用 */
+static void dequeue_task(struct task_struct *pthread)
+{
+    pthread->sched_class->dequeue(pthread);
+    if (pthread != idle_thread)
+    {
+        nr_ready--;
+    }
+}
+
+/* 从最高的调度类起挑出下一个运行的任务,它已离开就绪队列 */
+static struct task_struct *pick_next_task(void)
+{
+    const struct sched_class *class = sched_class_highest;
+    while (class != NULL)
+    {
+        struct task_struct *next = class->pick_next();
+        if (next != NULL)
+        {
+            if (next != idle_thread)
+            {
+                nr_ready--;
+            }
+            return next;
+        }
+        class = class->next;
+    }
+    PANIC("pick_next_task: no runnable task");
+    return NULL;
+}
+
+/* 被唤醒的woken是否应立即抢占正在运行的cur:同类时由调度类判断,不同类时高优先级的类抢占 */
+static bool wakeup_preempt(struct task_struct *cur, struct task_struct *woken)
+{
+    if (woken->sched_class == cur->sched_class)
+    {
+        return cur->sched_class->check_preempt(cur, woken);
+    }
+    const struct sched_class *class = sched_class_highest;
+    while (class != cur->sched_class)
+    {
+        if (class == woken->sched_class)
+        {
+            return true;
+        }
+        class = class->next;
+    }
+    return false;
+}
+
+/* 记录next从被唤醒到此刻被调度上cpu的延迟 */
+static void wakeup_latency_account(struct task_struct *next)
+{
+    struct wakeup_latency *lat = next->sched_class == &rt_sched_class ? &rt_latency : &fair_latency;
+    uint32_t cycles = rdtsc32() - next->wakeup_tsc;
+    next->wakeup_tsc = 0;
+    lat->cnt++;
+    lat->total_kcycles += cycles >> 10;
+    if (cycles > lat->max_cycles)
+    {
+        lat->max_cycles = cycles;
+    }
+}
+
+/* 把新建的任务pthread加入就绪队列 */
+void thread_ready(struct task_struct *pthread)
+{
+    enum intr_status old_status = intr_disable();
+    enqueue_task(pthread, ENQUEUE_NEW);
+    intr_set_status(old_status);
+}
+
 /* 初始化线程基本信息 */
-void init_thread(struct task_struct *pthread, char *name, int prio)
+void init_thread(struct task_struct *pthread, char *name, int nice)
 {
     memset(pthread, 0, sizeof(*pthread)); // 清空线程结构体
     pthread->pid = allocate_pid();        // 分配pid
@@ -99,8 +246,12 @@ void init_thread(struct task_struct *pthread, char *name, int prio)
 
     /* self_kstack是线程自己在内核态下使用的栈顶地址 */
     pthread->self_kstack = (uint32_t *)((uint32_t)pthread + PG_SIZE); // 栈顶地址为pcb起始地址加一页大小
-    pthread->priority = prio;                                         // 设置线程优先级
-    pthread->ticks = prio;                                            // 初始化时间片为优先级
+    pthread->nice = nice;                                             // 设置nice值
+    pthread->policy = SCHED_NORMAL;
+    pthread->rt_priority = 0;
+    pthread->sched_class = &fair_sched_class;                         // 普通任务都属于公平调度类
+    pthread->vruntime = 0;                                            // 加入就绪队列时再按min_vruntime安放
+    pthread->slice_ticks = 0;
     pthread->elapsed_ticks = 0;                                       // 已运行时间片数初始化为0
     pthread->pgdir = NULL;                                            // 进程页目录初始化为NULL
 
@@ -120,25 +271,23 @@ void init_thread(struct task_struct *pthread, char *name, int prio)
     pthread->stack_magic = 0x19870916; // 栈边界标记，用于检测栈溢出
 }
 
-/* 创建一优先级为prio的线程,线程名为name,线程所执行的函数是function(func_arg) */
+/* 创建一nice值为nice的线程,线程名为name,线程所执行的函数是function(func_arg) */
 /*
  *  name:线程名
- *  prio:线程优先级
+ *  nice:线程的nice值
  *  function:执行函数
  *  func_arg:函数参数
  * */
 
-struct task_struct *thread_start(char *name, int prio, thread_func *function, void *func_arg)
+struct task_struct *thread_start(char *name, int nice, thread_func *function, void *func_arg)
 {
-    struct task_struct *thread = get_kernel_pages(1); // 分配一页内存作为线程的pcb
-    init_thread(thread, name, prio);                  // 初始化线程基本信息
+    struct task_struct *thread = kmem_cache_alloc(task_cache); // 分配一页内存作为线程的pcb
+    init_thread(thread, name, nice);                  // 初始化线程基本信息
 
     /* 创建线程栈 */
     thread_create(thread, function, func_arg);
 
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-
-    list_append(&thread_ready_list, &thread->general_tag); // 将线程添加到就绪队列
+    thread_ready(thread); // 将线程添加到就绪队列
 
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
 
@@ -156,9 +305,9 @@ struct task_struct *thread_start(char *name, int prio, thread_func *function, vo
 static void make_main_thread(void)
 {
     main_thread = running_thread();       // 获取当前线程pcb
-    init_thread(main_thread, "main", 31); // 初始化主线程
+    init_thread(main_thread, "main", 0); // 初始化主线程
 
-    /* main函数是当前线程,当前线程不在thread_ready_list中,
+    /* main函数是当前线程,当前线程不在就绪队列中,
      * 所以只将其加在thread_all_list中. */
     ASSERT(!elem_find(&thread_all_list, &main_thread->all_list_tag));
     list_append(&thread_all_list, &main_thread->all_list_tag);
@@ -169,12 +318,16 @@ void schedule(void)
     ASSERT(intr_get_status() == INTR_OFF);      // 确保在关中断状态下调用调度函数
     struct task_struct *cur = running_thread(); // 获取当前线程pcb
 
+    if (cur == idle_thread)
+    { // 空闲时可能停掉了周期时钟,其它任务运行前恢复,它们需要按嘀嗒记账和抢占
+        tick_nohz_idle_exit();
+    }
+
     if (cur->status == TASK_RUNNING) // 如果当前线程是运行中状态
     {
-        ASSERT(!elem_find(&thread_ready_list, &cur->general_tag)); // 确保当前线程不在就绪队列中
-        list_append(&thread_ready_list, &cur->general_tag);        // 将当前线程添加到就绪队列
+        /* 被抢占的任务放回所属调度类的就绪队列,由调度类决定它排在哪里 */
         cur->status = TASK_READY;
-        cur->ticks = cur->priority; // 则将其状态改为就绪
+        enqueue_task(cur, 0);
     }
     else
     {
@@ -182,21 +335,20 @@ void schedule(void)
       不需要将其加入队列,因为当前线程不在就绪队列中。*/
     }
 
-    /* 如果就绪队列中没有可运行的任务,就唤醒idle */
-    if (list_empty(&thread_ready_list))
+    struct task_struct *next = pick_next_task(); // 没有其它任务时挑中的是idle
+    next->status = TASK_RUNNING;
+    next->slice_ticks = 0;
+    need_resched = false;
+    if (next->wakeup_tsc != 0)
     {
-        thread_unblock(idle_thread);
+        wakeup_latency_account(next);
     }
-
-    ASSERT(!list_empty(&thread_ready_list)); // 确保就绪队列不为空
-    thread_tag = NULL;                       // 清空遍历指针
-
-    /* 将thread_ready_list队列中的第一个就绪线程弹出,准备将其调度上cpu. */
-    thread_tag = list_pop(&thread_ready_list);
-    struct task_struct *next = elem2entry(struct task_struct, general_tag, thread_tag); // 获取下一个线程pcb
-    next->status = TASK_RUNNING;                                                        // 将下一个线程状态设置为运行中
-    process_activate(next);                                                             // 激活下一个线程的页表
-    switch_to(cur, next);                                                               // 切换到下一个线程
+    if (next == cur)
+    { // 挑中的还是自己,不必切换
+        return;
+    }
+    process_activate(next); // 激活下一个线程的页表
+    switch_to(cur, next);   // 切换到下一个线程
 }
 
 void thread_block(enum task_status status)
@@ -214,15 +366,17 @@ void thread_unblock(struct task_struct *pthread)
 {
     enum intr_status old_status = intr_disable(); // 关中断
     ASSERT(pthread->status == TASK_BLOCKED || pthread->status == TASK_WAITING || pthread->status == TASK_HANGING);
-    if (pthread->status != TASK_READY)                                 // 如果线程不是就绪状态
-    {                                                                  // 将线程状态设置为就绪
-        ASSERT(!elem_find(&thread_ready_list, &pthread->general_tag)); // 确保线程不在就绪队列中
-        if (elem_find(&thread_ready_list, &pthread->general_tag))
+    if (pthread->status != TASK_READY) // 如果线程不是就绪状态
+    {
+        pthread->status = TASK_READY;           // 设置线程状态为就绪
+        enqueue_task(pthread, ENQUEUE_WAKEUP); // 调度类按睡眠补偿安放被唤醒的任务
+        pthread->wakeup_tsc = rdtsc32() | 1;   // 最低位置1,避免与表示未被唤醒的0混淆
+
+        /* 这里可能在中断处理或信号量操作的中途,不能立即调度,先记下,到抢占点再调度 */
+        if (wakeup_preempt(running_thread(), pthread))
         {
-            PANIC("thread_unblock: blocked thread in ready_list\n"); // 如果线程在就绪队列中，报错
+            need_resched = true;
         }
-        list_push(&thread_ready_list, &pthread->general_tag); // 将线程添加到就绪队列
-        pthread->status = TASK_READY;                         // 设置线程状态为就绪
     }
 
     intr_set_status(old_status); // 恢复中断状态
@@ -232,16 +386,152 @@ void thread_yield(void)
 {
     struct task_struct *cur_thread = running_thread();                // 获取当前线程pcb
     enum intr_status old_status = intr_disable();                     // 关中断
-    ASSERT(!elem_find(&thread_ready_list, &cur_thread->general_tag)); // 确保当前线程不在就绪队列中
 
-    cur_thread->status = TASK_READY;                           // 将当前线程状态设置为就绪
-    list_append(&thread_ready_list, &cur_thread->general_tag); // 将当前线程添加到就绪队列
+    cur_thread->status = TASK_READY;       // 将当前线程状态设置为就绪
+    enqueue_task(cur_thread, ENQUEUE_YIELD); // 主动让出cpu,排到同类其它就绪任务之后
 
     schedule(); // 调度下一个线程
 
     intr_set_status(old_status); // 恢复中断状态
 }
 
+/* 时钟中断中记账,由当前任务的调度类决定是否让出cpu */
+void thread_tick(void)
+{
+    struct task_struct *cur_thread = running_thread();
+    cur_thread->elapsed_ticks++; // 增加已运行的时间片数
+    cur_thread->slice_ticks++;
+    if (cur_thread->sched_class->tick(cur_thread) || need_resched)
+    {
+        schedule(); // 调度下一个线程
+    }
+}
+
+/* 抢占点:之前唤醒的任务应抢占当前任务时立即调度.
+ * 由中断处理程序在处理完设备后、sema_up在信号量状态一致后调用,须在关中断时调用 */
+void thread_preempt(void)
+{
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (need_resched && running_thread()->status == TASK_RUNNING)
+    {
+        schedule();
+    }
+}
+
+/* 找到pid对应的任务,找不到返回NULL.须在关中断时调用 */
+static struct task_struct *pid2thread(pid_t pid)
+{
+    struct list_elem *elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, elem);
+        if (pthread->pid == pid)
+        {
+            return pthread;
+        }
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/* 把pthread的nice值设为nice(截到NICE_MIN~NICE_MAX).就绪的任务先摘下再放回,
+ * 让调度类按新权重记账.须在关中断时调用 */
+static void nice_set(struct task_struct *pthread, int32_t nice)
+{
+    nice = nice < NICE_MIN ? NICE_MIN : (nice > NICE_MAX ? NICE_MAX : nice);
+    if (pthread->status == TASK_READY)
+    {
+        dequeue_task(pthread);
+        pthread->nice = nice;
+        enqueue_task(pthread, 0);
+    }
+    else
+    {
+        pthread->nice = nice;
+    }
+}
+
+/* 把当前任务的nice值加上increment,返回新的nice值 */
+int32_t sys_nice(int32_t increment)
+{
+    struct task_struct *cur = running_thread();
+    enum intr_status old_status = intr_disable();
+    nice_set(cur, cur->nice + increment);
+    intr_set_status(old_status);
+    return cur->nice;
+}
+
+/* 把pid为pid的任务(pid为0时是当前任务)的nice值设为nice,成功返回0,找不到任务返回-1 */
+int32_t sys_setpriority(pid_t pid, int32_t nice)
+{
+    enum intr_status old_status = intr_disable();
+    struct task_struct *pthread = pid == 0 ? running_thread() : pid2thread(pid);
+    if (pthread != NULL && pthread != idle_thread)
+    {
+        nice_set(pthread, nice);
+    }
+    intr_set_status(old_status);
+    return pthread != NULL && pthread != idle_thread ? 0 : -1;
+}
+
+/* 把pthread的调度策略设为policy,优先级为priority,调度类随之改变.
+ * 就绪的任务先从原调度类摘下再放进新调度类.须在关中断时调用 */
+static void policy_set(struct task_struct *pthread, uint8_t policy, uint8_t priority)
+{
+    bool ready = pthread->status == TASK_READY;
+    if (ready)
+    {
+        dequeue_task(pthread);
+    }
+    pthread->policy = policy;
+    pthread->rt_priority = policy == SCHED_NORMAL ? 0 : priority;
+    pthread->sched_class = policy == SCHED_NORMAL ? &fair_sched_class : &rt_sched_class;
+    if (ready)
+    {
+        enqueue_task(pthread, 0);
+    }
+
+    /* 就绪的任务可能因此高过当前任务,当前任务也可能因此低过就绪的任务,都交给schedule重新挑选 */
+    if (ready ? wakeup_preempt(running_thread(), pthread) : pthread == running_thread())
+    {
+        need_resched = true;
+    }
+}
+
+/* 把pid为pid的任务(pid为0时是当前任务)的调度策略设为policy.实时策略的priority须在1~RT_PRIO_MAX,
+ * SCHED_NORMAL忽略priority.成功返回0,参数不对或找不到任务返回-1 */
+int32_t sys_sched_setscheduler(pid_t pid, uint8_t policy, uint8_t priority)
+{
+    if (policy != SCHED_NORMAL && policy != SCHED_FIFO && policy != SCHED_RR)
+    {
+        return -1;
+    }
+    if (policy != SCHED_NORMAL && (priority == 0 || priority > RT_PRIO_MAX))
+    {
+        return -1;
+    }
+    enum intr_status old_status = intr_disable();
+    struct task_struct *pthread = pid == 0 ? running_thread() : pid2thread(pid);
+    if (pthread == NULL || pthread == idle_thread)
+    {
+        intr_set_status(old_status);
+        return -1;
+    }
+    policy_set(pthread, policy, priority);
+    thread_preempt();
+    intr_set_status(old_status);
+    return 0;
+}
+
+/* 打印一个调度类的唤醒延迟统计 */
+static void wakeup_latency_print(char *name, struct wakeup_latency *lat)
+{
+    char buf[96];
+    uint32_t len = sprintf(buf, "wakeup latency %s: %d wakeups, avg %d kcycles, max %d cycles\n", name,
+                           lat->cnt, lat->cnt == 0 ? 0 : lat->total_kcycles / lat->cnt, lat->max_cycles);
+    sys_write(stdout_no, buf, len);
+}
+
 /* 以填充空格的方式输出buf */
 static void pad_print(char *buf, int32_t buf_len, void *ptr, char format)
 {
@@ -318,19 +608,36 @@ void sys_ps(void)
     char *ps_title = "PID            PPID           STAT           TICKS          COMMAND\n";
     sys_write(stdout_no, ps_title, strlen(ps_title));
     list_traversal(&thread_all_list, elem2thread_info, 0);
+    wakeup_latency_print("rt", &rt_latency);
+    wakeup_latency_print("fair", &fair_latency);
+    timer_info();
 }
 
 void thread_init(void)
 {
     put_str("thread_init start\n");
-    list_init(&thread_ready_list); // 初始化就绪线程队列
+    sched_rt_init();   // 初始化实时调度类的就绪队列
+    sched_fair_init(); // 初始化公平调度类的就绪队列
+    nr_ready = 0;
     list_init(&thread_all_list);   // 初始化所有线程队列
     lock_init(&pid_lock);          // 初始化pid锁
 
+    /* pcb所在页的顶端是内核栈,running_thread靠esp取整页定位pcb,故按整页分配 */
+    task_cache = kmem_cache_create("task_struct", PG_SIZE, NULL);
+    if (task_cache == NULL)
+    {
+        PANIC("thread_init: create task_cache failed");
+    }
+
     process_execute(init, "init"); // 创建init进程
     make_main_thread();            // 创建主线程
 
-    idle_thread = thread_start("idle", 10, idle, NULL); // 创建空闲线程
+    /* 空闲线程属于空闲调度类,只在没有其它任务就绪时运行 */
+    idle_thread = kmem_cache_alloc(task_cache);
+    init_thread(idle_thread, "idle", NICE_MAX);
+    thread_create(idle_thread, idle, NULL);
+    idle_thread->sched_class = &idle_sched_class;
+    list_append(&thread_all_list, &idle_thread->all_list_tag);
 
     put_str("thread_init done\n");
 }
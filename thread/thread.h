@@ -3,6 +3,7 @@
 #include "../lib/stdint.h"
 #include "../lib/kernel/list.h"
 #include "../lib/kernel/bitmap.h"
+#include "../lib/kernel/rbtree.h"
 #include "../kernel/memory.h"
 
 #define TASK_NAME_LEN 16
@@ -11,8 +12,14 @@
 /* 自定义通用函数类型,它将在很多线程函数中做为形参类型 */
 typedef void thread_func(void *);
 
+struct sched_class;
+
 typedef int16_t pid_t; // 定义pid_t为int16_t类型,用于表示进程或线程的ID
 
+/* nice值的范围,越小优先级越高,决定任务在公平调度类中的权重 */
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+
 /* 进程或线程的状态 */
 enum task_status
 {
@@ -87,33 +94,48 @@ struct task_struct
     pid_t pid;             // 线程或进程的ID
     enum task_status status;
     char name[16];
-    uint8_t priority;                          // 线程优先级
-    uint32_t ticks;                            // 线程的时间片
+    int8_t nice;                               // nice值,越小优先级越高
+    uint8_t policy;                            // 调度策略,SCHED_NORMAL、SCHED_FIFO或SCHED_RR
+    uint8_t rt_priority;                       // 实时策略的优先级,1~RT_PRIO_MAX
+    const struct sched_class *sched_class;     // 任务所属的调度类,由policy决定
+    struct rb_node run_node;                   // 就绪时挂在公平调度类的红黑树上
+    uint64_t vruntime;                         // 按权重折算的虚拟运行时间
+    uint32_t slice_ticks;                      // 本次被调度上cpu后已连续运行的嘀嗒数
+    uint32_t wakeup_tsc;                       // 被唤醒时时间戳计数器的低32位,为0表示不是被唤醒的
     uint32_t elapsed_ticks;                    // 线程已运行的时间片数
     int32_t fd_table[MAX_FILES_OPEN_PER_PROC]; // 线程打开的文件描述符表,每个线程最多打开8个文件
     struct list_elem general_tag;              // 用于线程的通用链表
     struct list_elem all_list_tag;             // 用于所有线程的链表
 
     uint32_t *pgdir;                              // 进程页目录的虚拟地址,用于页表切换
-    struct virtual_addr userprog_vaddr;           // 用户进程的虚拟地址池
+    struct list vma_list;                         // 用户进程已占用的虚拟地址区域,按起始地址排序
+    uint32_t brk_start;                           // 用户堆的起始地址,紧接在程序段之后
+    uint32_t brk;                                 // 用户堆的当前堆顶,[brk_start, brk)向上取整到页即堆区域
     struct mem_block_desc u_block_desc[DESC_CNT]; // 用户进程的内存块描述符数组
+    struct mem_magazine mem_mags[DESC_CNT];       // 本任务各规格内存块的magazine
     uint32_t cwd_inode_nr;                        // 当前工作目录的i结点号
     int16_t parent_pid;                           // 父进程的pid,如果是内核线程则为-1
     uint32_t stack_magic;                         // 用这串数字做栈的边界标记,用于检测栈的溢出
 };
 
-extern struct list thread_ready_list; // 就绪线程队列
 extern struct list thread_all_list;   // 所有线程队列
+extern struct kmem_cache *task_cache; // pcb的对象缓存
 
 void thread_create(struct task_struct *pthread, thread_func function, void *func_arg);
-void init_thread(struct task_struct *pthread, char *name, int prio);
-struct task_struct *thread_start(char *name, int prio, thread_func function, void *func_arg);
+void init_thread(struct task_struct *pthread, char *name, int nice);
+struct task_struct *thread_start(char *name, int nice, thread_func function, void *func_arg);
 struct task_struct *running_thread(void);
 void schedule(void);
 void thread_block(enum task_status status);
 void thread_unblock(struct task_struct *pthread);
 void thread_init(void);
 void thread_yield(void);
+void thread_ready(struct task_struct *pthread);
+void thread_tick(void);
+int32_t sys_nice(int32_t increment);
+int32_t sys_setpriority(pid_t pid, int32_t nice);
+int32_t sys_sched_setscheduler(pid_t pid, uint8_t policy, uint8_t priority);
+void thread_preempt(void);
 pid_t fork_pid(void);
 void sys_ps(void);
 
@@ -5,6 +5,8 @@
 #include "../lib/string.h"
 #include "../kernel/global.h"
 #include "../kernel/memory.h"
+#include "../kernel/vma.h"
+#include "process.h"
 
 extern void intr_exit(void);
 typedef uint32_t Elf32_Word, Elf32_Addr, Elf32_Off;
@@ -42,6 +44,11 @@ struct Elf32_Phdr
     Elf32_Word p_align;
 };
 
+/* 段权限,p_flags中的位 */
+#define PF_X 1 // 可执行
+#define PF_W 2 // 可写
+#define PF_R 4 // 可读
+
 /* 段类型 */
 enum segment_type
 {
@@ -54,55 +61,99 @@ enum segment_type
     PT_PHDR     // 程序头表
 };
 
-/* 将文件描述符fd指向的文件中,偏移为offset,大小为filesz的段加载到虚拟地址为vaddr的内存 */
-static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t vaddr)
+/* 检查可加载段的大小和地址范围是否落在用户空间中,释放旧程序之前先检查完所有段 */
+static bool segment_check(struct Elf32_Phdr *phdr)
+{
+    return phdr->p_memsz >= phdr->p_filesz && (phdr->p_vaddr & 0xfffff000) >= USER_VADDR_START &&
+           phdr->p_vaddr + phdr->p_memsz <= 0xc0000000 && phdr->p_vaddr + phdr->p_memsz >= phdr->p_vaddr;
+}
+
+/* 将文件描述符fd指向的文件中,偏移为offset,大小为filesz的段加载到虚拟地址为vaddr,大小为memsz的内存.
+ * 段已经segment_check检查过,旧程序的用户空间已经释放.
+ * 段所占的页记录为进程的一个区域,被文件数据整页写满的页预先成段映射,其余的页在首次访问时由缺页异常按需映射 */
+static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t memsz, uint32_t vaddr, uint32_t flags)
 {
-    uint32_t vaddr_first_page = vaddr & 0xfffff000;               // vaddr地址所在的页框
-    uint32_t size_in_first_page = PG_SIZE - (vaddr & 0x00000fff); // 加载到内存后,文件在第一个页框中占用的字节大小
-    uint32_t occupy_pages = 0;
-    /* 若一个页框容不下该段 */
-    if (filesz > size_in_first_page)
+    struct task_struct *cur = running_thread();
+    uint32_t vaddr_first_page = vaddr & 0xfffff000; // vaddr地址所在的页框
+    if (memsz == 0)
     {
-        uint32_t left_size = filesz - size_in_first_page;
-        occupy_pages = DIV_ROUND_UP(left_size, PG_SIZE) + 1; // 1是指vaddr_first_page
+        return true;
     }
-    else
+    uint32_t occupy_pages = DIV_ROUND_UP(vaddr + memsz - vaddr_first_page, PG_SIZE);
+
+    /* 按段的权限记录区域,段之间共用的页先去掉前一段记录的部分 */
+    uint32_t vaddr_end = vaddr_first_page + occupy_pages * PG_SIZE;
+    uint8_t prot = (flags & PF_R ? VM_READ : 0) | (flags & PF_W ? VM_WRITE : 0) | (flags & PF_X ? VM_EXEC : 0);
+    if (!vma_remove(&cur->vma_list, vaddr_first_page, vaddr_end) ||
+        !vma_add(&cur->vma_list, vaddr_first_page, vaddr_end, prot, VMA_ELF))
     {
-        occupy_pages = 1;
+        return false;
     }
 
-    /* 为进程分配内存 */
-    uint32_t page_idx = 0;
-    uint32_t vaddr_page = vaddr_first_page;
-    while (page_idx < occupy_pages)
+    /* 被文件数据整页写满的页先成段装好物理页,省去读入时逐页的缺页和清0.
+     * 首尾只写了一部分的页仍在缺页时分配清0的页,不会把旧数据留给进程 */
+    uint32_t data_first_page = (vaddr + PG_SIZE - 1) & 0xfffff000, data_end_page = (vaddr + filesz) & 0xfffff000;
+    if (data_end_page > data_first_page)
+    {
+        populate_user_pages(data_first_page, (data_end_page - data_first_page) / PG_SIZE);
+    }
+    /* 预先装好的页不清0,没能读满就不能把它们交给进程 */
+    sys_lseek(fd, offset, SEEK_SET);
+    if (filesz > 0 && sys_read(fd, (void *)vaddr, filesz) != (int32_t)filesz)
     {
-        uint32_t *pde = pde_ptr(vaddr_page);
-        uint32_t *pte = pte_ptr(vaddr_page);
+        return false;
+    }
 
-        /* 如果pde不存在,或者pte不存在就分配内存.
-         * pde的判断要在pte之前,否则pde若不存在会导致
-         * 判断pte时缺页异常 */
-        if (!(*pde & 0x00000001) || !(*pte & 0x00000001))
+    /* .bss部分中已映射的页(与文件数据或前一段同页的页)要清0,
+     * 未映射的页缺页时分配的就是0页,不去访问它们,以免提前分配物理页 */
+    uint32_t bss_start = vaddr + filesz, bss_end = vaddr + memsz;
+    while (bss_start < bss_end)
+    {
+        uint32_t chunk_end = (bss_start & 0xfffff000) + PG_SIZE;
+        if (chunk_end > bss_end)
         {
-            if (get_a_page(PF_USER, vaddr_page) == NULL)
-            {
-                return false;
-            }
-        } // 如果原进程的页表已经分配了,利用现有的物理页,直接覆盖进程体
-        vaddr_page += PG_SIZE;
-        page_idx++;
+            chunk_end = bss_end;
+        }
+        if (page_present(bss_start))
+        {
+            memset((void *)bss_start, 0, chunk_end - bss_start);
+        }
+        bss_start = chunk_end;
     }
-    sys_lseek(fd, offset, SEEK_SET);
-    sys_read(fd, (void *)vaddr, filesz);
     return true;
 }
 
-/* 从文件系统上加载用户程序pathname,成功则返回程序的起始地址,否则返回-1 */
-static int32_t load(const char *pathname)
+/* exec在旧程序的用户空间释放之后失败,进程已没有可以返回的程序.
+ * 没有exit,只能释放已加载的部分,让进程永远阻塞,不再被调度.
+ * 路径可能就在已释放的用户空间中,不能再访问,只打印进程原来的名字 */
+static void exec_abort(void)
+{
+    struct task_struct *cur = running_thread();
+    user_image_release();
+    printk("exec: %s (pid %d) failed after its old program was released, hanging\n", cur->name, cur->pid);
+    while (1)
+    {
+        thread_block(TASK_HANGING);
+    }
+}
+
+/* 读出文件fd中偏移为offset的程序头 */
+static bool prog_header_read(int32_t fd, uint32_t offset, struct Elf32_Phdr *prog_header)
+{
+    memset(prog_header, 0, sizeof(struct Elf32_Phdr));
+    sys_lseek(fd, offset, SEEK_SET);
+    return sys_read(fd, prog_header, sizeof(struct Elf32_Phdr)) == sizeof(struct Elf32_Phdr);
+}
+
+/* 从文件系统上加载用户程序pathname替换当前进程的用户空间,成功则返回程序的起始地址,
+ * 并在*brk_start中返回程序段之后按页对齐的堆起始地址.
+ * 程序头都检查过才释放旧程序,此前的失败返回-1,旧程序不受影响;此后的失败由exec_abort处理,不再返回 */
+static int32_t load(const char *pathname, uint32_t *brk_start)
 {
     int32_t ret = -1;
     struct Elf32_Ehdr elf_header;
     struct Elf32_Phdr prog_header;
+    bool released = false;
     memset(&elf_header, 0, sizeof(struct Elf32_Ehdr));
 
     int32_t fd = sys_open(pathname, O_RDONLY);
@@ -113,82 +164,156 @@ static int32_t load(const char *pathname)
 
     if (sys_read(fd, &elf_header, sizeof(struct Elf32_Ehdr)) != sizeof(struct Elf32_Ehdr))
     {
-        ret = -1;
         goto done;
     }
 
     /* 校验elf头 */
     if (memcmp(elf_header.e_ident, "\177ELF\1\1\1", 7) || elf_header.e_type != 2 || elf_header.e_machine != 3 || elf_header.e_version != 1 || elf_header.e_phnum > 1024 || elf_header.e_phentsize != sizeof(struct Elf32_Phdr))
     {
-        ret = -1;
         goto done;
     }
 
-    Elf32_Off prog_header_offset = elf_header.e_phoff;
-    Elf32_Half prog_header_size = elf_header.e_phentsize;
-
-    /* 遍历所有程序头 */
-    uint32_t prog_idx = 0;
-    while (prog_idx < elf_header.e_phnum)
+    /* 第一遍只读取并检查所有程序头,旧程序还在,失败可以返回 */
+    uint32_t prog_idx;
+    for (prog_idx = 0; prog_idx < elf_header.e_phnum; prog_idx++)
     {
-        memset(&prog_header, 0, prog_header_size);
+        if (!prog_header_read(fd, elf_header.e_phoff + prog_idx * elf_header.e_phentsize, &prog_header) ||
+            (PT_LOAD == prog_header.p_type && !segment_check(&prog_header)))
+        {
+            goto done;
+        }
+    }
 
-        /* 将文件的指针定位到程序头 */
-        sys_lseek(fd, prog_header_offset, SEEK_SET);
+    /* 旧程序的程序段、堆、匿名内存和文件映射都随之作废 */
+    user_image_release();
+    released = true;
 
-        /* 只获取程序头 */
-        if (sys_read(fd, &prog_header, prog_header_size) != prog_header_size)
+    /* 第二遍把可加载段加载到内存 */
+    uint32_t seg_end = USER_VADDR_START;
+    for (prog_idx = 0; prog_idx < elf_header.e_phnum; prog_idx++)
+    {
+        if (!prog_header_read(fd, elf_header.e_phoff + prog_idx * elf_header.e_phentsize, &prog_header))
         {
-            ret = -1;
             goto done;
         }
-
-        /* 如果是可加载段就调用segment_load加载到内存 */
         if (PT_LOAD == prog_header.p_type)
         {
-            if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, prog_header.p_vaddr))
+            if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, prog_header.p_memsz, prog_header.p_vaddr, prog_header.p_flags))
             {
-                ret = -1;
                 goto done;
             }
+            if (prog_header.p_vaddr + prog_header.p_memsz > seg_end)
+            {
+                seg_end = prog_header.p_vaddr + prog_header.p_memsz;
+            }
         }
-
-        /* 更新下一个程序头的偏移 */
-        prog_header_offset += elf_header.e_phentsize;
-        prog_idx++;
     }
     ret = elf_header.e_entry;
+    *brk_start = (seg_end + PG_SIZE - 1) & 0xfffff000;
 done:
     sys_close(fd);
+    if (ret == -1 && released)
+    {
+        exec_abort();
+    }
     return ret;
 }
 
+/* 把argv的argc个参数复制到新申请的用户页框中,作为新程序用户栈的顶页USER_STACK3_VADDR.
+ * 页的末尾依次是以NULL结尾的argv指针数组和各参数字符串,其余部分清0.
+ * 参数要在加载新程序之前取走,因为它们可能就在要被覆盖的旧进程体中.
+ * 成功返回页框的物理地址,并在*uargv中返回新程序中argv数组的地址;参数放不进一页或内存不足时返回0 */
+static uint32_t args_page_build(const char *argv[], uint32_t argc, uint32_t *uargv)
+{
+    if (argc >= PG_SIZE / sizeof(char *))
+    {
+        return 0;
+    }
+    uint32_t size = (argc + 1) * sizeof(char *), idx;
+    for (idx = 0; idx < argc && size <= PG_SIZE; idx++)
+    {
+        size += strlen(argv[idx]) + 1;
+    }
+    size = (size + 3) & ~3; // 栈顶按4字节对齐
+    if (size > PG_SIZE)
+    {
+        return 0;
+    }
+
+    /* 参数先复制到内核缓冲区:申请页框时可能换出参数所在的用户页,
+     * 而持有临时映射窗口时不能缺页去读交换区 */
+    char *buf = get_kernel_pages_flags(1, AF_NOZERO);
+    if (buf == NULL)
+    {
+        return 0;
+    }
+    uint32_t offset = PG_SIZE - size, str_offset = offset + (argc + 1) * sizeof(char *);
+    uint32_t *argv_array = (uint32_t *)(buf + offset);
+    for (idx = 0; idx < argc; idx++)
+    {
+        strcpy(buf + str_offset, argv[idx]);
+        argv_array[idx] = USER_STACK3_VADDR + str_offset;
+        str_offset += strlen(argv[idx]) + 1;
+    }
+    argv_array[argc] = 0;
+    memset(buf + str_offset, 0, PG_SIZE - str_offset); // 对齐补上的字节
+
+    uint32_t arg_page = user_frame_alloc();
+    if (arg_page != 0)
+    {
+        /* 新页框还没有映射到任何地址空间,经临时映射窗口填写 */
+        char *page = kmap_atomic(arg_page, KM_DST);
+        memset(page, 0, offset);
+        memcpy(page + offset, buf + offset, size);
+        kunmap_atomic(page, KM_DST);
+        *uargv = USER_STACK3_VADDR + offset;
+    }
+    free_kernel_pages(buf, 1);
+    return arg_page;
+}
+
 /* 用path指向的程序替换当前进程 */
 int32_t sys_execv(const char *path, const char *argv[])
 {
-    uint32_t argc = 0;
+    uint32_t argc = 0, uargv, brk_start;
     while (argv[argc])
     {
         argc++;
     }
-    int32_t entry_point = load(path);
+    uint32_t arg_page = args_page_build(argv, argc, &uargv);
+    if (arg_page == 0)
+    {
+        return -1;
+    }
+    /* 新进程名同样要在释放旧程序之前取走 */
+    char name[TASK_NAME_LEN];
+    memcpy(name, path, TASK_NAME_LEN);
+    name[TASK_NAME_LEN - 1] = 0;
+    int32_t entry_point = load(path, &brk_start);
     if (entry_point == -1)
-    { // 若加载失败则返回-1
+    { // 旧程序还在,加载失败则返回-1
+        user_frame_free(arg_page);
         return -1;
     }
-
     struct task_struct *cur = running_thread();
+    cur->brk_start = cur->brk = brk_start;
+
+    /* 参数页装为栈顶页,旧的栈页已随旧程序释放 */
+    if (!user_page_install(USER_STACK3_VADDR, arg_page))
+    {
+        exec_abort();
+    }
+
     /* 修改进程名 */
-    memcpy(cur->name, path, TASK_NAME_LEN);
-    cur->name[TASK_NAME_LEN - 1] = 0;
+    memcpy(cur->name, name, TASK_NAME_LEN);
 
     struct intr_stack *intr_0_stack = (struct intr_stack *)((uint32_t)cur + PG_SIZE - sizeof(struct intr_stack));
     /* 参数传递给用户进程 */
-    intr_0_stack->ebx = (int32_t)argv;
+    intr_0_stack->ebx = uargv;
     intr_0_stack->ecx = argc;
     intr_0_stack->eip = (void *)entry_point;
-    /* 使新用户进程的栈地址为最高用户空间地址 */
-    intr_0_stack->esp = (void *)0xc0000000;
+    /* 新用户进程的栈从参数之下开始 */
+    intr_0_stack->esp = (void *)uargv;
 
     /* exec不同于fork,为使新进程更快被执行,直接从中断返回 */
     asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(intr_0_stack) : "memory");
@@ -1,87 +1,48 @@
 #include "fork.h"
 #include "process.h"
 #include "../kernel/memory.h"
+#include "../kernel/slab.h"
+#include "../kernel/vma.h"
 #include "../kernel/interrupt.h"
 #include "../kernel/debug.h"
 #include "../thread/thread.h"
+#include "../thread/sched.h"
+#include "../lib/user/syscall.h"
 #include "../lib/string.h"
 #include "../fs/file.h"
 
 extern void intr_exit(void);
 
-/* 将父进程的pcb、虚拟地址位图拷贝给子进程 */
-static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct *child_thread, struct task_struct *parent_thread)
+/* 将父进程的pcb、虚拟地址区域拷贝给子进程 */
+static int32_t copy_pcb_vmas_stack0(struct task_struct *child_thread, struct task_struct *parent_thread)
 {
     /* a 复制pcb所在的整个页,里面包含进程pcb信息及特级0极的栈,里面包含了返回地址, 然后再单独修改个别部分 */
     memcpy(child_thread, parent_thread, PG_SIZE);
     child_thread->pid = fork_pid();
     child_thread->elapsed_ticks = 0;
     child_thread->status = TASK_READY;
-    child_thread->ticks = child_thread->priority; // 为新进程把时间片充满
+    child_thread->slice_ticks = 0; // vruntime继承自父进程,加入就绪队列时不低于min_vruntime
+    /* 实时策略不随fork继承,否则实时任务派生的计算任务会饿死所有普通任务 */
+    child_thread->policy = SCHED_NORMAL;
+    child_thread->rt_priority = 0;
+    child_thread->sched_class = &fair_sched_class;
+    child_thread->wakeup_tsc = 0;
     child_thread->parent_pid = parent_thread->pid;
     child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
+    /* 父进程的arena都拷贝到了子进程的堆中,但链在父进程pcb的描述符上,子进程从空链表开始,
+     * 往这些arena归还内存块时再收养.magazine中的内存块在子进程的堆中同样有效,照样继承 */
     block_desc_init(child_thread->u_block_desc);
-    /* b 复制父进程的虚拟地址池的位图 */
-    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-    void *vaddr_btmp = get_kernel_pages(bitmap_pg_cnt);
-    if (vaddr_btmp == NULL)
+    /* b 复制父进程的虚拟地址区域链表,memcpy过来的链表头还指向父进程的节点,先重新初始化 */
+    list_init(&child_thread->vma_list);
+    if (!vma_copy(&child_thread->vma_list, &parent_thread->vma_list))
         return -1;
-    /* 此时child_thread->userprog_vaddr.vaddr_bitmap.bits还是指向父进程虚拟地址的位图地址
-     * 下面将child_thread->userprog_vaddr.vaddr_bitmap.bits指向自己的位图vaddr_btmp */
-    memcpy(vaddr_btmp, child_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt * PG_SIZE);
-    child_thread->userprog_vaddr.vaddr_bitmap.bits = vaddr_btmp;
     /* 调试用 */
     ASSERT(strlen(child_thread->name) < 11); // pcb.name的长度是16,为避免下面strcat越界
     strcat(child_thread->name, "_fork");
     return 0;
 }
 
-/* 复制子进程的进程体(代码和数据)及用户栈 */
-static void copy_body_stack3(struct task_struct *child_thread, struct task_struct *parent_thread, void *buf_page)
-{
-    uint8_t *vaddr_btmp = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len;
-    uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start;
-    uint32_t idx_byte = 0;
-    uint32_t idx_bit = 0;
-    uint32_t prog_vaddr = 0;
-
-    /* 在父进程的用户空间中查找已有数据的页 */
-    while (idx_byte < btmp_bytes_len)
-    {
-        if (vaddr_btmp[idx_byte])
-        {
-            idx_bit = 0;
-            while (idx_bit < 8)
-            {
-                if ((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte])
-                {
-                    prog_vaddr = (idx_byte * 8 + idx_bit) * PG_SIZE + vaddr_start;
-                    /* 下面的操作是将父进程用户空间中的数据通过内核空间做中转,最终复制到子进程的用户空间 */
-
-                    /* a 将父进程在用户空间中的数据复制到内核缓冲区buf_page,
-                    目的是下面切换到子进程的页表后,还能访问到父进程的数据*/
-                    memcpy(buf_page, (void *)prog_vaddr, PG_SIZE);
-
-                    /* b 将页表切换到子进程,目的是避免下面申请内存的函数将pte及pde安装在父进程的页表中 */
-                    page_dir_activate(child_thread);
-                    /* c 申请虚拟地址prog_vaddr */
-                    get_a_page_without_opvaddrbitmap(PF_USER, prog_vaddr);
-
-                    /* d 从内核缓冲区中将父进程数据复制到子进程的用户空间 */
-                    memcpy((void *)prog_vaddr, buf_page, PG_SIZE);
-
-                    /* e 恢复父进程页表 */
-                    page_dir_activate(parent_thread);
-                }
-                idx_bit++;
-            }
-        }
-        idx_byte++;
-    }
-}
-
 /* 为子进程构建thread_stack和修改返回值 */
 static int32_t build_child_stack(struct task_struct *child_thread)
 {
@@ -134,47 +95,49 @@ static void update_inode_open_cnts(struct task_struct *thread)
     }
 }
 
-/* 拷贝父进程本身所占资源给子进程 */
+/* 拷贝父进程本身所占资源给子进程,失败时已为子进程申请的资源全部释放,只剩pcb由调用者归还 */
 static int32_t copy_process(struct task_struct *child_thread, struct task_struct *parent_thread)
 {
-    /* 内核缓冲区,作为父进程用户空间的数据复制到子进程用户空间的中转 */
-    void *buf_page = get_kernel_pages(1);
-    if (buf_page == NULL)
-    {
-        return -1;
-    }
-
-    /* a 复制父进程的pcb、虚拟地址位图、内核栈到子进程 */
-    if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1)
+    /* a 复制父进程的pcb、虚拟地址区域、内核栈到子进程 */
+    if (copy_pcb_vmas_stack0(child_thread, parent_thread) == -1)
     {
-        return -1;
+        goto fail_vmas;
     }
 
     /* b 为子进程创建页表,此页表仅包括内核空间 */
     child_thread->pgdir = create_page_dir();
     if (child_thread->pgdir == NULL)
     {
-        return -1;
+        goto fail_vmas;
     }
 
-    /* c 复制父进程进程体及用户栈给子进程 */
-    copy_body_stack3(child_thread, parent_thread, buf_page);
+    /* c 子进程以写时复制的方式共享父进程的进程体及用户栈,只复制页表.
+     * 失败时cow_share_user_pages已撤销对父进程页表的改动并归还了子进程的页表 */
+    if (!cow_share_user_pages(child_thread->pgdir))
+    {
+        goto fail_pgdir;
+    }
 
     /* d 构建子进程thread_stack和修改返回值pid */
     build_child_stack(child_thread);
 
     /* e 更新文件inode的打开数 */
     update_inode_open_cnts(child_thread);
-
-    mfree_page(PF_KERNEL, buf_page, 1);
     return 0;
+
+fail_pgdir:
+    free_kernel_pages(child_thread->pgdir, 1);
+fail_vmas:
+    /* vma_copy中途失败时已复制的区域也在链表上 */
+    vma_clear(&child_thread->vma_list);
+    return -1;
 }
 
 /* fork子进程,内核线程不可直接调用 */
 pid_t sys_fork(void)
 {
     struct task_struct *parent_thread = running_thread();
-    struct task_struct *child_thread = get_kernel_pages(1); // 为子进程创建pcb(task_struct结构)
+    struct task_struct *child_thread = kmem_cache_alloc(task_cache); // 为子进程创建pcb(task_struct结构)
     if (child_thread == NULL)
     {
         return -1;
@@ -183,14 +146,14 @@ pid_t sys_fork(void)
 
     if (copy_process(child_thread, parent_thread) == -1)
     {
+        kmem_cache_free(task_cache, child_thread);
         return -1;
     }
 
     /* 添加到就绪线程队列和所有线程队列,子进程由调试器安排运行 */
-    ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
-    list_append(&thread_ready_list, &child_thread->general_tag);
+    thread_ready(child_thread);
     ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag));
     list_append(&thread_all_list, &child_thread->all_list_tag);
 
     return child_thread->pid; // 父进程返回子进程的pid
-}
\ No newline at end of file
+}
@@ -2,16 +2,22 @@
 #include "../kernel/global.h"
 #include "../kernel/debug.h"
 #include "../kernel/memory.h"
+#include "../kernel/slab.h"
+#include "../kernel/vma.h"
 #include "../thread/thread.h"
 #include "../lib/kernel/list.h"
 #include "tss.h"
 #include "../kernel/interrupt.h"
 #include "../lib/string.h"
 #include "../device/console.h"
+#include "../device/timer.h"
+#include "../lib/kernel/stdio_kernel.h"
 
 extern void intr_exit(void);
-extern struct list thread_ready_list; // 就绪线程队列
-extern struct list thread_all_list;   // 所有线程队列
+extern struct list thread_all_list; // 所有线程队列
+
+uint32_t cr3_reload_cnt; // 切换任务时重新加载cr3(刷新tlb)的次数
+uint32_t cr3_skip_cnt;   // 切换任务时因页目录未变而省去的cr3加载次数
 
 /* 构建用户进程初始上下文信息 */
 void start_process(void *filename_)
@@ -38,7 +44,7 @@ void start_process(void *filename_)
     proc_stack->eip = function;                                                             // 设置入口函数地址
     proc_stack->cs = SELECTOR_U_CODE;                                                       // 设置代码段选择子
     proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);                        // 设置标志寄存器
-    proc_stack->esp = (void *)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE); // 设置栈顶地址
+    proc_stack->esp = (void *)(USER_STACK3_VADDR + PG_SIZE);                                // 栈页在首次压栈时由缺页异常映射
     proc_stack->ss = SELECTOR_U_DATA;
 
     asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(proc_stack) : "memory"); // 设置栈段选择子
@@ -60,10 +66,28 @@ void page_dir_activate(struct task_struct *p_thread)
         pagedir_phy_addr = addr_v2p((uint32_t)p_thread->pgdir);
     }
 
-    /* 更新页目录寄存器cr3,使新页表生效 */
+    /* 内核线程之间切换或切回同一个进程时页目录不变,重新加载cr3只会白白刷掉tlb */
+    uint32_t cur_pagedir_phy_addr;
+    asm volatile("movl %%cr3, %0" : "=r"(cur_pagedir_phy_addr));
+    if (cur_pagedir_phy_addr == pagedir_phy_addr)
+    {
+        cr3_skip_cnt++;
+        return;
+    }
+
+    /* 更新页目录寄存器cr3,使新页表生效.内核空间是全局页,其tlb表项不受影响 */
+    cr3_reload_cnt++;
     asm volatile("movl %0, %%cr3" : : "r"(pagedir_phy_addr) : "memory");
 }
 
+/* 打印切换任务时cr3的加载次数及每秒的平均次数 */
+void tlb_info(void)
+{
+    uint32_t seconds = ticks / IRQ0_FREQUENCY;
+    printk("tlb: %d cr3 reloads (%d per second), %d skipped with unchanged page dir\n",
+           cr3_reload_cnt, seconds == 0 ? cr3_reload_cnt : cr3_reload_cnt / seconds, cr3_skip_cnt);
+}
+
 void process_activate(struct task_struct *p_thread)
 {
     ASSERT(p_thread != NULL);
@@ -101,30 +125,36 @@ uint32_t *create_page_dir(void)
     return page_dir_vaddr;
 }
 
-/* 创建用户进程虚拟地址位图 */
-void create_user_vaddr_bitmap(struct task_struct *user_prog)
+/* 初始化用户进程的虚拟地址区域链表,成功返回true */
+bool user_vaddr_init(struct task_struct *user_prog)
 {
-    user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START;
-    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-    user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
-    user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
-    bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
+    list_init(&user_prog->vma_list);
+    /* 内核中的用户进程没有程序段,堆从用户程序的起始地址开始 */
+    user_prog->brk_start = user_prog->brk = USER_VADDR_START;
+
+    /* 预留用户空间顶端的USER_STACK_PAGES个虚拟页给用户栈,
+     * 这样栈向下增长时缺页异常便能识别出合法的栈地址,堆也不会分配到这里 */
+    return vma_add(&user_prog->vma_list, 0xc0000000 - USER_STACK_PAGES * PG_SIZE, 0xc0000000,
+                   VM_READ | VM_WRITE, VMA_STACK);
 }
 
 /* 创建用户进程 */
 void process_execute(void *filename, char *name)
 {
     /* pcb内核的数据结构,由内核来维护进程信息,因此要在内核内存池中申请 */
-    struct task_struct *thread = get_kernel_pages(1);
-    init_thread(thread, name, default_prio);
-    create_user_vaddr_bitmap(thread);
+    struct task_struct *thread = kmem_cache_alloc(task_cache);
+    init_thread(thread, name, default_nice);
+    if (!user_vaddr_init(thread))
+    {
+        console_put_str("process_execute: user_vaddr_init failed!\n");
+        return;
+    }
     thread_create(thread, start_process, filename); // start_process(filename)
     thread->pgdir = create_page_dir();
     block_desc_init(thread->u_block_desc); // 初始化用户进程的内存块描述符数组
 
     enum intr_status old_status = intr_disable();
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-    list_append(&thread_ready_list, &thread->general_tag);
+    thread_ready(thread);
 
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
     list_append(&thread_all_list, &thread->all_list_tag);
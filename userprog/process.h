@@ -4,15 +4,18 @@
 #include "../thread/thread.h"
 #include "../lib/stdint.h"
 
-#define default_prio 31                         // 默认优先级
+#define default_nice 0                          // 默认的nice值
 #define USER_STACK3_VADDR (0xc0000000 - 0x1000) // 用户栈的虚拟地址
+#define USER_STACK_PAGES 2048                   // 用户栈最大8M,这些虚拟页建进程时预留,访问时按需映射
 #define USER_VADDR_START 0x8048000              // 用户程序的虚拟地址起始位置
+#define USER_MMAP_BASE 0x40000000               // 匿名内存从这里向上分配,其下留给程序段和向上增长的brk堆
 
 void process_execute(void *filename, char *name);
 void start_process(void *filename_);
 void process_activate(struct task_struct *p_thread);
 void page_dir_activate(struct task_struct *p_thread);
 uint32_t *create_page_dir(void);
-void create_user_vaddr_bitmap(struct task_struct *user_prog);
+bool user_vaddr_init(struct task_struct *user_prog);
+void tlb_info(void);
 
 #endif
\ No newline at end of file
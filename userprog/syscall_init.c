@@ -6,6 +6,7 @@
 #include "../lib/string.h"
 #include "../lib/user/syscall.h"
 #include "../device/console.h"
+#include "../device/timer.h"
 #include "../fs/fs.h"
 #include "fork.h"
 #include "exec.h"
@@ -49,5 +50,13 @@ void syscall_init(void)
     syscall_table[SYS_STAT] = sys_stat;
     syscall_table[SYS_PS] = sys_ps;
     syscall_table[SYS_EXECV] = sys_execv;
+    syscall_table[SYS_MEMINFO] = sys_meminfo;
+    syscall_table[SYS_BRK] = sys_brk;
+    syscall_table[SYS_MMAP] = sys_mmap;
+    syscall_table[SYS_MUNMAP] = sys_munmap;
+    syscall_table[SYS_NICE] = sys_nice;
+    syscall_table[SYS_SETPRIORITY] = sys_setpriority;
+    syscall_table[SYS_SCHED_SETSCHEDULER] = sys_sched_setscheduler;
+    syscall_table[SYS_NANOSLEEP] = sys_nanosleep;
     put_str("syscall_init done\n");
 }
\ No newline at end of file